@@ -1,68 +1,117 @@
-import cv2
 import rospy
-import numpy
-import cv_bridge
-import rosbag
+import sensor_msgs.msg
+import mittenwire.msg
+import pymittenwire
+
+
+def _to_bag_time(t):
+    if isinstance(t, rospy.Time):
+        return pymittenwire.BagTime(t.secs, t.nsecs)
+    return pymittenwire.BagTime(float(t))
+
+
+def _to_ros_time(t):
+    return rospy.Time(t.sec, t.nsec)
 
 
 class BagImage:
-    pass
+
+    def __init__(self, image):
+        self._image = image
+        self._image_message = None
+        self._info_message = None
+        self.name = image.name
+        self.time = _to_ros_time(image.time)
+        self.stamp = _to_ros_time(image.stamp)
+        # decoded BGR image, None if decoding is off
+        self.pixels = image.pixels
+
+    # image and camera info messages, deserialized on first use
+
+    @property
+    def image(self):
+        if self._image_message is None:
+            if self._image.image_type == "sensor_msgs/CompressedImage":
+                message = sensor_msgs.msg.CompressedImage()
+            else:
+                message = sensor_msgs.msg.Image()
+            self._image_message = message.deserialize(self._image.image_data)
+        return self._image_message
+
+    @property
+    def info(self):
+        if self._info_message is None:
+            self._info_message = sensor_msgs.msg.CameraInfo().deserialize(
+                self._image.info_data)
+        return self._info_message
 
 
 class BagImageSet:
-    pass
+
+    def __init__(self, image_set):
+        self.time = _to_ros_time(image_set.time)
+        self.images = [BagImage(image) for image in image_set.images]
 
 
 class ImageBag:
+    """Iterates over the synchronized image sets of a bag, in time order.
 
-    def __init__(self, path):
+    The index comes from the bag's own index records, and a native thread
+    pool reads and decodes the next `prefetch` sets in the background, so
+    the images of each set are ready as `pixels` when it is yielded.
+    Iteration continues from the current position, which `seek` and
+    `position` change, `stride` skips sets.
+    """
+
+    def __init__(self, path, prefetch=4, stride=1, decode=True, thread_count=0):
         self.path = path
+        self.reader = pymittenwire.ImageBagReader(
+            path, prefetch, thread_count, decode)
+        self.reader.stride = stride
+        self.start_time = self.reader.start_time.to_sec()
+        self.end_time = self.reader.end_time.to_sec()
+
+    def __len__(self):
+        return len(self.reader)
 
     def __iter__(self):
-        bridge = cv_bridge.CvBridge()
-        with rosbag.Bag(self.path, "r") as bag:
-            last_time = rospy.Time(0)
-
-            image_messages = {}
-            camera_info_messages = {}
-
-            bag_start_time = bag.get_start_time()
-            bag_end_time = bag.get_end_time()
-
-            self.start_time = bag_start_time
-            self.end_time = bag_end_time
-
-            for topic, message, mtime in bag:
-
-                if mtime != last_time:
-
-                    bag_images = []
-                    for name in (image_messages.keys() & camera_info_messages.keys()):
-                        image_time, image_message = image_messages[name]
-                        info_time, info_message = camera_info_messages[name]
-                        if image_time == info_time:
-                            b = BagImage()
-                            b.time = last_time
-                            b.name = name
-                            b.image = image_message
-                            b.info = info_message
-                            bag_images.append(b)
-                    if len(bag_images) > 0:
-                        bag_images = sorted(
-                            bag_images, key=lambda img: img.name)
-                        image_set = BagImageSet()
-                        image_set.images = bag_images
-                        image_set.time = last_time
-                        yield image_set
-
-                    last_time = mtime
-                    image_messages = {}
-                    camera_info_messages = {}
-
-                if topic.endswith("/image_raw/compressed"):
-                    image_messages[topic[:-
-                                         len("/image_raw/compressed")]] = (mtime, message)
-
-                if topic.endswith("/camera_info"):
-                    camera_info_messages[topic[:-
-                                               len("/camera_info")]] = (mtime, message)
+        while True:
+            image_set = self.reader.next()
+            if image_set is None:
+                return
+            yield BagImageSet(image_set)
+
+    @property
+    def position(self):
+        return self.reader.position
+
+    @position.setter
+    def position(self, index):
+        self.reader.position = index
+
+    @property
+    def stride(self):
+        return self.reader.stride
+
+    @stride.setter
+    def stride(self, stride):
+        self.reader.stride = stride
+
+    def seek(self, time):
+        """Continues with the first set at or after time, a rospy.Time or
+        seconds."""
+        self.reader.seek(_to_bag_time(time))
+
+    def messages(self, topic, message_type, begin, end):
+        """(time, message) pairs of a topic in [begin, end)."""
+        return [(_to_ros_time(t), message_type().deserialize(data))
+                for t, data in self.reader.messages(
+                    topic, _to_bag_time(begin), _to_bag_time(end))]
+
+    def tactile(self, begin, end):
+        return self.messages("/impedance_matrix",
+                             mittenwire.msg.ImpedanceMatrix, begin, end)
+
+    def status(self, begin, end):
+        return self.messages("/glove_status",
+                             mittenwire.msg.GloveStatus, begin, end)
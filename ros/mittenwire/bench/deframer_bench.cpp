@@ -0,0 +1,157 @@
+// (c) 2023-2024 Philipp Ruppel
+
+// Compares the bulk deframer against the previous word-at-a-time loop.
+
+#include <deframer.hpp>
+
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace mittenwire;
+
+typedef std::vector<std::vector<uint32_t>> TransferList;
+
+static TransferList make_stream(size_t total_words, size_t transfer_words) {
+  std::mt19937 rng(7);
+  std::vector<uint32_t> stream;
+  stream.reserve(total_words + 1024);
+  while (stream.size() < total_words) {
+    if (rng() % 1000 == 0) {
+      stream.push_back(rng() & 0xff00ffff);
+    }
+    uint32_t channel = rng() % 8;
+    uint32_t len64 = 9;
+    if (rng() % 8 == 0) {
+      len64 = rng() % 256;
+    }
+    uint32_t end = (rng() % 4 != 0);
+    stream.push_back(0x23010000 | (end << 12) | (channel << 8) | len64);
+    for (size_t i = 0; i < len64 * 2; i++) {
+      stream.push_back(rng());
+    }
+  }
+  TransferList transfers;
+  for (size_t i = 0; i < stream.size(); i += transfer_words) {
+    transfers.emplace_back(
+        stream.begin() + i,
+        stream.begin() + std::min(stream.size(), i + transfer_words));
+  }
+  return transfers;
+}
+
+static void legacy_deframe(const TransferList &transfers,
+                           std::vector<Packet> &packets) {
+  size_t itransfer = 0;
+  size_t recv_index = 0;
+  size_t transfer_index = 0;
+  bool eof = false;
+  auto _recv = [&]() -> uint32_t {
+    while (true) {
+      if (itransfer >= transfers.size()) {
+        eof = true;
+        return 0;
+      }
+      if (recv_index < transfers[itransfer].size()) {
+        if (recv_index == 0) transfer_index++;
+        return transfers[itransfer][recv_index++];
+      }
+      itransfer++;
+      recv_index = 0;
+    }
+  };
+  struct PacketBuffer {
+    std::vector<uint32_t> data;
+    size_t start_transfer = 0;
+  };
+  std::vector<PacketBuffer> packet_buffers(16);
+  while (true) {
+    uint32_t header = _recv();
+    if (eof) break;
+    if ((header & 0xffff0000) == 0x23010000) {
+      size_t len64 = (header & 0xff);
+      size_t channel = ((header >> 8) & 15);
+      bool end = ((header >> 12) & 1);
+      auto &pbuf = packet_buffers.at(channel);
+      if (pbuf.data.empty()) {
+        pbuf.start_transfer = transfer_index;
+      }
+      for (size_t i = 0; i < len64; i++) {
+        pbuf.data.push_back(_recv());
+        pbuf.data.push_back(_recv());
+      }
+      if (eof) break;
+      if (end) {
+        size_t bytecount = pbuf.data.size() * 4;
+        packets.emplace_back();
+        Packet &msg = packets.back();
+        msg.channel = channel;
+        msg.data.assign((const uint8_t *)pbuf.data.data(),
+                        (const uint8_t *)pbuf.data.data() + bytecount);
+        if (pbuf.start_transfer != transfer_index) {
+          msg.flags |= 64;
+        }
+        pbuf.data.clear();
+      }
+    }
+  }
+}
+
+static void bulk_deframe(const TransferList &transfers,
+                         std::vector<Packet> &packets) {
+  Deframer deframer;
+  for (auto &transfer : transfers) {
+    deframer.process(transfer.data(), transfer.size(), packets);
+  }
+}
+
+template <class F>
+static double measure(const char *name, const TransferList &transfers,
+                      size_t bytes, F f, std::vector<Packet> &packets) {
+  double best = 1e9;
+  for (size_t iteration = 0; iteration < 5; iteration++) {
+    packets.clear();
+    packets.reserve(bytes / 64);
+    auto start = std::chrono::steady_clock::now();
+    f(transfers, packets);
+    double t = std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+    best = std::min(best, t);
+  }
+  double rate = bytes / best * 1e-9;
+  std::cout << name << " " << rate << " GB/s " << packets.size()
+            << " packets" << std::endl;
+  return rate;
+}
+
+int main(int argc, char **argv) {
+  size_t total_words = 64 * 1024 * 1024 / 4;
+  auto transfers = make_stream(total_words, 32 * 1024 / 4);
+  size_t bytes = 0;
+  for (auto &t : transfers) bytes += t.size() * 4;
+
+  std::vector<Packet> legacy_packets, bulk_packets;
+  double legacy = measure("legacy", transfers, bytes, legacy_deframe,
+                          legacy_packets);
+  double bulk =
+      measure("bulk", transfers, bytes, bulk_deframe, bulk_packets);
+  std::cout << "speedup " << bulk / legacy << std::endl;
+
+  bool equal = (legacy_packets.size() == bulk_packets.size());
+  for (size_t i = 0; equal && i < legacy_packets.size(); i++) {
+    auto &a = legacy_packets[i];
+    auto &b = bulk_packets[i];
+    equal = (a.channel == b.channel && a.flags == b.flags &&
+             a.data.size() == b.data.size() &&
+             memcmp(a.data.data(), b.data.data(), a.data.size()) == 0);
+  }
+  if (!equal) {
+    std::cerr << "output mismatch" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,247 @@
+// (c) 2023-2024 Philipp Ruppel
+
+// Synthetic hub stream in the exact wire format parsed by Master, with camera
+// frames and tactile packets interleaved across channels and optional fault
+// injection.
+
+#pragma once
+
+#include <messages.hpp>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace mittenwire {
+
+struct StreamGeneratorConfig {
+  uint64_t seed = 1;
+  // cameras use channels [0, camera_count), tactile sensors the next
+  // tactile_count channels
+  size_t camera_count = 12;
+  size_t tactile_count = 4;
+  size_t width = 320;
+  size_t height = 240;
+  size_t frames = 20;
+  size_t tactile_matrices_per_frame = 4;
+  size_t transfer_bytes = 64 * 1024;
+  // probability per word of the word being dropped from the stream
+  double drop_word_rate = 0.0;
+  // probability per camera data packet of a payload byte being corrupted
+  // after the checksum has been computed
+  double corrupt_checksum_rate = 0.0;
+  // probability per transfer of it being cut short at a random position
+  double short_transfer_rate = 0.0;
+};
+
+struct GeneratedFrame {
+  size_t channel = 0;
+  uint32_t timestamp = 0;
+  // transfer carrying the last packet of the frame
+  size_t last_transfer = 0;
+  // pixel_hash() of the pixels a camera node should decode
+  uint64_t pixel_hash = 0;
+};
+
+struct GeneratedStream {
+  std::vector<std::vector<uint32_t>> transfers;
+  std::vector<GeneratedFrame> frames;
+  size_t bytes = 0;
+  // packets of all channels, including the image info packets
+  size_t packets = 0;
+  size_t camera_packets = 0;
+  size_t tactile_packets = 0;
+  size_t dropped_words = 0;
+  size_t corrupted_packets = 0;
+};
+
+// FNV-1a
+inline uint64_t pixel_hash(const uint8_t* data, size_t size) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+class StreamGenerator {
+  StreamGeneratorConfig _config;
+  std::mt19937_64 _rng;
+  std::vector<std::vector<std::vector<uint32_t>>> _queues;
+  std::vector<uint32_t> _stream;
+  std::vector<size_t> _frame_end_words;
+  std::vector<size_t> _channel_end_words;
+  GeneratedStream _result;
+
+  bool chance(double p) {
+    return p > 0 && std::uniform_real_distribution<double>(0, 1)(_rng) < p;
+  }
+
+  // Splits a packet into hub segments of at most 255 64-bit words.
+  void enqueue(size_t channel, const void* data, size_t size) {
+    size_t words = (size + 7) / 8 * 2;
+    std::vector<uint32_t> payload(words, 0);
+    memcpy(payload.data(), data, size);
+    size_t offset = 0;
+    do {
+      size_t len64 = std::min<size_t>((words - offset) / 2, 255);
+      uint32_t end = (offset + len64 * 2 == words);
+      std::vector<uint32_t> segment;
+      segment.push_back(0x23010000 | (end << 12) | (channel << 8) | len64);
+      segment.insert(segment.end(), payload.begin() + offset,
+                     payload.begin() + offset + len64 * 2);
+      _queues[channel].push_back(std::move(segment));
+      offset += len64 * 2;
+    } while (offset < words);
+    _result.packets++;
+  }
+
+  // returns the pixel hash
+  uint64_t make_camera_frame(size_t channel, uint32_t timestamp) {
+    ImageInfo info = {};
+    info.magic = 0x8C53;
+    info.timestamp = timestamp;
+    info.width = _config.width;
+    info.height = _config.height;
+    info.temperature = 20;
+    update_message_checksum(info);
+    enqueue(channel, &info, sizeof(info));
+
+    std::vector<uint8_t> values(_config.width * _config.height);
+    std::vector<uint8_t> pixels(values.size());
+    uint8_t prev = 0;
+    for (size_t i = 0; i < pixels.size(); i++) {
+      uint8_t value = (i % _config.width + i / _config.width + timestamp +
+                       (_rng() & 7)) &
+                      0xff;
+      values[i] = value;
+      prev = (value ^ 0b10101010) + prev * 31;
+      pixels[i] = prev;
+    }
+
+    size_t packet_count = (pixels.size() + 63) / 64;
+    for (size_t index = 1; index <= packet_count; index++) {
+      uint8_t packet[72] = {};
+      uint32_t marker = 0xBA2FA166;
+      memcpy(packet, &marker, 4);
+      size_t offset = (index - 1) * 64;
+      memcpy(packet + 4, pixels.data() + offset,
+             std::min<size_t>(64, pixels.size() - offset));
+      uint32_t checksum = index;
+      for (size_t i = 0; i < 64; i++) {
+        checksum = checksum * 41 + packet[i + 4];
+      }
+      uint32_t tail = index | ((checksum & 4095) << 20);
+      memcpy(packet + 68, &tail, 4);
+      if (chance(_config.corrupt_checksum_rate)) {
+        packet[4 + _rng() % 64] ^= 0x10;
+        _result.corrupted_packets++;
+      }
+      enqueue(channel, packet, sizeof(packet));
+      _result.camera_packets++;
+    }
+    return pixel_hash(values.data(), values.size());
+  }
+
+  void make_tactile_packets(size_t channel, uint32_t timestamp) {
+    for (size_t m = 0; m < _config.tactile_matrices_per_frame; m++) {
+      for (uint32_t index = 0; index <= 256 / 7; index++) {
+        uint32_t packet[10] = {timestamp, 0x79A90F58, 0x1e662200 | index};
+        for (size_t k = 0; k < 7; k++) {
+          packet[3 + k] = _rng();
+        }
+        enqueue(channel, packet, sizeof(packet));
+        _result.tactile_packets++;
+      }
+    }
+    uint32_t status[10] = {timestamp, 0x79A90F58, 0x8da0cdef, timestamp};
+    enqueue(channel, status, sizeof(status));
+    _result.tactile_packets++;
+  }
+
+  // Round-robin over all channels one segment at a time, the way the hub
+  // multiplexes its ports.
+  void interleave() {
+    bool any = true;
+    std::vector<size_t> positions(_queues.size(), 0);
+    while (any) {
+      any = false;
+      for (size_t c = 0; c < _queues.size(); c++) {
+        if (positions[c] < _queues[c].size()) {
+          for (uint32_t w : _queues[c][positions[c]]) {
+            if (chance(_config.drop_word_rate)) {
+              _result.dropped_words++;
+            } else {
+              _stream.push_back(w);
+            }
+          }
+          positions[c]++;
+          any = true;
+          if (positions[c] == _queues[c].size()) {
+            _channel_end_words[c] = _stream.size();
+          }
+        }
+      }
+    }
+    for (auto& q : _queues) {
+      q.clear();
+    }
+  }
+
+ public:
+  StreamGenerator(const StreamGeneratorConfig& config)
+      : _config(config), _rng(config.seed) {
+    _queues.resize(16);
+    _channel_end_words.resize(16);
+  }
+
+  GeneratedStream generate() {
+    std::vector<uint64_t> hashes(_config.camera_count);
+    for (size_t frame = 0; frame < _config.frames; frame++) {
+      uint32_t timestamp = frame + 1;
+      for (size_t c = 0; c < _config.camera_count; c++) {
+        hashes[c] = make_camera_frame(c, timestamp);
+      }
+      for (size_t t = 0; t < _config.tactile_count; t++) {
+        make_tactile_packets(_config.camera_count + t, timestamp);
+      }
+      interleave();
+      for (size_t c = 0; c < _config.camera_count; c++) {
+        GeneratedFrame f;
+        f.channel = c;
+        f.timestamp = timestamp;
+        f.pixel_hash = hashes[c];
+        _result.frames.push_back(f);
+        _frame_end_words.push_back(_channel_end_words[c]);
+      }
+    }
+
+    size_t transfer_words = _config.transfer_bytes / 4;
+    std::vector<size_t> transfer_ends;
+    size_t position = 0;
+    while (position < _stream.size()) {
+      size_t n = transfer_words;
+      if (chance(_config.short_transfer_rate)) {
+        n = 1 + _rng() % transfer_words;
+      }
+      n = std::min(n, _stream.size() - position);
+      _result.transfers.emplace_back(_stream.begin() + position,
+                                     _stream.begin() + position + n);
+      position += n;
+      transfer_ends.push_back(position);
+      _result.bytes += n * 4;
+    }
+    for (size_t i = 0; i < _result.frames.size(); i++) {
+      _result.frames[i].last_transfer =
+          std::lower_bound(transfer_ends.begin(), transfer_ends.end(),
+                           _frame_end_words[i]) -
+          transfer_ends.begin();
+    }
+    return std::move(_result);
+  }
+};
+
+}  // namespace mittenwire
\ No newline at end of file
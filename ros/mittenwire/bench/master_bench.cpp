@@ -0,0 +1,332 @@
+// (c) 2023-2024 Philipp Ruppel
+
+// Throughput and latency of the receive path on a synthetic hub stream:
+//   deframe     Deframer only
+//   reassembly  Deframer and one Camera per camera channel, inline
+//   master      Master, Hub and Camera nodes fed from memory through the
+//               Transport interface, including the packet thread hand-off
+// The first valid frame of each camera is compared against the generated
+// pixels, the exit status is 1 on a mismatch.
+//
+// usage: mittenwire_master_bench [frames] [drop_word_rate]
+//                                [corrupt_checksum_rate] [short_transfer_rate]
+
+#include "generator.hpp"
+
+#include <camera.hpp>
+#include <deframer.hpp>
+#include <hub.hpp>
+#include <log.hpp>
+#include <master.hpp>
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+using namespace mittenwire;
+
+typedef std::chrono::steady_clock Clock;
+
+// Looks up the generated frame by channel and request timestamp.
+struct FrameIndex {
+  std::map<std::pair<size_t, uint32_t>, const GeneratedFrame *> frames;
+  FrameIndex(const GeneratedStream &stream) {
+    for (auto &f : stream.frames) {
+      frames[std::make_pair(f.channel, f.timestamp)] = &f;
+    }
+  }
+  const GeneratedFrame *find(size_t channel, uint32_t timestamp) const {
+    auto it = frames.find(std::make_pair(channel, timestamp));
+    return it != frames.end() ? it->second : nullptr;
+  }
+};
+
+struct FrameStats {
+  size_t valid = 0;
+  size_t invalid = 0;
+  std::vector<double> latencies;
+  // first valid frame of each channel, checked against the generator after
+  // the timed run
+  std::map<size_t, std::shared_ptr<ImageMessage>> samples;
+  Clock::time_point last_delivery;
+
+  void add(const FrameIndex &index,
+           const std::vector<Clock::time_point> &transfer_times,
+           const std::shared_ptr<ImageMessage> &msg) {
+    auto now = Clock::now();
+    last_delivery = now;
+    (msg->valid ? valid : invalid)++;
+    if (msg->valid && !samples.count(msg->channel)) {
+      samples[msg->channel] = msg;
+    }
+    auto *frame = index.find(msg->channel, msg->request_timestamp);
+    if (frame && frame->last_transfer < transfer_times.size()) {
+      latencies.push_back(std::chrono::duration<double, std::micro>(
+                              now - transfer_times[frame->last_transfer])
+                              .count());
+    }
+  }
+
+  // false if a sampled frame differs from the generated pixels
+  bool check(const char *name, const FrameIndex &index) {
+    size_t mismatches = 0;
+    for (auto &sample : samples) {
+      auto &msg = sample.second;
+      auto *frame = index.find(msg->channel, msg->request_timestamp);
+      if (!frame ||
+          pixel_hash(msg->data.data(), msg->data.size()) != frame->pixel_hash) {
+        mismatches++;
+      }
+    }
+    std::cout << name << " pixels checked " << samples.size() << " frames "
+              << mismatches << " mismatches" << std::endl;
+    return samples.size() > 0 && mismatches == 0;
+  }
+
+  void report(const char *name) {
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+      if (latencies.empty()) return 0.0;
+      return latencies[std::min(latencies.size() - 1,
+                                size_t(p * latencies.size()))];
+    };
+    std::cout << name << " frames valid " << valid << " invalid " << invalid
+              << " latency us p50 " << percentile(0.5) << " p90 "
+              << percentile(0.9) << " p99 " << percentile(0.99) << " max "
+              << percentile(1.0) << std::endl;
+  }
+};
+
+// Packet rates of all stages are based on the generated packet count, so
+// they stay comparable when faults are injected.
+static void report_rate(const char *name, const GeneratedStream &stream,
+                        double seconds) {
+  std::cout << name << " " << stream.bytes / seconds * 1e-9 << " GB/s "
+            << stream.packets / seconds * 1e-6 << " Mpackets/s" << std::endl;
+}
+
+static void bench_deframe(const GeneratedStream &stream) {
+  double best = 1e9;
+  std::vector<Packet> packets;
+  for (size_t iteration = 0; iteration < 3; iteration++) {
+    Deframer deframer;
+    auto start = Clock::now();
+    for (auto &transfer : stream.transfers) {
+      packets.clear();
+      deframer.process(transfer.data(), transfer.size(), packets);
+    }
+    best = std::min(
+        best, std::chrono::duration<double>(Clock::now() - start).count());
+  }
+  report_rate("deframe", stream, best);
+}
+
+// returns false if the decoded pixels are wrong
+static bool bench_reassembly(const GeneratedStream &stream,
+                             const StreamGeneratorConfig &config) {
+  FrameIndex index(stream);
+  FrameStats stats;
+  std::vector<Clock::time_point> transfer_times(stream.transfers.size());
+  std::vector<std::shared_ptr<Camera>> cameras;
+  for (size_t c = 0; c < config.camera_count; c++) {
+    cameras.push_back(std::make_shared<Camera>(
+        [&](const std::shared_ptr<ImageMessage> &msg) {
+          stats.add(index, transfer_times, msg);
+        }));
+  }
+  Deframer deframer;
+  std::vector<Packet> packets;
+  auto start = Clock::now();
+  for (size_t i = 0; i < stream.transfers.size(); i++) {
+    auto &transfer = stream.transfers[i];
+    transfer_times[i] = Clock::now();
+    packets.clear();
+    deframer.process(transfer.data(), transfer.size(), packets);
+    for (auto &packet : packets) {
+      if (packet.channel < cameras.size()) {
+        cameras[packet.channel]->process_batch(PacketSpan(&packet, 1));
+      }
+    }
+  }
+  double t = std::chrono::duration<double>(Clock::now() - start).count();
+  report_rate("reassembly", stream, t);
+  stats.report("reassembly");
+  return stats.check("reassembly", index);
+}
+
+// Feeds pre-generated transfers into a reader callback from a separate
+// thread, with at most buffer_count leases outstanding like the USB reader.
+class MemoryTransport : public superspeed::Transport {
+  struct Stream : superspeed::ReaderStream,
+                  superspeed::BufferSource,
+                  std::enable_shared_from_this<Stream> {
+    const GeneratedStream *stream = nullptr;
+    std::vector<Clock::time_point> *transfer_times = nullptr;
+    std::function<void(superspeed::Buffer &&)> callback;
+    size_t buffer_count = 0;
+    size_t outstanding = 0;
+    bool exit_flag = false;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+
+    virtual void recycle(void *handle) override {
+      std::unique_lock<std::mutex> lock(mutex);
+      outstanding--;
+      condition.notify_all();
+    }
+    void run() {
+      for (size_t i = 0; i < stream->transfers.size(); i++) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          while (!exit_flag && outstanding >= buffer_count) {
+            condition.wait(lock);
+          }
+          if (exit_flag) {
+            return;
+          }
+          outstanding++;
+        }
+        auto &transfer = stream->transfers[i];
+        (*transfer_times)[i] = Clock::now();
+        callback(superspeed::Buffer(shared_from_this(), (void *)(i + 1),
+                                    (const uint8_t *)transfer.data(),
+                                    transfer.size() * 4));
+      }
+    }
+    void wait_idle() {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (outstanding > 0) {
+        condition.wait(lock);
+      }
+    }
+    virtual void stop() override {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        exit_flag = true;
+        condition.notify_all();
+      }
+      if (thread.joinable()) {
+        thread.join();
+      }
+    }
+  };
+
+ public:
+  const GeneratedStream *stream = nullptr;
+  std::vector<Clock::time_point> *transfer_times = nullptr;
+  std::shared_ptr<Stream> current;
+
+  virtual std::shared_ptr<superspeed::ReaderStream> open_reader(
+      const std::function<void(superspeed::Buffer &&)> &callback,
+      size_t buffer_count, size_t buffer_size,
+      size_t max_buffer_count) override {
+    auto s = std::make_shared<Stream>();
+    s->stream = stream;
+    s->transfer_times = transfer_times;
+    s->callback = callback;
+    s->buffer_count = buffer_count;
+    current = s;
+    return s;
+  }
+  void start() {
+    auto s = current;
+    s->thread = std::thread([s]() { s->run(); });
+  }
+  virtual void write_async(const std::string &data,
+                           const std::function<void()> &completed) override {
+    if (completed) {
+      completed();
+    }
+  }
+};
+
+// returns false if the decoded pixels are wrong
+static bool bench_master(const GeneratedStream &stream,
+                         const StreamGeneratorConfig &config) {
+  FrameIndex index(stream);
+  FrameStats stats;
+  std::mutex stats_mutex;
+  std::vector<Clock::time_point> transfer_times(stream.transfers.size());
+  size_t frame_count = 0;
+
+  auto transport = std::make_shared<MemoryTransport>();
+  transport->stream = &stream;
+  transport->transfer_times = &transfer_times;
+
+  auto master = std::make_shared<Master>(transport, 16, 256 * 1024);
+  master->set_backpressure_policy(BackpressurePolicy::Block);
+  {
+    Hub hub(master);
+    std::vector<std::shared_ptr<Camera>> cameras;
+    for (size_t c = 0; c < config.camera_count; c++) {
+      cameras.push_back(std::make_shared<Camera>(
+          [&](const std::shared_ptr<ImageMessage> &msg) {
+            std::unique_lock<std::mutex> lock(stats_mutex);
+            stats.add(index, transfer_times, msg);
+            frame_count++;
+          }));
+      hub.connect(c, cameras.back());
+    }
+
+    auto start = Clock::now();
+    transport->start();
+    transport->current->thread.join();
+    transport->current->wait_idle();
+    // the last buffer has been released once deframed, wait until nothing
+    // more arrives and time up to the last delivery
+    Clock::time_point end;
+    while (true) {
+      size_t n = 0;
+      {
+        std::unique_lock<std::mutex> lock(stats_mutex);
+        n = frame_count;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      std::unique_lock<std::mutex> lock(stats_mutex);
+      if (frame_count == n) {
+        end = n ? stats.last_delivery : Clock::now();
+        break;
+      }
+    }
+    double t = std::chrono::duration<double>(end - start).count();
+    report_rate("master", stream, t);
+    std::cout << "master dropped transfers "
+              << master->dropped_oldest_transfers() +
+                     master->dropped_newest_transfers()
+              << std::endl;
+  }
+  master.reset();
+  stats.report("master");
+  return stats.check("master", index);
+}
+
+int main(int argc, char **argv) {
+  StreamGeneratorConfig config;
+  if (argc > 1) config.frames = atoi(argv[1]);
+  if (argc > 2) config.drop_word_rate = atof(argv[2]);
+  if (argc > 3) config.corrupt_checksum_rate = atof(argv[3]);
+  if (argc > 4) config.short_transfer_rate = atof(argv[4]);
+
+  auto stream = StreamGenerator(config).generate();
+  std::cout << "stream " << stream.bytes / 1e6 << " MB "
+            << stream.transfers.size() << " transfers "
+            << stream.frames.size() << " frames " << stream.packets
+            << " packets " << stream.camera_packets << " camera packets "
+            << stream.tactile_packets << " tactile packets "
+            << stream.dropped_words << " dropped words "
+            << stream.corrupted_packets << " corrupted packets" << std::endl;
+
+  bench_deframe(stream);
+  bool ok = bench_reassembly(stream, config);
+  ok &= bench_master(stream, config);
+
+  Logger::flush();
+  return ok ? 0 : 1;
+}
\ No newline at end of file
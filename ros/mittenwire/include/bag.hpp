@@ -0,0 +1,139 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "object.hpp"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace mittenwire {
+
+struct BagTime {
+  uint32_t sec = 0;
+  uint32_t nsec = 0;
+  BagTime() {}
+  BagTime(uint32_t sec, uint32_t nsec) : sec(sec), nsec(nsec) {}
+  // system clock seconds
+  explicit BagTime(double seconds);
+  uint64_t value() const { return (uint64_t(sec) << 32) | nsec; }
+  bool operator<(const BagTime& other) const { return value() < other.value(); }
+  double seconds() const { return sec + nsec * 1e-9; }
+};
+
+// Writes uncompressed ROS bag format 2.0 files that rosbag and rqt_bag read
+// like their own. Messages are serialized by the caller straight into a
+// preallocated, page aligned chunk buffer. Each finished chunk goes to the
+// file together with its index records in a single write, the connection
+// and chunk index is appended by close(). Not thread safe, errors throw.
+class BagWriter : public Object<BagWriter> {
+  struct Connection {
+    std::string topic;
+    std::string type;
+    std::string md5sum;
+    std::string definition;
+    // entries of the current chunk, time and offset into the chunk data
+    std::vector<uint64_t> index_times;
+    std::vector<uint32_t> index_offsets;
+    bool in_chunk = false;
+  };
+  struct ChunkInfo {
+    uint64_t position = 0;
+    BagTime start;
+    BagTime end;
+    std::vector<std::pair<uint32_t, uint32_t>> counts;
+  };
+
+  std::string _path;
+  int _fd = -1;
+  uint64_t _file_size = 0;
+  size_t _chunk_threshold = 0;
+  uint8_t* _buffer = nullptr;
+  size_t _capacity = 0;
+  // bytes of the current chunk record in the buffer, including the reserved
+  // space for its header
+  size_t _fill = 0;
+  BagTime _chunk_start;
+  BagTime _chunk_end;
+  size_t _chunk_messages = 0;
+  std::vector<Connection> _connections;
+  std::vector<ChunkInfo> _chunks;
+
+  uint8_t* reserve(size_t size);
+  void write_connection(uint32_t id);
+  void write_file(const void* data, size_t size);
+  void flush_chunk();
+
+ public:
+  BagWriter(const std::string& path, size_t chunk_threshold = 4 << 20);
+  ~BagWriter();
+  uint32_t add_connection(const std::string& topic, const std::string& type,
+                          const std::string& md5sum,
+                          const std::string& definition);
+  // Appends a message record and returns where to put its size bytes of
+  // serialized data. The pointer is valid until the next call.
+  uint8_t* add_message(uint32_t connection, const BagTime& time, size_t size);
+  // Writes the pending chunk and the index and closes the file.
+  void close();
+  bool closed() const { return _fd < 0; }
+  const std::string& path() const { return _path; }
+  // bytes in the file so far, the pending chunk not included
+  uint64_t bytes_written() const { return _file_size; }
+};
+
+struct BagConnectionInfo {
+  std::string topic;
+  std::string type;
+  std::string md5sum;
+  std::string definition;
+};
+
+struct BagMessageInfo {
+  BagTime time;
+  uint32_t connection = 0;
+  // file offset of the message record
+  uint64_t position = 0;
+};
+
+// Random access to indexed ROS bag format 2.0 files with uncompressed chunks,
+// like those written by BagWriter and rosbag record. The constructor builds
+// the time index of all messages from the bag's connection, chunk info and
+// index records without touching message data, read() then fetches single
+// messages with positioned reads and is safe to call from any thread. Bags
+// that were not closed properly need rosbag reindex, compressed bags rosbag
+// decompress. Errors throw.
+class BagReader : public Object<BagReader> {
+  std::string _path;
+  int _fd = -1;
+  uint64_t _file_size = 0;
+  std::vector<BagConnectionInfo> _connections;
+  // sorted by time, messages with equal times in file order
+  std::vector<BagMessageInfo> _messages;
+
+  void read_file(void* data, size_t size, uint64_t position) const;
+  // Reads the header and optionally the data of the record at position and
+  // returns the position of the next record.
+  uint64_t read_record(uint64_t position, std::string& header,
+                       std::string* data) const;
+  void read_index();
+
+ public:
+  BagReader(const std::string& path);
+  ~BagReader();
+  const std::string& path() const { return _path; }
+  const std::vector<BagConnectionInfo>& connections() const {
+    return _connections;
+  }
+  const std::vector<BagMessageInfo>& messages() const { return _messages; }
+  // time of the first and last message, zero for empty bags
+  BagTime start_time() const;
+  BagTime end_time() const;
+  // index of the first message at or after time
+  size_t lower_bound(const BagTime& time) const;
+  // serialized message data
+  void read(const BagMessageInfo& message, std::vector<uint8_t>& data) const;
+};
+
+}  // namespace mittenwire
\ No newline at end of file
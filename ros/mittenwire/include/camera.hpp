@@ -2,11 +2,16 @@
 
 #pragma once
 
+#include "clocksync.hpp"
 #include "master.hpp"
+#include "metrics.hpp"
 #include "object.hpp"
 #include "node.hpp"
 #include "message.hpp"
 
+#include <memory>
+#include <mutex>
+
 namespace mittenwire {
 
 struct ImageMessage : Message {
@@ -17,21 +22,147 @@ struct ImageMessage : Message {
   size_t height = 0;
   float temperature = 0.0f;
   uint32_t request_timestamp = 0;
+  // consecutive number of the frame within its camera
+  uint64_t frame_id = 0;
+  // host monotonic ns at which the frame info and the last received packet
+  // arrived
+  uint64_t host_start_timestamp = 0;
+  uint64_t host_timestamp = 0;
+  // request_timestamp mapped to host monotonic ns and to system clock
+  // seconds, 0 without clock sync
+  uint64_t trigger_host_timestamp = 0;
+  double stamp = 0;
   uint8_t skip = 0;
+  // set if every data packet arrived intact, otherwise the gaps have been
+  // filled according to the camera's FillPolicy
+  bool valid = false;
+  size_t packets_expected = 0;
+  size_t packets_received = 0;
+  // 1 for rows whose pixels all come from received packets
+  std::vector<uint8_t> row_valid;
+  double completeness() const {
+    return packets_expected ? packets_received * 1.0 / packets_expected : 0.0;
+  }
+};
+
+// How pixels of lost or corrupt data packets are filled in.
+enum class FillPolicy {
+  // mid gray 0x80
+  Gray,
+  // same pixels of the previous frame, gray if the size changed
+  PreviousFrame,
+  // average of the nearest same-color pixels above and below
+  Interpolate,
+};
+
+// Band of rows [row_begin, row_end) of a frame that is still being received.
+// Rows before row_end are final, rows after it may still change. valid is
+// set if every packet of the band was received intact.
+struct ImageSlice {
+  std::shared_ptr<ImageMessage> frame;
+  uint64_t frame_id = 0;
+  size_t row_begin = 0;
+  size_t row_end = 0;
   bool valid = false;
 };
 
+// Recycles frames and their pixel storage. Frames are handed out as shared
+// pointers that return to the pool once the last reference is dropped, from
+// any thread. At most depth idle frames are kept, frames still referenced
+// when the pool is empty are replaced by new allocations.
+class ImagePool : public Object<ImagePool>,
+                  public std::enable_shared_from_this<ImagePool> {
+  std::mutex _mutex;
+  std::vector<std::unique_ptr<ImageMessage>> _free;
+  size_t _depth = 0;
+  uint64_t _allocations = 0;
+  void recycle(ImageMessage* image);
+
+ public:
+  ImagePool(size_t depth);
+  std::shared_ptr<ImageMessage> acquire();
+  void set_depth(size_t depth);
+  size_t depth();
+  size_t idle();
+  uint64_t allocations();
+};
+
 class Camera : public Node {
-  ImageMessage image_buffer;
+  std::shared_ptr<ImagePool> pool;
+  std::shared_ptr<ImageMessage> frame;
   int32_t prev_offset = -1;
   bool frame_started = false;
   std::chrono::steady_clock::time_point receive_start_time;
-  std::function<void(const ImageMessage&)> callback;
+  std::function<void(const std::shared_ptr<ImageMessage>&)> callback;
+  // first and last encoded byte of each payload, to decode payloads as they
+  // arrive even if their predecessor comes later
+  struct PayloadEdges {
+    uint8_t first = 0;
+    uint8_t last = 0;
+  };
+  std::vector<PayloadEdges> payload_edges;
+  // one bit per data packet
+  std::vector<uint64_t> received_packets;
+  bool packet_received(size_t slot) const {
+    return (received_packets[slot / 64] >> (slot % 64)) & 1;
+  }
+  FillPolicy fill_policy = FillPolicy::Gray;
+  std::shared_ptr<ImageMessage> previous_frame;
+  // number of leading payloads that have all been received
+  size_t received_prefix = 0;
+  uint64_t frame_counter = 0;
+  size_t slice_rows = 0;
+  size_t slice_row = 0;
+  std::function<void(const ImageSlice&)> slice_callback;
+  void emit_slices(bool frame_complete);
+
+  struct Metrics {
+    std::shared_ptr<MetricCounter> frames_completed;
+    std::shared_ptr<MetricCounter> frames_invalid;
+    std::shared_ptr<MetricCounter> frames_incomplete;
+    std::shared_ptr<MetricCounter> checksum_errors;
+    std::shared_ptr<MetricCounter> lost_packets;
+    std::shared_ptr<MetricCounter> filled_packets;
+    std::shared_ptr<MetricCounter> size_errors;
+    std::shared_ptr<MetricCounter> frame_allocations;
+    std::shared_ptr<MetricHistogram> reassembly_latency_us;
+    std::shared_ptr<MetricHistogram> trigger_latency_us;
+  };
+  std::unique_ptr<Metrics> metrics;
+  size_t metrics_channel = 0;
+  Metrics& get_metrics(size_t channel);
+  void fill_missing(ImageMessage& image);
+  void complete_frame(Metrics& m);
+  std::shared_ptr<ClockSync> clock_sync;
 
  public:
-  Camera(const std::function<void(const ImageMessage&)>& callback)
-      : callback(callback) {}
+  // Completed frames are passed to the callback and may be retained, also
+  // across threads. Up to pool_depth released frames are reused.
+  Camera(const std::function<void(const std::shared_ptr<ImageMessage>&)>&
+             callback,
+         size_t pool_depth = 4)
+      : pool(std::make_shared<ImagePool>(pool_depth)), callback(callback) {}
   virtual void process(const Packet& message) override;
+  const std::shared_ptr<ImagePool>& frame_pool() const { return pool; }
+  // Calls back with every band of rows rows as soon as it is decoded, before
+  // the frame is complete, on the thread that processes packets. The last
+  // band of a frame is delivered right before the frame itself and may be
+  // shorter. rows = 0 disables slices.
+  // Frames with lost packets are delivered with valid = false, row_valid and
+  // the gaps filled by this policy. Frames whose last packet is lost are
+  // delivered once the next frame starts.
+  void set_fill_policy(FillPolicy policy) { fill_policy = policy; }
+  FillPolicy get_fill_policy() const { return fill_policy; }
+  void set_slice_callback(size_t rows,
+                          const std::function<void(const ImageSlice&)>& cb) {
+    slice_rows = rows;
+    slice_callback = cb;
+  }
+  // Feeds frame request timestamps into the estimator and uses it to stamp
+  // frames with host and system clock trigger times.
+  void set_clock_sync(const std::shared_ptr<ClockSync>& sync) {
+    clock_sync = sync;
+  }
 };
 
 }  // namespace mittenwire
@@ -0,0 +1,96 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "object.hpp"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mittenwire {
+
+namespace superspeed {
+
+// One entry per captured transfer in the .idx file next to each .raw segment.
+struct CaptureIndexEntry {
+  uint64_t timestamp = 0;
+  uint64_t transfer_index = 0;
+  uint64_t offset = 0;
+  uint32_t size = 0;
+  uint32_t reserved = 0;
+};
+static_assert(sizeof(CaptureIndexEntry) == 32, "");
+
+// Records raw bulk-in transfers into rotating, preallocated, memory-mapped
+// segment files <prefix>-NNNNNN.raw with an index in <prefix>-NNNNNN.idx.
+// append() only copies into an in-memory staging ring and never blocks; all
+// file access happens on a dedicated writer thread. Transfers that do not fit
+// into the staging ring are dropped and counted. A file error, like a full
+// disk, stops the capture: the writer thread closes the current segment and
+// every transfer from then on is dropped and counted, failed() and error()
+// report what happened.
+class Capture : public Object<Capture> {
+  struct RecordHeader {
+    uint32_t size;
+    uint32_t reserved;
+    uint64_t timestamp;
+    uint64_t transfer_index;
+  };
+  static constexpr uint32_t wrap_marker = 0xffffffff;
+
+  std::string _prefix;
+  size_t _segment_size = 0;
+  size_t _max_segments = 0;
+
+  std::vector<uint8_t> _staging;
+  std::atomic<uint64_t> _write_pos{0};
+  std::atomic<uint64_t> _read_pos{0};
+
+  std::atomic<uint64_t> _transfers_captured{0};
+  std::atomic<uint64_t> _transfers_dropped{0};
+  std::atomic<uint64_t> _bytes_captured{0};
+  std::atomic<uint64_t> _segment_count{0};
+  std::atomic<bool> _failed{false};
+  std::string _error;
+
+  mutable std::mutex _mutex;
+  std::condition_variable _condition;
+  bool _exit_flag = false;
+  std::thread _thread;
+
+  int _segment_fd = -1;
+  int _index_fd = -1;
+  uint8_t *_segment_map = nullptr;
+  size_t _segment_fill = 0;
+  std::vector<std::string> _segment_names;
+
+  void open_segment();
+  void close_segment();
+  void write_record(const RecordHeader &header, const uint8_t *data);
+  void fail(const std::string &error);
+  void run();
+
+ public:
+  Capture(const std::string &prefix, size_t segment_size,
+          size_t max_segments = 0, size_t staging_size = 256 * 1024 * 1024);
+  ~Capture();
+  void append(const void *data, size_t size, uint64_t timestamp,
+              uint64_t transfer_index);
+  uint64_t transfers_captured() const { return _transfers_captured; }
+  uint64_t transfers_dropped() const { return _transfers_dropped; }
+  uint64_t bytes_captured() const { return _bytes_captured; }
+  uint64_t segment_count() const { return _segment_count; }
+  bool failed() const { return _failed; }
+  // error that stopped the capture, empty if it is running
+  std::string error() const;
+};
+
+}  // namespace superspeed
+
+}  // namespace mittenwire
@@ -0,0 +1,79 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "object.hpp"
+
+#include <stdint.h>
+
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace mittenwire {
+
+// Online estimate of the mapping from the hub's free-running 32-bit
+// microsecond clock to host monotonic time (see monotonic_time_ns).
+//
+// Each sample pairs a device timestamp with the host time at which the
+// transfer carrying it completed, so every sample is late by a varying USB
+// and scheduling delay. Samples are grouped into buckets of bucket_seconds
+// device time, and only the earliest sample per bucket is kept. The estimate
+// is a least-squares line through these lower-envelope points over the last
+// bucket_count buckets, which yields offset and drift while ignoring
+// delayed samples. The offset therefore includes the minimum transport
+// delay of the sample source.
+//
+// Every camera of a trigger asks for the same device time, while the
+// estimate keeps moving with their samples. Recent conversions are
+// remembered, so all of them get the same stamp, and the offset to the
+// system clock only follows steps, not the jitter of reading both clocks.
+class ClockSync : public Object<ClockSync> {
+  struct Bucket {
+    int64_t index = 0;
+    int64_t device_us = 0;
+    int64_t residual_ns = 0;
+  };
+
+  double _bucket_seconds = 1.0;
+  size_t _bucket_count = 60;
+
+  mutable std::mutex _mutex;
+  bool _has_samples = false;
+  uint32_t _last_device = 0;
+  int64_t _last_unwrapped = 0;
+  uint64_t _sample_count = 0;
+  uint64_t _reset_count = 0;
+  std::deque<Bucket> _buckets;
+
+  bool _valid = false;
+  int64_t _reference_us = 0;
+  double _offset_ns = 0;
+  double _drift = 0;
+
+  mutable std::deque<std::pair<uint32_t, uint64_t>> _recent;
+  mutable bool _has_wall_offset = false;
+  mutable int64_t _wall_minus_host_ns = 0;
+
+  int64_t unwrap(uint32_t device_us) const;
+  double predict_residual(int64_t unwrapped_us) const;
+  void fit();
+
+ public:
+  ClockSync(double bucket_seconds = 1.0, size_t bucket_count = 60);
+  void add_sample(uint32_t device_us, uint64_t host_ns);
+  void reset();
+  bool valid() const;
+  // Host monotonic time in ns of the given device time, 0 if there is no
+  // estimate yet. Device times within +-35 minutes of the most recent sample
+  // are unwrapped correctly.
+  uint64_t to_host(uint32_t device_us) const;
+  // Same as to_host, converted to system clock seconds, for ROS stamps.
+  double to_wall(uint32_t device_us) const;
+  // Device clock drift relative to the host clock in parts per million.
+  double drift_ppm() const;
+  uint64_t sample_count() const;
+  uint64_t reset_count() const;
+};
+
+}  // namespace mittenwire
\ No newline at end of file
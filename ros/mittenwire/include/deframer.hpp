@@ -0,0 +1,59 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "packet.hpp"
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace mittenwire {
+
+// Splits the raw word stream from the hub into packets. Each segment starts
+// with a 0x2301CELL header word (C = channel, E = end of packet bit,
+// LL = payload length in 64 bit units) and segments of one channel are
+// concatenated until the end bit is set. Payload runs are copied in bulk and
+// the next valid header is searched with SIMD after a sync loss.
+class Deframer {
+  struct ChannelBuffer {
+    std::vector<uint8_t> data;
+    size_t start_transfer = 0;
+  };
+
+  std::vector<ChannelBuffer> _channels;
+  size_t _transfer_index = 0;
+  uint64_t _host_timestamp = 0;
+  size_t _channel = 0;
+  size_t _remaining = 0;
+  bool _in_payload = false;
+  bool _end = false;
+
+  uint64_t _resync_words = 0;
+  uint64_t _overflows = 0;
+  uint64_t _split_packets = 0;
+
+  void finish_segment(std::vector<Packet> &packets);
+
+ public:
+  static constexpr size_t channel_count = 16;
+  static constexpr size_t max_packet_size = 4000000;
+
+  Deframer();
+
+  // Deframes one transfer and appends all packets completed within it,
+  // stamped with the host time at which the transfer completed.
+  void process(const uint32_t *words, size_t count,
+               std::vector<Packet> &packets, uint64_t host_timestamp = 0);
+
+  void reset();
+
+  uint64_t resync_words() const { return _resync_words; }
+  uint64_t overflows() const { return _overflows; }
+  uint64_t split_packets() const { return _split_packets; }
+};
+
+// Returns the index of the first valid segment header or count if none.
+size_t find_segment_header(const uint32_t *words, size_t count);
+
+}  // namespace mittenwire
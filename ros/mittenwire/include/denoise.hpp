@@ -0,0 +1,51 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "object.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+namespace mittenwire {
+
+class ThreadPool;
+
+// Motion-adaptive recursive filter for the frames of one camera. Each frame is
+// first smoothed by an edge-preserving 3x3 sigma filter, which also steadies
+// motion detection. Each pixel is then blended with its filtered value from
+// the previous frame, less the more it changed, so static areas average out
+// over time while moving ones keep only the spatial filter.
+// An instance filters one image stream, calls on it are serialized, use one
+// instance per camera to filter several in parallel.
+class TemporalDenoiser : public Object<TemporalDenoiser> {
+  std::mutex _mutex;
+  float _strength = 0;
+  float _threshold = 0;
+  float _spatial = 0;
+  size_t _width = 0;
+  size_t _height = 0;
+  size_t _channels = 0;
+  // previous output in 8.8 fixed point
+  std::vector<uint16_t> _history;
+  // copy of the frame being filtered, kept to avoid reallocating it
+  std::vector<uint8_t> _input;
+
+ public:
+  // strength is the maximum weight of the previous frame in [0, 1), threshold
+  // the noise level in 8-bit steps, above which neighbors count as edges and
+  // pixels as moving, and spatial the weight of the spatial filter in [0, 1].
+  // The first frame is always filtered spatially at full weight.
+  TemporalDenoiser(float strength = 0.8f, float threshold = 12.0f,
+                   float spatial = 1.0f);
+  // Filters an 8-bit image with interleaved channels in place. A change of
+  // size or channel count restarts the filter.
+  void process(uint8_t *data, size_t width, size_t height, size_t channels,
+               size_t stride, ThreadPool *pool = nullptr);
+  void reset();
+};
+
+}  // namespace mittenwire
\ No newline at end of file
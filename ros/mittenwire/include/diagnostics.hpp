@@ -0,0 +1,37 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "metrics.hpp"
+#include "object.hpp"
+
+#include <ros/ros.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace mittenwire {
+
+// Periodically publishes all registered metrics as a
+// diagnostic_msgs/DiagnosticArray, with one status per subsystem. Counters
+// are reported together with their rate since the previous publication,
+// histograms as count, mean, p50, p99 and max.
+class DiagnosticsPublisher : public Object<DiagnosticsPublisher> {
+  ros::Publisher _publisher;
+  std::unordered_map<std::string, int64_t> _previous;
+  std::chrono::steady_clock::time_point _previous_time;
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  bool _exit_flag = false;
+  std::thread _thread;
+  void publish();
+
+ public:
+  DiagnosticsPublisher(ros::NodeHandle& node_handle, const std::string& topic,
+                       double interval);
+  ~DiagnosticsPublisher();
+};
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,43 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "object.hpp"
+#include "packet.hpp"
+#include "ring.hpp"
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace mittenwire {
+
+// Fans packets out to worker threads. All packets of a channel go to the same
+// worker (channel % thread_count), so ordering within a channel is preserved
+// while different channels are processed in parallel.
+class Dispatcher : public Object<Dispatcher> {
+ public:
+  typedef std::function<void(const Packet *, size_t)> Callback;
+
+ private:
+  struct Worker {
+    SpscRing<Packet> queue;
+    std::thread thread;
+    Worker(size_t capacity) : queue(capacity) {}
+  };
+
+  std::vector<std::unique_ptr<Worker>> _workers;
+  Callback _callback;
+
+ public:
+  Dispatcher(size_t thread_count, size_t queue_capacity,
+             const Callback &callback);
+  ~Dispatcher();
+  size_t thread_count() const { return _workers.size(); }
+  // Called by the packet thread only. Blocks while the worker of the
+  // packet's channel is full.
+  void dispatch(Packet &&packet);
+};
+
+}  // namespace mittenwire
@@ -6,17 +6,24 @@
 #include "master.hpp"
 #include "message.hpp"
 
+#include <array>
 #include <vector>
 #include <memory>
 #include <mutex>
-#include <deque>
 
 namespace mittenwire {
 
 class Hub : public Object<Hub> {
+  // Routing tables are never modified once published. connect() and
+  // disconnect() build a new table and swap it in, the packet path only loads
+  // the current table once per batch.
+  typedef std::array<std::vector<std::shared_ptr<Node>>,
+                     Deframer::channel_count>
+      RoutingTable;
   struct Impl {
     std::mutex mutex;
-    std::vector<std::vector<std::shared_ptr<Node>>> node_map;
+    std::shared_ptr<const RoutingTable> table =
+        std::make_shared<const RoutingTable>();
   };
 
   std::shared_ptr<Master> _master;
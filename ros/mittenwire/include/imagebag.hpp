@@ -0,0 +1,124 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "bag.hpp"
+#include "isp.hpp"
+#include "object.hpp"
+#include "parallel.hpp"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mittenwire {
+
+struct BagImage {
+  // topic prefix of the camera, e.g. /cam0
+  std::string name;
+  BagTime time;
+  // header stamp of the image message
+  BagTime stamp;
+  // serialized sensor_msgs/CompressedImage or sensor_msgs/Image, and the
+  // matching sensor_msgs/CameraInfo
+  std::string image_type;
+  std::vector<uint8_t> image_data;
+  std::vector<uint8_t> info_data;
+  // decoded BGR image, empty if decoding is off
+  size_t width = 0;
+  size_t height = 0;
+  std::vector<uint8_t> pixels;
+};
+
+struct BagImageSet {
+  BagTime time;
+  // sorted by name
+  std::vector<std::shared_ptr<BagImage>> images;
+};
+
+// Synchronized camera images from a recorded bag. An image is a
+// /camN/image_raw/compressed or /camN/image_raw message together with the
+// /camN/camera_info message of the same bag time, a set holds all images of
+// one time. Sets are indexed from the bag index on construction. next()
+// reads and decodes up to prefetch sets ahead of the consumer on a thread
+// pool, one task per image, compressed images with OpenCV and raw bayer
+// images with the ISP. seek() and stride select the sets that come next,
+// tasks still queued for the sets skipped that way do nothing.
+// Messages of all other topics, like /impedance_matrix and /glove_status,
+// can be looked up by time range. Not thread safe, errors throw.
+class ImageBagReader : public Object<ImageBagReader> {
+  struct ImageIndex {
+    std::string name;
+    size_t image = 0;
+    size_t info = 0;
+  };
+  struct SetIndex {
+    BagTime time;
+    std::vector<ImageIndex> images;
+  };
+  struct Pending {
+    size_t index = 0;
+    std::shared_ptr<BagImageSet> set;
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t remaining = 0;
+    std::exception_ptr error;
+  };
+
+  std::shared_ptr<BagReader> _bag;
+  std::vector<SetIndex> _sets;
+  // message indices of the topics that are not part of image sets
+  std::map<std::string, std::vector<size_t>> _topics;
+  size_t _prefetch = 0;
+  bool _decode = true;
+  IspParams _isp_params;
+  size_t _stride = 1;
+  // next set to schedule, sets in between are pending
+  size_t _scheduled = 0;
+  std::deque<std::shared_ptr<Pending>> _pending;
+  // changed on every jump, tasks of an older generation are discarded
+  std::shared_ptr<std::atomic<uint64_t>> _generation =
+      std::make_shared<std::atomic<uint64_t>>(0);
+  // declared last, finishes its tasks before the rest is destroyed
+  std::unique_ptr<ThreadPool> _pool;
+
+  void build_index();
+  void schedule();
+
+ public:
+  // thread_count = 0 uses one thread per hardware thread
+  ImageBagReader(const std::string& path, size_t prefetch = 4,
+                 size_t thread_count = 0, bool decode = true);
+  const BagReader& bag() const { return *_bag; }
+  // number of image sets in the bag and their times
+  size_t size() const { return _sets.size(); }
+  BagTime time(size_t index) const { return _sets.at(index).time; }
+  // index of the set returned by the next call to next()
+  size_t position() const;
+  void set_position(size_t index);
+  // continues with the first set at or after time
+  void seek(const BagTime& time);
+  // next() skips stride - 1 sets after each set
+  size_t stride() const { return _stride; }
+  void set_stride(size_t stride);
+  // used for raw bayer images, applies to sets scheduled from now on
+  const IspParams& isp_params() const { return _isp_params; }
+  void set_isp_params(const IspParams& params) { _isp_params = params; }
+  // Waits for the next set and returns it, nullptr at the end of the bag.
+  std::shared_ptr<BagImageSet> next();
+  // times and serialized data of the messages on topic in [begin, end)
+  std::vector<std::pair<BagTime, std::vector<uint8_t>>> messages(
+      const std::string& topic, const BagTime& begin,
+      const BagTime& end) const;
+};
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,53 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mittenwire {
+
+class ThreadPool;
+
+// Preview image pipeline settings, mostly the filter group of Hub.cfg.
+struct IspParams {
+  // subtracted from the raw values, fraction of full scale
+  float black_level = 0.0f;
+  float gain_red = 1.0f;
+  float gain_green = 1.0f;
+  float gain_blue = 1.0f;
+  // hue rotation in degrees, saturation and brightness as factors
+  float hue = 0.0f;
+  float saturation = 1.0f;
+  float brightness = 1.0f;
+  // compress highlights instead of clipping them when brightening
+  bool tone_mapping = false;
+  // apply the sRGB transfer curve, for linear raw data
+  bool srgb = false;
+  bool invert = false;
+};
+
+// IspParams prepared for per-pixel use. matrix maps black level corrected
+// linear RGB on the 0 to 255 scale to lut indices, row by row in RGB order,
+// and lut holds tone curve, sRGB and inversion.
+struct IspTables {
+  static constexpr int lut_steps = 1024;
+  // lookup table input covers [0, 8) times full scale
+  static constexpr int lut_size = 8 * lut_steps;
+  float matrix[9];
+  float black = 0;
+  uint8_t lut[lut_size];
+  IspTables(const IspParams &params);
+};
+
+// Converts a GRBG Bayer image (the layout of ImageMessage) to 8-bit color in
+// one pass over bands of rows, in parallel on pool if given. The output is in
+// BGR byte order like OpenCV images, with rgb_stride bytes per row. Demosaicing
+// is bilinear, followed by black level, white balance gains, a combined hue,
+// saturation and brightness matrix and a lookup table for tone curve, sRGB and
+// inversion. width and height must be at least 2.
+void isp_process(const uint8_t *bayer, size_t bayer_stride, size_t width,
+                 size_t height, uint8_t *rgb, size_t rgb_stride,
+                 const IspParams &params, ThreadPool *pool = nullptr);
+
+}  // namespace mittenwire
\ No newline at end of file
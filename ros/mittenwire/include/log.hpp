@@ -2,8 +2,99 @@
 
 #pragma once
 
-#include <iostream>
+#include <stdint.h>
 
-#define MTW_LOG_DEBUG(...)  // std::cerr << "D " << __VA_ARGS__ << std::endl;
-#define MTW_LOG_INFO(...) std::cerr << "I " << __VA_ARGS__ << std::endl;
-#define MTW_LOG_ERROR(...) std::cerr << "E " << __VA_ARGS__ << std::endl;
\ No newline at end of file
+#include <atomic>
+#include <sstream>
+#include <string>
+
+// Call sites below this level are compiled out entirely.
+// 0 = debug, 1 = info, 2 = error, 3 = off
+#ifndef MTW_LOG_LEVEL
+#define MTW_LOG_LEVEL 1
+#endif
+
+namespace mittenwire {
+
+enum class LogLevel : int {
+  Debug = 0,
+  Info = 1,
+  Error = 2,
+  Off = 3,
+};
+
+// Static state of one MTW_LOG_* call site. Each site may emit up to
+// Logger::rate_limit() messages per second, further messages are only
+// counted and later reported as a single aggregated line.
+struct LogSite {
+  const char* file;
+  int line;
+  LogLevel level;
+  std::atomic<int64_t> window_start{0};
+  std::atomic<uint32_t> window_count{0};
+  std::atomic<uint32_t> suppressed{0};
+  LogSite* next = nullptr;
+  LogSite(const char* file, int line, LogLevel level);
+  bool admit();
+  // Reports and resets the suppressed count if the window has expired.
+  void roll(int64_t now);
+};
+
+// Log messages are formatted on the calling thread and handed to a bounded
+// lock-free queue, a background thread writes them to stderr. If the queue is
+// full, messages are dropped and counted instead of blocking the caller.
+class Logger {
+ public:
+  static std::atomic<int> g_level;
+  static bool enabled(LogLevel level) {
+    return int(level) >= g_level.load(std::memory_order_relaxed);
+  }
+  static void set_level(LogLevel level) { g_level = int(level); }
+  static LogLevel level() { return LogLevel(g_level.load()); }
+  static void set_rate_limit(uint32_t messages_per_second);
+  static uint32_t rate_limit();
+  static uint64_t dropped();
+  static void write(LogSite& site, std::string&& text);
+  static void report_suppressed(LogSite& site, uint32_t count);
+  // Blocks until all queued messages have been written.
+  static void flush();
+};
+
+}  // namespace mittenwire
+
+#define MTW_LOG_SITE(level, ...)                                        \
+  do {                                                                  \
+    if (::mittenwire::Logger::enabled(level)) {                         \
+      static ::mittenwire::LogSite mtw_log_site(__FILE__, __LINE__,     \
+                                                level);                 \
+      if (mtw_log_site.admit()) {                                       \
+        std::ostringstream mtw_log_stream;                              \
+        mtw_log_stream << __VA_ARGS__;                                  \
+        ::mittenwire::Logger::write(mtw_log_site, mtw_log_stream.str()); \
+      }                                                                 \
+    }                                                                   \
+  } while (0)
+
+#define MTW_LOG_DISABLED(...) \
+  do {                        \
+  } while (0)
+
+#if MTW_LOG_LEVEL <= 0
+#define MTW_LOG_DEBUG(...) \
+  MTW_LOG_SITE(::mittenwire::LogLevel::Debug, __VA_ARGS__)
+#else
+#define MTW_LOG_DEBUG(...) MTW_LOG_DISABLED(__VA_ARGS__)
+#endif
+
+#if MTW_LOG_LEVEL <= 1
+#define MTW_LOG_INFO(...) MTW_LOG_SITE(::mittenwire::LogLevel::Info, __VA_ARGS__)
+#else
+#define MTW_LOG_INFO(...) MTW_LOG_DISABLED(__VA_ARGS__)
+#endif
+
+#if MTW_LOG_LEVEL <= 2
+#define MTW_LOG_ERROR(...) \
+  MTW_LOG_SITE(::mittenwire::LogLevel::Error, __VA_ARGS__)
+#else
+#define MTW_LOG_ERROR(...) MTW_LOG_DISABLED(__VA_ARGS__)
+#endif
\ No newline at end of file
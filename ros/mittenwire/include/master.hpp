@@ -2,15 +2,20 @@
 
 #pragma once
 
+#include "clocksync.hpp"
+#include "deframer.hpp"
+#include "dispatcher.hpp"
+#include "metrics.hpp"
 #include "packet.hpp"
 #include "object.hpp"
 #include "superspeed.hpp"
+#include "capture.hpp"
+#include "ring.hpp"
 
 #include <ros/ros.h>
 
 #include <boost/container/small_vector.hpp>
 #include <condition_variable>
-#include <deque>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -19,33 +24,100 @@
 namespace mittenwire {
 
 class Master : public Object<Master> {
-  std::shared_ptr<superspeed::Device> _device;
+  std::shared_ptr<superspeed::Transport> _transport;
 
-  std::deque<std::vector<uint8_t>> _rx_buffers;
-  std::thread _rx_thread;
-  std::mutex _rx_mutex;
-  std::condition_variable _rx_condition;
+  SpscRing<superspeed::Buffer> _rx_ring;
 
   std::thread _packet_thread;
+  Deframer _deframer;
 
   std::shared_ptr<superspeed::Reader> _reader;
 
+  std::shared_ptr<ClockSync> _clock_sync = std::make_shared<ClockSync>();
+
   volatile bool _exit_flag = false;
 
   std::mutex _listener_mutex;
   typedef std::unordered_map<std::shared_ptr<void>,
-                             std::function<void(const Packet&)>>
+                             std::function<void(const PacketSpan&)>>
       ListenerMap;
   typedef std::shared_ptr<const ListenerMap> ListenerMapPointer;
+  // run on the packet thread
   ListenerMapPointer _listener_map = std::make_shared<ListenerMap>();
+  // run on the dispatch workers if there are any, else on the packet thread
+  ListenerMapPointer _channel_listener_map = std::make_shared<ListenerMap>();
+
+  struct ChannelMetrics {
+    std::shared_ptr<MetricCounter> packets;
+    std::shared_ptr<MetricCounter> bytes;
+    std::shared_ptr<MetricCounter> split_packets;
+  };
+  std::vector<ChannelMetrics> _channel_metrics;
+  std::shared_ptr<MetricCounter> _transfers_metric;
+  std::shared_ptr<MetricCounter> _resync_words_metric;
+  std::shared_ptr<MetricCounter> _overflows_metric;
+  uint64_t _last_resync_words = 0;
+  uint64_t _last_overflows = 0;
+  void update_metrics(const std::vector<Packet>& packets);
+
+  std::mutex _dispatch_mutex;
+  std::unique_ptr<Dispatcher> _dispatcher;
+
+  void update_listeners(
+      ListenerMapPointer& map, const std::shared_ptr<void>& listener,
+      const std::function<void(const PacketSpan&)>* callback);
+  void deliver(const ListenerMapPointer& map, const Packet* packets,
+               size_t count);
 
  public:
-  Master(const std::shared_ptr<superspeed::Device>& device, size_t buffer_count,
-         size_t buffer_size);
+  Master(const std::shared_ptr<superspeed::Transport>& transport,
+         size_t buffer_count, size_t buffer_size, size_t max_buffer_count = 0);
   ~Master();
+  // Listeners see every packet and run on the packet thread, one call at a
+  // time, whether or not dispatch threads are enabled.
   void add_packet_listener(const std::shared_ptr<void>& listener,
                            const std::function<void(const Packet&)>& callback);
+  // Batch listeners get all packets of a transfer at once, grouped by
+  // channel in ascending order and in arrival order within each channel.
+  void add_batch_listener(
+      const std::shared_ptr<void>& listener,
+      const std::function<void(const PacketSpan&)>& callback);
+  // Channel listeners handle each channel independently, like Hub routing to
+  // its nodes. With dispatch threads they run on the workers: packets of one
+  // channel always arrive in order on the same worker, but different
+  // channels are processed concurrently and a batch may hold packets of
+  // several channels of the same worker.
+  void add_channel_listener(
+      const std::shared_ptr<void>& listener,
+      const std::function<void(const PacketSpan&)>& callback);
+  // Removes a listener of any kind.
   void remove_packet_listener(const std::shared_ptr<void>& listener);
+  void set_backpressure_policy(BackpressurePolicy policy) {
+    _rx_ring.set_policy(policy);
+  }
+  BackpressurePolicy backpressure_policy() const { return _rx_ring.policy(); }
+  uint64_t dropped_oldest_transfers() const {
+    return _rx_ring.dropped_oldest();
+  }
+  uint64_t dropped_newest_transfers() const {
+    return _rx_ring.dropped_newest();
+  }
+  // Runs channel listeners, and with them all nodes connected to a hub, on
+  // thread_count worker threads instead of the packet thread, with each
+  // channel pinned to one worker. Node callbacks of different channels then
+  // run concurrently. Packet and batch listeners stay on the packet thread.
+  // 0 disables dispatching.
+  void set_dispatch_threads(size_t thread_count);
+  size_t dispatch_threads();
+  // Device to host clock estimate shared by the nodes of this master.
+  const std::shared_ptr<ClockSync>& clock_sync() const { return _clock_sync; }
+  void start_capture(const std::string& prefix, size_t segment_size,
+                     size_t max_segments = 0);
+  void stop_capture();
+  // current capture, to check its counters and whether it failed
+  std::shared_ptr<superspeed::Capture> capture() const {
+    return _reader->capture();
+  }
 };
 
 }  // namespace mittenwire
\ No newline at end of file
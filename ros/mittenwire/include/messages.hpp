@@ -68,7 +68,42 @@ union ImageInfo {
 };
 static_assert(sizeof(ImageInfo) == 16);
 
-uint16_t compute_message_checksum(const void *data, size_t size) {
+// Tactile glove packets arrive wrapped by the radio receiver, which prepends
+// its hub timestamp and a magic word.
+struct RadioHeader {
+  static constexpr uint32_t magic_value = 0x79A90F58;
+  uint32_t timestamp;
+  uint32_t magic;
+};
+static_assert(sizeof(RadioHeader) == 8);
+
+// Seven consecutive samples of the impedance matrix, starting at sample
+// index * 7, in shared-exponent format.
+struct TactileMatrixChunk {
+  static constexpr uint32_t id_mask = 0xffffff00;
+  static constexpr uint32_t id_value = 0x1e662200;
+  static constexpr size_t sample_count = 7;
+  uint32_t id;
+  uint32_t samples[sample_count];
+  uint32_t index() const { return id & 0xff; }
+};
+static_assert(sizeof(TactileMatrixChunk) == 32);
+
+struct GloveStatusPacket {
+  static constexpr uint32_t id_value = 0x8da0cdef;
+  uint32_t id;
+  uint32_t millis;
+  uint16_t battery_voltage_mv;
+  int16_t shunt_voltage_mv;
+  uint8_t core_temperature;
+  uint8_t flags;
+  uint16_t reserved1;
+  int16_t imu_temp_accel_gyro[7];
+  uint16_t reserved2;
+};
+static_assert(sizeof(GloveStatusPacket) == 32);
+
+inline uint16_t compute_message_checksum(const void *data, size_t size) {
   uint32_t ret = 0x61D209A2;
   for (size_t i = 0; i < size; i++) {
     ret += ((const uint8_t *)data)[i];
@@ -0,0 +1,121 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mittenwire {
+
+// Monotonic event counter, cheap enough for the packet path.
+class MetricCounter {
+  std::atomic<uint64_t> _value{0};
+
+ public:
+  void add(uint64_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+};
+
+// Instantaneous value such as the number of transfers in flight.
+class MetricGauge {
+  std::atomic<int64_t> _value{0};
+
+ public:
+  void set(int64_t v) { _value.store(v, std::memory_order_relaxed); }
+  void add(int64_t n) { _value.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return _value.load(std::memory_order_relaxed); }
+};
+
+struct HistogramSnapshot {
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+  // buckets[0] counts zeros, buckets[i] counts values in [2^(i-1), 2^i)
+  std::vector<uint64_t> buckets;
+  double mean() const { return count ? double(sum) / count : 0.0; }
+  // Upper bucket bound below which the given fraction of samples lies.
+  uint64_t quantile(double q) const;
+};
+
+// Histogram with power-of-two buckets, recording is a handful of relaxed
+// atomic increments.
+class MetricHistogram {
+ public:
+  static constexpr size_t bucket_count = 64;
+
+ private:
+  std::atomic<uint64_t> _buckets[bucket_count];
+  std::atomic<uint64_t> _count{0};
+  std::atomic<uint64_t> _sum{0};
+  std::atomic<uint64_t> _max{0};
+
+ public:
+  MetricHistogram() {
+    for (auto& b : _buckets) {
+      b.store(0, std::memory_order_relaxed);
+    }
+  }
+  void record(uint64_t value) {
+    size_t bucket = value ? std::min<size_t>(64 - __builtin_clzll(value),
+                                             bucket_count - 1)
+                          : 0;
+    _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t current = _max.load(std::memory_order_relaxed);
+    while (value > current &&
+           !_max.compare_exchange_weak(current, value,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+  template <class Duration>
+  void record_us(const Duration& duration) {
+    auto us =
+        std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    record(us > 0 ? us : 0);
+  }
+  HistogramSnapshot snapshot() const;
+};
+
+enum class MetricType : uint8_t {
+  Counter,
+  Gauge,
+  Histogram,
+};
+
+struct MetricSample {
+  std::string name;
+  MetricType type = MetricType::Counter;
+  int64_t value = 0;
+  HistogramSnapshot histogram;
+};
+
+// Process-wide set of named metrics. Components look their metrics up once
+// when they are created and then update them without touching the registry.
+// Names are dot-separated, the first component names the subsystem, e.g.
+// "reader.transfers" or "camera.3.frames_completed". Metrics are never
+// removed, so counters keep accumulating across component restarts.
+class MetricsRegistry {
+  std::mutex _mutex;
+  std::map<std::string, std::shared_ptr<MetricCounter>> _counters;
+  std::map<std::string, std::shared_ptr<MetricGauge>> _gauges;
+  std::map<std::string, std::shared_ptr<MetricHistogram>> _histograms;
+  MetricsRegistry() {}
+
+ public:
+  static MetricsRegistry& instance();
+  std::shared_ptr<MetricCounter> counter(const std::string& name);
+  std::shared_ptr<MetricGauge> gauge(const std::string& name);
+  std::shared_ptr<MetricHistogram> histogram(const std::string& name);
+  std::vector<MetricSample> snapshot();
+};
+
+}  // namespace mittenwire
\ No newline at end of file
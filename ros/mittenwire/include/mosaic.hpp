@@ -0,0 +1,71 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "isp.hpp"
+#include "object.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace mittenwire {
+
+class ThreadPool;
+struct ImageMessage;
+
+struct MosaicCell {
+  size_t x = 0;
+  size_t y = 0;
+  size_t width = 0;
+  size_t height = 0;
+};
+
+// Grid layout of mosaic.py. The column count maximizes the scale of a nominal
+// cell_width x cell_height image, and each image is centered in its grid cell
+// at its own aspect ratio. image_sizes are (width, height) pairs.
+std::vector<MosaicCell> mosaic_layout(
+    size_t width, size_t height, size_t cell_width, size_t cell_height,
+    const std::vector<std::pair<size_t, size_t>> &image_sizes);
+
+// Draws the raw frames of several cameras side by side into a display buffer
+// for live preview. Each cell is demosaiced at its display size directly from
+// the GRBG Bayer data, averaging the 2x2 Bayer quads that fall into each
+// output pixel, and then colored like isp_process. Output pixels are BGR for
+// three channels and BGRA with opaque alpha for four, which is the memory
+// layout of SDL_PIXELFORMAT_BGR24 and SDL_PIXELFORMAT_ARGB8888.
+class MosaicCompositor : public Object<MosaicCompositor> {
+  size_t _cell_width = 0;
+  size_t _cell_height = 0;
+  size_t _channels = 0;
+  size_t _width = 0;
+  size_t _height = 0;
+  std::vector<std::pair<size_t, size_t>> _image_sizes;
+  std::vector<MosaicCell> _cells;
+  std::vector<uint8_t> _buffer;
+
+  void update_layout(const std::vector<std::shared_ptr<ImageMessage>> &images,
+                     size_t width, size_t height);
+
+ public:
+  MosaicCompositor(size_t cell_width = 400, size_t cell_height = 300,
+                   size_t channels = 3);
+  size_t channels() const { return _channels; }
+  // Renders into width x height pixels at out, rows stride bytes apart. Areas
+  // outside the cells are cleared to opaque black.
+  void render(const std::vector<std::shared_ptr<ImageMessage>> &images,
+              uint8_t *out, size_t width, size_t height, size_t stride,
+              const IspParams &params, ThreadPool *pool = nullptr);
+  // Renders into an internal buffer that is reused by the next call and
+  // returns it, rows are width * channels() bytes apart.
+  const uint8_t *render(
+      const std::vector<std::shared_ptr<ImageMessage>> &images, size_t width,
+      size_t height, const IspParams &params, ThreadPool *pool = nullptr);
+  // Layout of the last render call, in the order of its images.
+  const std::vector<MosaicCell> &cells() const { return _cells; }
+};
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -11,6 +11,9 @@ namespace mittenwire {
 class Node : public Object<Node> {
  public:
   virtual void process(const Packet& message);
+  // Receives consecutive packets of one channel from a single transfer.
+  // Calls process() for each packet unless overridden.
+  virtual void process_batch(const PacketSpan& packets);
 };
 
 }  // namespace mittenwire
\ No newline at end of file
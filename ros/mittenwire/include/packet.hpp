@@ -2,17 +2,157 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
-#include <boost/container/small_vector.hpp>
+#include <string.h>
+
+#include <atomic>
+#include <iterator>
 #include <string>
+#include <utility>
 
 namespace mittenwire {
 
+struct PacketPoolStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t blocks_in_use = 0;
+  uint64_t blocks_high_water = 0;
+  uint64_t bytes_in_use = 0;
+  uint64_t bytes_high_water = 0;
+  uint64_t bytes_cached = 0;
+};
+
+// Header in front of every pooled payload, the bytes follow directly after it.
+struct alignas(16) PacketBlock {
+  std::atomic<uint32_t> refcount{1};
+  uint32_t size_class = 0;
+  size_t capacity = 0;
+  size_t size = 0;
+  PacketBlock* next = nullptr;
+  uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+};
+
+// Process-wide pool of packet payload blocks in power-of-two size classes.
+// Released blocks go back to a per-class free list, so after warm-up the
+// packet path does not call malloc anymore. Each class keeps at most
+// max_cached_bytes of idle blocks, payloads above max_class_size are
+// allocated directly and counted as misses.
+class PacketPool {
+ public:
+  static constexpr size_t min_class_shift = 7;
+  static constexpr size_t class_count = 16;
+  static constexpr size_t max_class_size =
+      size_t(1) << (min_class_shift + class_count - 1);
+  static constexpr size_t max_cached_bytes = 16 * 1024 * 1024;
+  static PacketPool& instance();
+  PacketBlock* allocate(size_t size);
+  void release(PacketBlock* block);
+  PacketPoolStats stats() const;
+  void trim();
+
+ private:
+  struct alignas(64) SizeClass {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    PacketBlock* free = nullptr;
+    size_t cached_bytes = 0;
+  };
+  SizeClass _classes[class_count];
+  std::atomic<uint64_t> _hits{0};
+  std::atomic<uint64_t> _misses{0};
+  std::atomic<uint64_t> _blocks_in_use{0};
+  std::atomic<uint64_t> _blocks_high_water{0};
+  std::atomic<uint64_t> _bytes_in_use{0};
+  std::atomic<uint64_t> _bytes_high_water{0};
+  std::atomic<uint64_t> _bytes_cached{0};
+  PacketPool() {}
+};
+
+// Immutable, reference-counted packet payload. Copies share the same pooled
+// block, so a packet can be handed to any number of listeners and retained
+// without copying its bytes.
+class PacketData {
+  PacketBlock* _block = nullptr;
+
+  void unref() {
+    if (_block &&
+        _block->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      PacketPool::instance().release(_block);
+    }
+    _block = nullptr;
+  }
+
+ public:
+  PacketData() {}
+  PacketData(const PacketData& other) : _block(other._block) {
+    if (_block) {
+      _block->refcount.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  PacketData(PacketData&& other) noexcept : _block(other._block) {
+    other._block = nullptr;
+  }
+  PacketData& operator=(const PacketData& other) {
+    if (this != &other) {
+      unref();
+      _block = other._block;
+      if (_block) {
+        _block->refcount.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    return *this;
+  }
+  PacketData& operator=(PacketData&& other) noexcept {
+    if (this != &other) {
+      unref();
+      std::swap(_block, other._block);
+    }
+    return *this;
+  }
+  ~PacketData() { unref(); }
+
+  const uint8_t* data() const { return _block ? _block->data() : nullptr; }
+  size_t size() const { return _block ? _block->size : 0; }
+  bool empty() const { return size() == 0; }
+  const uint8_t& operator[](size_t i) const { return data()[i]; }
+  const uint8_t* begin() const { return data(); }
+  const uint8_t* end() const { return data() + size(); }
+  size_t use_count() const {
+    return _block ? _block->refcount.load(std::memory_order_relaxed) : 0;
+  }
+
+  void clear() { unref(); }
+
+  // Replaces the payload. Reuses the current block if nobody else holds it
+  // and it is large enough, otherwise takes a fresh one from the pool.
+  void assign(const uint8_t* first, const uint8_t* last) {
+    size_t n = last - first;
+    if (!_block || _block->capacity < n ||
+        _block->refcount.load(std::memory_order_acquire) != 1) {
+      unref();
+      _block = PacketPool::instance().allocate(n);
+    }
+    if (n > 0) {
+      memcpy(_block->data(), first, n);
+    }
+    _block->size = n;
+  }
+  template <class It>
+  void assign(It first, It last) {
+    size_t n = std::distance(first, last);
+    const uint8_t* p = n ? &*first : nullptr;
+    assign(p, p + n);
+  }
+};
+
 class Packet {
  public:
-  boost::container::small_vector<uint8_t, 128> data;
+  PacketData data;
   uint16_t flags = 0;
   uint16_t channel = 0;
+  // host monotonic time in ns at which the last transfer of the packet
+  // completed
+  uint64_t host_timestamp = 0;
   std::string str() const {
     std::string s;
     for (auto &c : data) {
@@ -25,4 +165,18 @@ class Packet {
   }
 };
 
+// Non-owning view of consecutive packets, typically all packets of one
+// channel from the same transfer.
+struct PacketSpan {
+  const Packet* first = nullptr;
+  size_t count = 0;
+  PacketSpan() {}
+  PacketSpan(const Packet* first, size_t count) : first(first), count(count) {}
+  const Packet* begin() const { return first; }
+  const Packet* end() const { return first + count; }
+  const Packet& operator[](size_t i) const { return first[i]; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+};
+
 }  // namespace mittenwire
\ No newline at end of file
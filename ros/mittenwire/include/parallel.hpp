@@ -0,0 +1,40 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "object.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mittenwire {
+
+// Fixed set of worker threads for data-parallel image processing.
+class ThreadPool : public Object<ThreadPool> {
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::deque<std::function<void()>> _tasks;
+  bool _exit = false;
+
+ public:
+  // thread_count = 0 uses one thread per hardware thread
+  ThreadPool(size_t thread_count = 0);
+  ~ThreadPool();
+  size_t thread_count() const { return _threads.size(); }
+  void post(std::function<void()> task);
+  // Calls f(chunk_begin, chunk_end) for consecutive chunks of at most grain
+  // items covering [begin, end), in parallel on the pool and the calling
+  // thread, and returns once all chunks are done. Must not be called from a
+  // pool thread.
+  void parallel_for(size_t begin, size_t end, size_t grain,
+                    const std::function<void(size_t, size_t)> &f);
+  // Shared pool, created on first use and never destroyed.
+  static ThreadPool &instance();
+};
+
+}  // namespace mittenwire
\ No newline at end of file
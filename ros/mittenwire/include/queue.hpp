@@ -0,0 +1,178 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "camera.hpp"
+#include "node.hpp"
+#include "object.hpp"
+#include "packet.hpp"
+#include "ring.hpp"
+
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace mittenwire {
+
+// Bounded multi-producer queue from the receive path to a consumer that pulls
+// items in batches, typically Python. Producers never wait for the consumer,
+// a full queue drops its oldest or the newest item according to the policy.
+// An eventfd is readable while the queue holds items or has been closed, for
+// select or asyncio.
+template <class T>
+class PullQueue : public Object<PullQueue<T>> {
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::deque<T> _items;
+  size_t _capacity = 0;
+  BackpressurePolicy _policy = BackpressurePolicy::DropOldest;
+  uint64_t _dropped = 0;
+  bool _closed = false;
+  bool _signaled = false;
+  int _event = -1;
+
+  void signal() {
+    if (!_signaled) {
+      uint64_t v = 1;
+      if (write(_event, &v, sizeof(v)) != sizeof(v)) {
+        throw std::runtime_error("queue event write failed");
+      }
+      _signaled = true;
+    }
+  }
+
+  void unsignal() {
+    if (_signaled) {
+      uint64_t v = 0;
+      if (read(_event, &v, sizeof(v)) < 0) {
+        // already reset
+      }
+      _signaled = false;
+    }
+  }
+
+ public:
+  PullQueue(size_t capacity,
+            BackpressurePolicy policy = BackpressurePolicy::DropOldest)
+      : _capacity(std::max<size_t>(1, capacity)), _policy(policy) {
+    if (policy == BackpressurePolicy::Block) {
+      throw std::runtime_error("pull queues must not block the receive path");
+    }
+    _event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_event < 0) {
+      throw std::runtime_error("failed to create queue eventfd");
+    }
+  }
+  ~PullQueue() { ::close(_event); }
+
+  // Called by producers.
+  template <class It>
+  void push(It first, It last) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_closed) {
+      return;
+    }
+    for (; first != last; ++first) {
+      if (_items.size() >= _capacity) {
+        _dropped++;
+        if (_policy == BackpressurePolicy::DropNewest) {
+          continue;
+        }
+        _items.pop_front();
+      }
+      _items.push_back(*first);
+    }
+    if (!_items.empty()) {
+      signal();
+      _condition.notify_all();
+    }
+  }
+  void push(const T &item) { push(&item, &item + 1); }
+
+  // Moves up to max_items into items and returns how many. Waits up to
+  // timeout seconds for the first item, forever if timeout is negative.
+  // Returns 0 on timeout and once the queue has been closed and drained.
+  size_t poll(std::vector<T> &items, size_t max_items, double timeout) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto ready = [&]() { return !_items.empty() || _closed; };
+    if (timeout < 0) {
+      _condition.wait(lock, ready);
+    } else {
+      _condition.wait_for(lock, std::chrono::duration<double>(timeout), ready);
+    }
+    size_t n = std::min(max_items, _items.size());
+    for (size_t i = 0; i < n; i++) {
+      items.push_back(std::move(_items.front()));
+      _items.pop_front();
+    }
+    if (_items.empty() && !_closed) {
+      unsignal();
+    }
+    return n;
+  }
+
+  // Wakes all waiting consumers and drops later items.
+  void close() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _closed = true;
+    signal();
+    _condition.notify_all();
+  }
+
+  int fileno() const { return _event; }
+  size_t capacity() const { return _capacity; }
+  size_t size() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _items.size();
+  }
+  uint64_t dropped() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _dropped;
+  }
+  bool closed() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _closed;
+  }
+};
+
+// Completed frames of one or more cameras, pass add as the camera callback.
+class FrameQueue : public PullQueue<std::shared_ptr<ImageMessage>> {
+ public:
+  FrameQueue(size_t capacity = 16,
+             BackpressurePolicy policy = BackpressurePolicy::DropOldest)
+      : PullQueue(capacity, policy) {}
+  void add(const std::shared_ptr<ImageMessage> &frame) { push(frame); }
+};
+
+// Messages of any type, such as tactile matrices and status.
+class MessageQueue : public PullQueue<std::shared_ptr<Message>> {
+ public:
+  MessageQueue(size_t capacity = 1024,
+               BackpressurePolicy policy = BackpressurePolicy::DropOldest)
+      : PullQueue(capacity, policy) {}
+  void add(const std::shared_ptr<Message> &message) { push(message); }
+};
+
+// Node that queues the packets of the channels it is connected to. Packets
+// share their pooled payloads, so queueing does not copy any bytes.
+class PacketQueue : public Node {
+  PullQueue<Packet> _queue;
+
+ public:
+  PacketQueue(size_t capacity = 65536,
+              BackpressurePolicy policy = BackpressurePolicy::DropOldest);
+  virtual void process(const Packet &packet) override;
+  virtual void process_batch(const PacketSpan &packets) override;
+  PullQueue<Packet> &queue() { return _queue; }
+};
+
+}  // namespace mittenwire
\ No newline at end of file
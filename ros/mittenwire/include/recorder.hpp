@@ -0,0 +1,102 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "bag.hpp"
+#include "message.hpp"
+#include "metrics.hpp"
+#include "object.hpp"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace mittenwire {
+
+// Records camera frames, tactile matrices and glove status into ROS bags,
+// as /camN/image_raw with /camN/camera_info, /impedance_matrix and
+// /glove_status stamped with their clock sync time like the live topics.
+// add() only queues a reference to the message and returns, serialization
+// and file access happen on a dedicated writer thread. Frames stay owned by
+// their camera's pool until written, a full pool allocates new frames
+// instead of waiting. Messages that would grow the backlog beyond
+// max_backlog_bytes are left out of the recording and counted, they still
+// reach every other consumer. So are frames with lost packets below the
+// minimum completeness, which the bag could not tell from intact ones.
+// All frames of one trigger are written with the bag time of the first, so
+// readers find them as one set.
+class Recorder : public Object<Recorder> {
+  size_t _max_backlog_bytes = 0;
+  size_t _chunk_size = 0;
+  std::atomic<double> _min_frame_completeness{0.95};
+
+  mutable std::mutex _mutex;
+  std::condition_variable _condition;
+  std::deque<std::shared_ptr<Message>> _queue;
+  size_t _backlog_bytes = 0;
+  bool _stop = false;
+  std::string _path;
+  std::thread _thread;
+  std::atomic<bool> _recording{false};
+
+  std::atomic<uint64_t> _messages{0};
+  std::atomic<uint64_t> _dropped{0};
+  std::atomic<uint64_t> _incomplete{0};
+  std::atomic<uint64_t> _bytes_written{0};
+
+  std::shared_ptr<MetricCounter> _messages_metric;
+  std::shared_ptr<MetricCounter> _dropped_metric;
+  std::shared_ptr<MetricGauge> _backlog_metric;
+  std::shared_ptr<MetricHistogram> _write_latency_us;
+
+  // topic to bag connection of the current recording
+  std::map<std::string, uint32_t> _connections;
+  // bag times of the recent triggers by request timestamp, oldest first
+  std::map<uint32_t, BagTime> _trigger_times;
+  std::deque<uint32_t> _triggers;
+  BagTime trigger_time(uint32_t request_timestamp, double stamp);
+  template <class T>
+  uint32_t connection(BagWriter& bag, const std::string& topic);
+  void write(BagWriter& bag, const Message& message);
+  void run(std::unique_ptr<BagWriter> bag);
+
+ public:
+  Recorder(size_t max_backlog_bytes = size_t(1) << 30,
+           size_t chunk_size = 4 << 20);
+  ~Recorder();
+  // Opens a new bag and starts recording into it, throws if the file cannot
+  // be created or a recording is already running.
+  void start(const std::string& path);
+  // Writes the backlog and the bag index and closes the bag. Blocks until the
+  // file is complete, does nothing if not recording.
+  void stop();
+  // Queues a message for the current recording, from any thread. Does
+  // nothing if not recording. Never waits for the disk.
+  void add(const std::shared_ptr<Message>& message);
+  bool recording() const { return _recording; }
+  // path of the current or last recording
+  std::string path() const;
+  // queued messages and their payload bytes
+  size_t backlog() const;
+  size_t backlog_bytes() const;
+  // counts of the current or last recording
+  uint64_t messages() const { return _messages; }
+  uint64_t dropped() const { return _dropped; }
+  uint64_t incomplete() const { return _incomplete; }
+  // Frames that lost packets are only recorded if at least this fraction of
+  // them arrived, 0 records all frames.
+  double min_frame_completeness() const { return _min_frame_completeness; }
+  void set_min_frame_completeness(double completeness) {
+    _min_frame_completeness = completeness;
+  }
+  uint64_t bytes_written() const { return _bytes_written; }
+};
+
+}  // namespace mittenwire
\ No newline at end of file
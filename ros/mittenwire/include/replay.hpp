@@ -0,0 +1,68 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "object.hpp"
+#include "superspeed.hpp"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace mittenwire {
+
+namespace superspeed {
+
+enum class ReplayPacing : uint8_t {
+  AsFastAsPossible,
+  RealTime,
+};
+
+struct ReplayState {
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool finished = false;
+  std::atomic<uint64_t> bytes_read{0};
+  std::atomic<uint64_t> bytes_written{0};
+};
+
+// Transport that plays back a captured raw bulk-in byte stream instead of
+// talking to the FT601. The source can be a file, a named pipe, standard input
+// ("-") or a unix stream socket ("unix:<path>"). In real-time mode, data is
+// handed out at bytes_per_second, otherwise as fast as the consumer accepts
+// it. Capture segments (.raw) are replayed with the transfer boundaries from
+// their index and, in real-time mode without a byte rate, with the recorded
+// timing. Everything written to the device is discarded.
+class ReplayDevice : public Object<ReplayDevice>, public Transport {
+  std::string _path;
+  ReplayPacing _pacing = ReplayPacing::AsFastAsPossible;
+  double _bytes_per_second = 0;
+  bool _loop = false;
+  std::shared_ptr<ReplayState> _state = std::make_shared<ReplayState>();
+
+ public:
+  ReplayDevice(const ReplayDevice &) = delete;
+  ReplayDevice &operator=(const ReplayDevice &) = delete;
+  ReplayDevice(const std::string &path,
+               ReplayPacing pacing = ReplayPacing::AsFastAsPossible,
+               double bytes_per_second = 0, bool loop = false);
+  virtual std::shared_ptr<ReaderStream> open_reader(
+      const std::function<void(Buffer &&)> &callback, size_t buffer_count,
+      size_t buffer_size, size_t max_buffer_count) override;
+  virtual void write_async(
+      const std::string &data,
+      const std::function<void()> &completed = nullptr) override;
+  virtual bool live() const override { return false; }
+  bool finished();
+  void wait();
+  uint64_t bytes_read() const { return _state->bytes_read; }
+  uint64_t bytes_written() const { return _state->bytes_written; }
+};
+
+}  // namespace superspeed
+
+}  // namespace mittenwire
@@ -0,0 +1,216 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+namespace mittenwire {
+
+enum class BackpressurePolicy : uint8_t {
+  DropOldest,
+  DropNewest,
+  Block,
+};
+
+// Bounded single-producer single-consumer queue. Each slot sits on its own
+// cache line and carries a sequence number, which also lets the producer
+// discard the oldest element when the queue is full. The consumer only sleeps
+// on an eventfd after the queue ran empty, so the producer only pays for a
+// wakeup if the consumer is idle.
+template <class T>
+class SpscRing {
+  struct alignas(64) Cell {
+    std::atomic<size_t> sequence{0};
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> _cells;
+  size_t _mask = 0;
+
+  alignas(64) std::atomic<size_t> _head{0};
+  alignas(64) std::atomic<size_t> _tail{0};
+
+  alignas(64) std::atomic<bool> _consumer_waiting{false};
+  std::atomic<bool> _producer_waiting{false};
+  std::atomic<bool> _closed{false};
+  std::atomic<BackpressurePolicy> _policy{BackpressurePolicy::DropOldest};
+  std::atomic<uint64_t> _dropped_oldest{0};
+  std::atomic<uint64_t> _dropped_newest{0};
+  int _data_event = -1;
+  int _space_event = -1;
+
+  static void signal(int fd) {
+    uint64_t v = 1;
+    if (write(fd, &v, sizeof(v)) != sizeof(v)) {
+      throw std::runtime_error("ring event write failed");
+    }
+  }
+
+  static void wait(int fd, int timeout) {
+    pollfd d = {0};
+    d.fd = fd;
+    d.events = POLLIN;
+    if (poll(&d, 1, timeout) > 0) {
+      uint64_t v = 0;
+      if (read(fd, &v, sizeof(v)) < 0) {
+        // nothing to reset
+      }
+    }
+  }
+
+  bool enqueue(T &item) {
+    size_t pos = _tail.load(std::memory_order_relaxed);
+    Cell &cell = _cells[pos & _mask];
+    if (cell.sequence.load(std::memory_order_acquire) != pos) {
+      return false;
+    }
+    cell.value = std::move(item);
+    cell.sequence.store(pos + 1, std::memory_order_release);
+    _tail.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  bool dequeue(T &item) {
+    size_t pos = _head.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = _cells[pos & _mask];
+      size_t seq = cell.sequence.load(std::memory_order_acquire);
+      intptr_t dif = intptr_t(seq) - intptr_t(pos + 1);
+      if (dif == 0) {
+        if (_head.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          item = std::move(cell.value);
+          cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = _head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+ public:
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  explicit SpscRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size *= 2;
+    }
+    _cells.reset(new Cell[size]);
+    _mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    _data_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _space_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_data_event < 0 || _space_event < 0) {
+      throw std::runtime_error("failed to create ring eventfd");
+    }
+  }
+
+  ~SpscRing() {
+    ::close(_data_event);
+    ::close(_space_event);
+  }
+
+  size_t capacity() const { return _mask + 1; }
+
+  size_t size() const {
+    return _tail.load(std::memory_order_relaxed) -
+           _head.load(std::memory_order_relaxed);
+  }
+
+  void set_policy(BackpressurePolicy policy) { _policy = policy; }
+  BackpressurePolicy policy() const { return _policy; }
+
+  uint64_t dropped_oldest() const { return _dropped_oldest; }
+  uint64_t dropped_newest() const { return _dropped_newest; }
+
+  // Called by the producer. Returns false if the item has been dropped.
+  bool push(T &&item) {
+    while (!_closed.load(std::memory_order_relaxed)) {
+      if (enqueue(item)) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_consumer_waiting.load(std::memory_order_relaxed) &&
+            _consumer_waiting.exchange(false)) {
+          signal(_data_event);
+        }
+        return true;
+      }
+      switch (_policy.load(std::memory_order_relaxed)) {
+        case BackpressurePolicy::DropNewest:
+          _dropped_newest++;
+          return false;
+        case BackpressurePolicy::DropOldest: {
+          T oldest;
+          if (dequeue(oldest)) {
+            _dropped_oldest++;
+          }
+          break;
+        }
+        case BackpressurePolicy::Block:
+          _producer_waiting.store(true);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if (_cells[_tail.load(std::memory_order_relaxed) & _mask]
+                  .sequence.load(std::memory_order_acquire) !=
+              _tail.load(std::memory_order_relaxed)) {
+            wait(_space_event, 100);
+          }
+          _producer_waiting.store(false);
+          break;
+      }
+    }
+    return false;
+  }
+
+  // Called by the consumer. Returns false if the ring is empty.
+  bool try_pop(T &item) {
+    if (dequeue(item)) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (_producer_waiting.load(std::memory_order_relaxed) &&
+          _producer_waiting.exchange(false)) {
+        signal(_space_event);
+      }
+      return true;
+    }
+    return false;
+  }
+
+  // Called by the consumer. Blocks until an item is available or the ring has
+  // been closed and drained.
+  bool pop(T &item) {
+    while (true) {
+      if (try_pop(item)) {
+        return true;
+      }
+      if (_closed.load()) {
+        return false;
+      }
+      _consumer_waiting.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (size() == 0 && !_closed.load()) {
+        wait(_data_event, -1);
+      }
+      _consumer_waiting.store(false);
+    }
+  }
+
+  void close() {
+    _closed = true;
+    signal(_data_event);
+    signal(_space_event);
+  }
+};
+
+}  // namespace mittenwire
@@ -0,0 +1,166 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+// Shared-exponent sample format of the tactile sensors, see
+// vlsi/hardware/shfloat.v. An I/Q pair of 32-bit samples is packed into one
+// word as
+//   [31:20] inphase mantissa, [19:8] quadrature mantissa, [7:0] exponent
+// where the exponent is the number of redundant sign bits both samples have
+// in common, at most 31. Header only and free of library dependencies, so
+// the same code builds for the host, the Verilator test bench and firmware.
+
+#include "simd.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mittenwire {
+
+static constexpr uint32_t shfloat_mantissa_mask = 0xfff00000;
+static constexpr uint32_t shfloat_mantissa_bits = 12;
+static constexpr uint32_t shfloat_exponent_mask = 0xff;
+static constexpr uint32_t shfloat_max_exponent = 31;
+
+inline uint32_t shfloat_exponent(int32_t i, int32_t q) {
+  // magnitude bits of both samples, the top bit is always clear
+  uint32_t m = uint32_t((i ^ (i >> 31)) | (q ^ (q >> 31)));
+  return m ? __builtin_clz(m) - 1 : shfloat_max_exponent;
+}
+
+inline uint32_t shfloat_pack(int32_t i, int32_t q) {
+  uint32_t exp = shfloat_exponent(i, q);
+  return exp | ((uint32_t(i) << exp) & shfloat_mantissa_mask) |
+         (((uint32_t(q) << exp) & shfloat_mantissa_mask) >>
+          shfloat_mantissa_bits);
+}
+
+// Exponents above 31 are not produced by the encoder and decode like 31.
+inline void shfloat_unpack(uint32_t v, int32_t &i, int32_t &q) {
+  uint32_t exp = v & shfloat_exponent_mask;
+  exp = exp < shfloat_max_exponent ? exp : shfloat_max_exponent;
+  i = int32_t(v & shfloat_mantissa_mask) >> exp;
+  q = int32_t((v << shfloat_mantissa_bits) & shfloat_mantissa_mask) >> exp;
+}
+
+#if defined(MTW_SIMD_AVX2)
+// batch kernels, return the number of elements done
+MTW_TARGET_AVX2 inline size_t shfloat_pack_avx2(
+    const int32_t *__restrict inphase, const int32_t *__restrict quadrature,
+    uint32_t *__restrict packed, size_t count) {
+  size_t k = 0;
+  const __m256i mask = _mm256_set1_epi32(shfloat_mantissa_mask);
+  for (; k + 8 <= count; k += 8) {
+    __m256i i = _mm256_loadu_si256((const __m256i *)(inphase + k));
+    __m256i q = _mm256_loadu_si256((const __m256i *)(quadrature + k));
+    __m256i m = _mm256_or_si256(_mm256_xor_si256(i, _mm256_srai_epi32(i, 31)),
+                                _mm256_xor_si256(q, _mm256_srai_epi32(q, 31)));
+    // no 32-bit lzcnt before AVX-512, normalize m by binary search instead
+    __m256i exp = _mm256_setzero_si256();
+#define MTW_SHFLOAT_STEP(s)                                                \
+  {                                                                        \
+    __m256i c = _mm256_cmpgt_epi32(_mm256_set1_epi32(1 << (31 - s)), m);   \
+    m = _mm256_blendv_epi8(m, _mm256_slli_epi32(m, s), c);                 \
+    exp = _mm256_add_epi32(exp, _mm256_and_si256(c, _mm256_set1_epi32(s))); \
+  }
+    MTW_SHFLOAT_STEP(16)
+    MTW_SHFLOAT_STEP(8)
+    MTW_SHFLOAT_STEP(4)
+    MTW_SHFLOAT_STEP(2)
+    MTW_SHFLOAT_STEP(1)
+#undef MTW_SHFLOAT_STEP
+    i = _mm256_and_si256(_mm256_sllv_epi32(i, exp), mask);
+    q = _mm256_and_si256(_mm256_sllv_epi32(q, exp), mask);
+    _mm256_storeu_si256(
+        (__m256i *)(packed + k),
+        _mm256_or_si256(_mm256_or_si256(exp, i),
+                        _mm256_srli_epi32(q, shfloat_mantissa_bits)));
+  }
+  return k;
+}
+
+MTW_TARGET_AVX2 inline size_t shfloat_unpack_avx2(
+    const uint32_t *__restrict packed, int32_t *__restrict inphase,
+    int32_t *__restrict quadrature, size_t count) {
+  size_t k = 0;
+  const __m256i mask = _mm256_set1_epi32(shfloat_mantissa_mask);
+  const __m256i exp_mask = _mm256_set1_epi32(shfloat_exponent_mask);
+  for (; k + 8 <= count; k += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(packed + k));
+    // shift counts above 31 fill with the sign bit, same as 31
+    __m256i exp = _mm256_and_si256(v, exp_mask);
+    __m256i i = _mm256_and_si256(v, mask);
+    __m256i q =
+        _mm256_and_si256(_mm256_slli_epi32(v, shfloat_mantissa_bits), mask);
+    _mm256_storeu_si256((__m256i *)(inphase + k), _mm256_srav_epi32(i, exp));
+    _mm256_storeu_si256((__m256i *)(quadrature + k),
+                        _mm256_srav_epi32(q, exp));
+  }
+  return k;
+}
+#endif
+
+inline void shfloat_pack(const int32_t *__restrict inphase,
+                         const int32_t *__restrict quadrature,
+                         uint32_t *__restrict packed, size_t count) {
+  size_t k = 0;
+#if defined(MTW_SIMD_AVX2)
+  if (simd_avx2()) {
+    k = shfloat_pack_avx2(inphase, quadrature, packed, count);
+  }
+#elif defined(__ARM_NEON)
+  {
+    const uint32x4_t mask = vdupq_n_u32(shfloat_mantissa_mask);
+    for (; k + 4 <= count; k += 4) {
+      int32x4_t i = vld1q_s32(inphase + k);
+      int32x4_t q = vld1q_s32(quadrature + k);
+      uint32x4_t m = vreinterpretq_u32_s32(
+          vorrq_s32(veorq_s32(i, vshrq_n_s32(i, 31)),
+                    veorq_s32(q, vshrq_n_s32(q, 31))));
+      // clz(0) is 32, which gives the maximum exponent of 31
+      int32x4_t exp =
+          vreinterpretq_s32_u32(vsubq_u32(vclzq_u32(m), vdupq_n_u32(1)));
+      uint32x4_t pi = vandq_u32(vreinterpretq_u32_s32(vshlq_s32(i, exp)), mask);
+      uint32x4_t pq = vandq_u32(vreinterpretq_u32_s32(vshlq_s32(q, exp)), mask);
+      vst1q_u32(packed + k,
+                vorrq_u32(vorrq_u32(vreinterpretq_u32_s32(exp), pi),
+                          vshrq_n_u32(pq, shfloat_mantissa_bits)));
+    }
+  }
+#endif
+  for (; k < count; k++) {
+    packed[k] = shfloat_pack(inphase[k], quadrature[k]);
+  }
+}
+
+inline void shfloat_unpack(const uint32_t *__restrict packed,
+                           int32_t *__restrict inphase,
+                           int32_t *__restrict quadrature, size_t count) {
+  size_t k = 0;
+#if defined(MTW_SIMD_AVX2)
+  if (simd_avx2()) {
+    k = shfloat_unpack_avx2(packed, inphase, quadrature, count);
+  }
+#elif defined(__ARM_NEON)
+  {
+    const uint32x4_t mask = vdupq_n_u32(shfloat_mantissa_mask);
+    const uint32x4_t exp_mask = vdupq_n_u32(shfloat_exponent_mask);
+    const uint32x4_t exp_max = vdupq_n_u32(shfloat_max_exponent);
+    for (; k + 4 <= count; k += 4) {
+      uint32x4_t v = vld1q_u32(packed + k);
+      int32x4_t shift = vnegq_s32(
+          vreinterpretq_s32_u32(vminq_u32(vandq_u32(v, exp_mask), exp_max)));
+      int32x4_t i = vreinterpretq_s32_u32(vandq_u32(v, mask));
+      int32x4_t q = vreinterpretq_s32_u32(
+          vandq_u32(vshlq_n_u32(v, shfloat_mantissa_bits), mask));
+      vst1q_s32(inphase + k, vshlq_s32(i, shift));
+      vst1q_s32(quadrature + k, vshlq_s32(q, shift));
+    }
+  }
+#endif
+  for (; k < count; k++) {
+    shfloat_unpack(packed[k], inphase[k], quadrature[k]);
+  }
+}
+
+}  // namespace mittenwire
\ No newline at end of file
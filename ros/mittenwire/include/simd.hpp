@@ -0,0 +1,47 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+// Runtime selection of SIMD kernels. The library is built for the baseline
+// instruction set of the target, so on x86 the AVX2 kernels are compiled
+// with MTW_TARGET_AVX2 and only called if simd_avx2() reports CPU support.
+// Builds with AVX2 enabled, like the Verilator test bench, skip the check.
+// Header only and free of library dependencies, like shfloat.hpp.
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define MTW_SIMD_AVX2 1
+#define MTW_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace mittenwire {
+
+inline bool simd_avx2() {
+#if defined(__AVX2__)
+  return true;
+#elif defined(MTW_SIMD_AVX2)
+  static const bool supported =
+      (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+  return supported;
+#else
+  return false;
+#endif
+}
+
+// widest instruction set the kernels use on this CPU
+inline const char *simd_name() {
+  if (simd_avx2()) {
+    return "avx2";
+  }
+#if defined(__SSE2__)
+  return "sse2";
+#elif defined(__ARM_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+}  // namespace mittenwire
\ No newline at end of file
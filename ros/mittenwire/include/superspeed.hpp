@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "metrics.hpp"
 #include "object.hpp"
 
 #include <stdint.h>
@@ -69,6 +70,89 @@ struct Config {
   uint32_t gpio_control = 0x0;
 };
 
+class BufferSource {
+ public:
+  virtual ~BufferSource() {}
+  virtual void recycle(void *handle) = 0;
+};
+
+// Lease on the data of a completed bulk-in transfer. The transfer is handed
+// back to its source and resubmitted once the lease is released.
+class Buffer {
+  std::shared_ptr<BufferSource> _source;
+  void *_handle = nullptr;
+  const uint8_t *_data = nullptr;
+  size_t _size = 0;
+  uint64_t _timestamp = 0;
+
+ public:
+  Buffer() {}
+  Buffer(const std::shared_ptr<BufferSource> &source, void *handle,
+         const uint8_t *data, size_t size, uint64_t timestamp = 0)
+      : _source(source),
+        _handle(handle),
+        _data(data),
+        _size(size),
+        _timestamp(timestamp) {}
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+  Buffer(Buffer &&other) noexcept { *this = std::move(other); }
+  Buffer &operator=(Buffer &&other) noexcept {
+    if (this != &other) {
+      release();
+      _source = std::move(other._source);
+      _handle = other._handle;
+      _data = other._data;
+      _size = other._size;
+      _timestamp = other._timestamp;
+      other._handle = nullptr;
+      other._data = nullptr;
+      other._size = 0;
+    }
+    return *this;
+  }
+  ~Buffer() { release(); }
+  const uint8_t *data() const { return _data; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  // Host monotonic time in nanoseconds at which the transfer completed.
+  uint64_t timestamp() const { return _timestamp; }
+  void set_timestamp(uint64_t timestamp) { _timestamp = timestamp; }
+  explicit operator bool() const { return _handle != nullptr; }
+  void release() {
+    if (_handle) {
+      _source->recycle(_handle);
+    }
+    _source.reset();
+    _handle = nullptr;
+    _data = nullptr;
+    _size = 0;
+  }
+};
+
+class ReaderStream {
+ public:
+  virtual ~ReaderStream() {}
+  virtual void stop() = 0;
+};
+
+// Byte stream endpoint that readers, writers and masters are built on.
+class Transport {
+ public:
+  virtual ~Transport() {}
+  virtual std::shared_ptr<ReaderStream> open_reader(
+      const std::function<void(Buffer &&)> &callback, size_t buffer_count,
+      size_t buffer_size, size_t max_buffer_count) = 0;
+  // Sends data to the device. completed, if set, runs once the transfer has
+  // finished, possibly on another thread.
+  virtual void write_async(
+      const std::string &data,
+      const std::function<void()> &completed = nullptr) = 0;
+  // False for sources that can wait for the consumer without losing data,
+  // like recorded streams.
+  virtual bool live() const { return true; }
+};
+
 class ContextImpl;
 class EventLoop;
 class Context : public Object<Context> {
@@ -93,7 +177,6 @@ class DeviceBase : public Object<DeviceBase> {
 
  public:
   std::shared_ptr<DeviceImpl> impl_or_null_unsafe();
-  friend class Reader;
 };
 
 class DeviceLock {
@@ -112,7 +195,7 @@ class DeviceLock {
   operator bool() { return bool(_impl); }
 };
 
-class Device : public DeviceBase {
+class Device : public DeviceBase, public Transport {
  public:
   Device(const Device &) = delete;
   Device &operator=(const Device &) = delete;
@@ -132,8 +215,12 @@ class Device : public DeviceBase {
   void write(const std::string &data);
   std::vector<uint8_t> read(ssize_t count = -1, int timeout = -1);
   void reset();
-  void write_async(const std::string &data);
-  friend class Reader;
+  virtual void write_async(
+      const std::string &data,
+      const std::function<void()> &completed = nullptr) override;
+  virtual std::shared_ptr<ReaderStream> open_reader(
+      const std::function<void(Buffer &&)> &callback, size_t buffer_count,
+      size_t buffer_size, size_t max_buffer_count) override;
 };
 
 class EventLoop : public Object<EventLoop> {
@@ -148,28 +235,53 @@ class EventLoop : public Object<EventLoop> {
   ~EventLoop();
 };
 
-struct ReaderImpl;
+class Capture;
 
 class Reader : public Object<Reader> {
-  std::shared_ptr<ReaderImpl> _impl;
+  std::shared_ptr<ReaderStream> _impl;
+  // held by the reader callback while it appends, so set_capture() knows the
+  // previous capture is no longer in use once it has swapped it out
+  mutable std::mutex _capture_mutex;
+  std::shared_ptr<Capture> _capture;
+  uint64_t _transfer_index = 0;
+  std::shared_ptr<MetricCounter> _transfers_metric =
+      MetricsRegistry::instance().counter("reader.transfers");
+  std::shared_ptr<MetricCounter> _bytes_metric =
+      MetricsRegistry::instance().counter("reader.bytes");
 
  public:
-  Reader(const std::shared_ptr<Device> &device,
-         const std::function<void(const void *, size_t)> &callback,
-         size_t buffer_count, size_t buffer_size);
+  // Keeps buffer_count transfers in flight. Transfers whose buffers are still
+  // leased are replaced by new ones, up to max_buffer_count in total.
+  Reader(const std::shared_ptr<Transport> &transport,
+         const std::function<void(Buffer &&)> &callback, size_t buffer_count,
+         size_t buffer_size, size_t max_buffer_count);
+  ~Reader();
+  // Records every transfer into the capture before it is passed on, or stops
+  // recording if capture is null.
+  void set_capture(const std::shared_ptr<Capture> &capture);
+  std::shared_ptr<Capture> capture() const {
+    std::lock_guard<std::mutex> lock(_capture_mutex);
+    return _capture;
+  }
 };
 
 class Writer : public Object<Writer> {
-  std::shared_ptr<Device> _device;
+  std::shared_ptr<Transport> _transport;
   std::thread _thread;
   std::mutex _mutex;
   std::condition_variable _condition;
   bool _ok = true;
   bool _new = false;
   std::function<std::string()> _callback;
+  std::shared_ptr<MetricCounter> _writes_metric =
+      MetricsRegistry::instance().counter("writer.writes");
+  std::shared_ptr<MetricHistogram> _callback_time_metric =
+      MetricsRegistry::instance().histogram("writer.callback_time_us");
+  std::shared_ptr<MetricHistogram> _write_latency_metric =
+      MetricsRegistry::instance().histogram("writer.write_latency_us");
 
  public:
-  Writer(const std::shared_ptr<Device> &device,
+  Writer(const std::shared_ptr<Transport> &transport,
          const std::function<std::string()> &callback, double interval);
   ~Writer();
   void update();
@@ -0,0 +1,87 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "camera.hpp"
+#include "metrics.hpp"
+#include "object.hpp"
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mittenwire {
+
+// Frames of several cameras taken on the same hub trigger, which the hub
+// stamps into every camera request and which comes back as
+// ImageMessage::request_timestamp.
+struct FrameSet {
+  uint32_t request_timestamp = 0;
+  // channels of the synchronizer and the frame of each, null where missing
+  std::vector<size_t> channels;
+  std::vector<std::shared_ptr<ImageMessage>> frames;
+  // host monotonic ns at which the first and the last frame arrived
+  uint64_t first_host_timestamp = 0;
+  uint64_t last_host_timestamp = 0;
+  bool complete() const;
+  std::vector<size_t> missing_channels() const;
+};
+
+// Groups the frames of a fixed set of camera channels by trigger. A set is
+// delivered as soon as every channel has contributed a frame, or
+// incomplete once it has waited timeout seconds since its first frame, once
+// a newer set has completed, or once more than max_pending sets are open.
+// Frames arriving for a set that has already been delivered are dropped.
+// Sets are delivered in trigger order on a thread of the synchronizer, so
+// slow consumers never stall the cameras. The synchronizer must not be
+// destroyed from its own callback.
+class FrameSynchronizer : public Object<FrameSynchronizer> {
+  struct Pending {
+    std::shared_ptr<FrameSet> set;
+    size_t count = 0;
+    uint64_t deadline = 0;
+  };
+
+  std::vector<size_t> _channels;
+  std::function<void(const std::shared_ptr<FrameSet>&)> _callback;
+  uint64_t _timeout_ns = 0;
+  size_t _max_pending = 0;
+
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  // open sets in order of their first frame
+  std::deque<Pending> _pending;
+  std::deque<std::shared_ptr<FrameSet>> _ready;
+  // recently delivered triggers, to recognize late frames
+  std::deque<uint32_t> _delivered;
+  bool _exit = false;
+  std::thread _thread;
+
+  std::shared_ptr<MetricCounter> _complete_sets;
+  std::shared_ptr<MetricCounter> _incomplete_sets;
+  std::shared_ptr<MetricCounter> _late_frames;
+  std::shared_ptr<MetricHistogram> _set_spread_us;
+
+  // moves the first count pending sets to the ready queue
+  void deliver(size_t count);
+  void run();
+
+ public:
+  FrameSynchronizer(
+      const std::vector<size_t>& channels,
+      const std::function<void(const std::shared_ptr<FrameSet>&)>& callback,
+      double timeout = 0.1, size_t max_pending = 8);
+  ~FrameSynchronizer();
+  // Adds a frame of one of the channels, from any thread. Pass this as the
+  // callback of the cameras.
+  void add(const std::shared_ptr<ImageMessage>& frame);
+  const std::vector<size_t>& channels() const { return _channels; }
+};
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,95 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "clocksync.hpp"
+#include "message.hpp"
+#include "metrics.hpp"
+#include "node.hpp"
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+
+namespace mittenwire {
+
+// Impedance matrix of a tactile glove, samples in row-major order.
+struct TactileMatrix : Message {
+  static constexpr size_t width = 16;
+  static constexpr size_t height = 16;
+  static constexpr size_t size = width * height;
+  // hub time of the first chunk
+  uint32_t timestamp = 0;
+  // host monotonic ns at which the last chunk arrived
+  uint64_t host_timestamp = 0;
+  // timestamp mapped to system clock seconds, 0 without clock sync
+  double stamp = 0;
+  size_t chunks_received = 0;
+  int32_t inphase[size] = {};
+  int32_t quadrature[size] = {};
+  // 1 for samples that were received
+  uint8_t validity[size] = {};
+  bool complete() const;
+};
+
+// Decoded GloveStatusPacket in physical units.
+struct TactileStatus : Message {
+  uint32_t timestamp = 0;
+  uint64_t host_timestamp = 0;
+  double stamp = 0;
+  uint32_t clock_milliseconds = 0;
+  // degrees Celsius
+  float core_temperature = 0;
+  bool button_pressed = false;
+  bool battery_disconnect = false;
+  bool battery_charging = false;
+  bool usb_power_present = false;
+  // volts and amperes
+  float battery_voltage = 0;
+  float battery_current = 0;
+  float imu_temperature = 0;
+  // g and degrees per second
+  float imu_linear_acceleration[3] = {};
+  float imu_angular_velocity[3] = {};
+};
+
+// Reassembles the impedance matrices of a tactile glove from its radio
+// packets and decodes its status packets. A matrix is delivered once its last
+// chunk arrives, or with the missing samples marked invalid once chunks of
+// the next matrix start arriving.
+class Tactile : public Node {
+  std::function<void(const std::shared_ptr<TactileMatrix>&)> matrix_callback;
+  std::function<void(const std::shared_ptr<TactileStatus>&)> status_callback;
+  std::shared_ptr<TactileMatrix> matrix;
+  uint32_t prev_index = 0;
+  std::shared_ptr<ClockSync> clock_sync;
+
+  struct Metrics {
+    std::shared_ptr<MetricCounter> matrices;
+    std::shared_ptr<MetricCounter> incomplete_matrices;
+    std::shared_ptr<MetricCounter> status_packets;
+    std::shared_ptr<MetricCounter> unknown_packets;
+  };
+  std::unique_ptr<Metrics> metrics;
+  size_t metrics_channel = 0;
+  Metrics& get_metrics(size_t channel);
+  void flush(Metrics& m);
+
+ public:
+  // Called on the thread that processes packets, matrices and status are not
+  // modified after delivery and may be retained.
+  Tactile(const std::function<void(const std::shared_ptr<TactileMatrix>&)>&
+              matrix_callback,
+          const std::function<void(const std::shared_ptr<TactileStatus>&)>&
+              status_callback)
+      : matrix_callback(matrix_callback), status_callback(status_callback) {}
+  virtual void process(const Packet& packet) override;
+  // Feeds radio timestamps into the estimator and uses it to stamp matrices
+  // and status with system clock time.
+  void set_clock_sync(const std::shared_ptr<ClockSync>& sync) {
+    clock_sync = sync;
+  }
+};
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,36 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#pragma once
+
+#include "object.hpp"
+#include "tactile.hpp"
+
+#include <mittenwire/GloveStatus.h>
+#include <mittenwire/ImpedanceMatrix.h>
+#include <ros/ros.h>
+
+#include <string>
+
+namespace mittenwire {
+
+// Convert everything but the header stamp.
+void tactile_to_ros(const TactileMatrix& matrix,
+                    mittenwire::ImpedanceMatrix& msg);
+void tactile_to_ros(const TactileStatus& status, mittenwire::GloveStatus& msg);
+
+// Publishes tactile matrices and glove status as mittenwire/ImpedanceMatrix
+// and mittenwire/GloveStatus straight from the packet path. Messages are
+// stamped with their clock sync time, or with the current time without one.
+class TactilePublisher : public Object<TactilePublisher> {
+  ros::Publisher _matrix_publisher;
+  ros::Publisher _status_publisher;
+
+ public:
+  TactilePublisher(ros::NodeHandle& node_handle,
+                   const std::string& matrix_topic = "impedance_matrix",
+                   const std::string& status_topic = "glove_status");
+  void publish(const TactileMatrix& matrix);
+  void publish(const TactileStatus& status);
+};
+
+}  // namespace mittenwire
\ No newline at end of file
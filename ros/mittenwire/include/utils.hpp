@@ -2,8 +2,19 @@
 
 #pragma once
 
+#include <stdint.h>
+
+#include <chrono>
+
 namespace mittenwire {
 
 void set_current_thread_name(const char* name);
 
+// Host timestamps throughout mittenwire are steady_clock nanoseconds.
+inline uint64_t monotonic_time_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 }  // namespace mittenwire
\ No newline at end of file
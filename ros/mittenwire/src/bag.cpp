@@ -0,0 +1,569 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <bag.hpp>
+
+#include <log.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+
+namespace mittenwire {
+
+static const char bag_magic[] = "#ROSBAG V2.0\n";
+static constexpr size_t bag_magic_size = sizeof(bag_magic) - 1;
+// the bag header record is padded to this size so it can be rewritten
+static constexpr size_t bag_header_size = 4096;
+static constexpr size_t bag_buffer_alignment = 4096;
+
+enum BagOp : uint8_t {
+  bag_op_message = 0x02,
+  bag_op_bag_header = 0x03,
+  bag_op_index = 0x04,
+  bag_op_chunk = 0x05,
+  bag_op_chunk_info = 0x06,
+  bag_op_connection = 0x07,
+};
+
+// Record header, a sequence of length prefixed name=value fields.
+class BagFields {
+  std::string _data;
+
+ public:
+  BagFields &field(const char *name, const void *value, size_t size) {
+    size_t name_size = strlen(name);
+    uint32_t len = name_size + 1 + size;
+    _data.append((const char *)&len, 4);
+    _data.append(name, name_size);
+    _data.push_back('=');
+    _data.append((const char *)value, size);
+    return *this;
+  }
+  BagFields &field(const char *name, const std::string &value) {
+    return field(name, value.data(), value.size());
+  }
+  template <class T>
+  BagFields &field(const char *name, const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    return field(name, &value, sizeof(value));
+  }
+  const std::string &data() const { return _data; }
+};
+
+static_assert(sizeof(BagTime) == 8, "");
+
+static void append_record(std::string &out, const BagFields &header,
+                          const void *data, size_t size) {
+  uint32_t len = header.data().size();
+  out.append((const char *)&len, 4);
+  out += header.data();
+  len = size;
+  out.append((const char *)&len, 4);
+  out.append((const char *)data, size);
+}
+
+static BagFields chunk_header(uint32_t size) {
+  return BagFields()
+      .field("op", bag_op_chunk)
+      .field("compression", std::string("none"))
+      .field("size", size);
+}
+
+// Bag header record padded to bag_header_size. Bags that were not closed
+// keep index_pos 0, which rosbag reindex recognizes.
+static std::string bag_header_record(uint64_t index_position,
+                                     uint32_t connection_count,
+                                     uint32_t chunk_count) {
+  BagFields header;
+  header.field("op", bag_op_bag_header)
+      .field("index_pos", index_position)
+      .field("conn_count", connection_count)
+      .field("chunk_count", chunk_count);
+  std::string padding(bag_header_size - 8 - header.data().size(), ' ');
+  std::string record;
+  append_record(record, header, padding.data(), padding.size());
+  return record;
+}
+
+// record length and header of a chunk, reserved at the start of the buffer
+static const size_t bag_chunk_prefix = 4 + chunk_header(0).data().size() + 4;
+
+BagTime::BagTime(double seconds) {
+  double s = floor(seconds);
+  sec = (uint32_t)s;
+  nsec = std::min<uint32_t>(999999999, (uint32_t)((seconds - s) * 1e9 + 0.5));
+}
+
+BagWriter::BagWriter(const std::string &path, size_t chunk_threshold)
+    : _path(path), _chunk_threshold(chunk_threshold) {
+  _capacity = (chunk_threshold + (1 << 20) + bag_buffer_alignment - 1) /
+              bag_buffer_alignment * bag_buffer_alignment;
+  _buffer = (uint8_t *)aligned_alloc(bag_buffer_alignment, _capacity);
+  if (!_buffer) {
+    throw std::bad_alloc();
+  }
+  _fill = bag_chunk_prefix;
+  _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (_fd < 0) {
+    int err = errno;
+    free(_buffer);
+    throw std::runtime_error("failed to create bag " + path + " " +
+                             strerror(err));
+  }
+  // header without index, rewritten by close()
+  std::string head(bag_magic, bag_magic_size);
+  head += bag_header_record(0, 0, 0);
+  try {
+    write_file(head.data(), head.size());
+  } catch (...) {
+    ::close(_fd);
+    free(_buffer);
+    throw;
+  }
+}
+
+BagWriter::~BagWriter() {
+  try {
+    close();
+  } catch (std::exception &e) {
+    MTW_LOG_ERROR("failed to close bag " << _path << " " << e.what());
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+  free(_buffer);
+}
+
+uint8_t *BagWriter::reserve(size_t size) {
+  if (_fill + size > _capacity) {
+    size_t capacity = std::max(_capacity * 2, _fill + size);
+    capacity = (capacity + bag_buffer_alignment - 1) / bag_buffer_alignment *
+               bag_buffer_alignment;
+    uint8_t *buffer = (uint8_t *)aligned_alloc(bag_buffer_alignment, capacity);
+    if (!buffer) {
+      throw std::bad_alloc();
+    }
+    memcpy(buffer, _buffer, _fill);
+    free(_buffer);
+    _buffer = buffer;
+    _capacity = capacity;
+  }
+  uint8_t *ret = _buffer + _fill;
+  _fill += size;
+  return ret;
+}
+
+void BagWriter::write_file(const void *data, size_t size) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (size > 0) {
+    ssize_t n = ::write(_fd, p, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("failed to write bag " + _path + " " +
+                               strerror(errno));
+    }
+    p += n;
+    size -= n;
+    _file_size += n;
+  }
+}
+
+uint32_t BagWriter::add_connection(const std::string &topic,
+                                   const std::string &type,
+                                   const std::string &md5sum,
+                                   const std::string &definition) {
+  Connection c;
+  c.topic = topic;
+  c.type = type;
+  c.md5sum = md5sum;
+  c.definition = definition;
+  _connections.push_back(std::move(c));
+  return _connections.size() - 1;
+}
+
+static std::string connection_record(uint32_t id, const std::string &topic,
+                                     const std::string &type,
+                                     const std::string &md5sum,
+                                     const std::string &definition) {
+  BagFields data;
+  data.field("topic", topic)
+      .field("type", type)
+      .field("md5sum", md5sum)
+      .field("message_definition", definition);
+  std::string ret;
+  append_record(ret,
+                BagFields()
+                    .field("op", bag_op_connection)
+                    .field("conn", id)
+                    .field("topic", topic),
+                data.data().data(), data.data().size());
+  return ret;
+}
+
+void BagWriter::write_connection(uint32_t id) {
+  auto &c = _connections[id];
+  std::string record =
+      connection_record(id, c.topic, c.type, c.md5sum, c.definition);
+  memcpy(reserve(record.size()), record.data(), record.size());
+  c.in_chunk = true;
+}
+
+uint8_t *BagWriter::add_message(uint32_t connection, const BagTime &time,
+                                size_t size) {
+  if (_fd < 0) {
+    throw std::runtime_error("bag " + _path + " is closed");
+  }
+  if (connection >= _connections.size()) {
+    throw std::runtime_error("unknown bag connection");
+  }
+  if (_fill - bag_chunk_prefix >= _chunk_threshold) {
+    flush_chunk();
+  }
+  auto &c = _connections[connection];
+  if (!c.in_chunk) {
+    write_connection(connection);
+  }
+  c.index_times.push_back(time.value());
+  c.index_offsets.push_back(_fill - bag_chunk_prefix);
+  if (_chunk_messages == 0 || time < _chunk_start) {
+    _chunk_start = time;
+  }
+  if (_chunk_messages == 0 || _chunk_end < time) {
+    _chunk_end = time;
+  }
+  _chunk_messages++;
+
+  BagFields header;
+  header.field("op", bag_op_message).field("conn", connection).field("time",
+                                                                       time);
+  uint32_t header_size = header.data().size();
+  uint32_t data_size = size;
+  uint8_t *p = reserve(4 + header_size + 4 + size);
+  memcpy(p, &header_size, 4);
+  memcpy(p + 4, header.data().data(), header_size);
+  memcpy(p + 4 + header_size, &data_size, 4);
+  return p + 4 + header_size + 4;
+}
+
+void BagWriter::flush_chunk() {
+  if (_chunk_messages == 0) {
+    return;
+  }
+  uint32_t data_size = _fill - bag_chunk_prefix;
+
+  ChunkInfo info;
+  info.position = _file_size;
+  info.start = _chunk_start;
+  info.end = _chunk_end;
+
+  // index records follow the chunk and go out with the same write
+  std::string index;
+  for (uint32_t id = 0; id < _connections.size(); id++) {
+    auto &c = _connections[id];
+    if (c.index_times.empty()) {
+      c.in_chunk = false;
+      continue;
+    }
+    uint32_t count = c.index_times.size();
+    info.counts.emplace_back(id, count);
+    std::string entries;
+    for (size_t i = 0; i < count; i++) {
+      BagTime t(c.index_times[i] >> 32, c.index_times[i] & 0xffffffff);
+      entries.append((const char *)&t, sizeof(t));
+      entries.append((const char *)&c.index_offsets[i], 4);
+    }
+    append_record(index,
+                  BagFields()
+                      .field("op", bag_op_index)
+                      .field("ver", uint32_t(1))
+                      .field("conn", id)
+                      .field("count", count),
+                  entries.data(), entries.size());
+    c.index_times.clear();
+    c.index_offsets.clear();
+    c.in_chunk = false;
+  }
+  memcpy(reserve(index.size()), index.data(), index.size());
+
+  BagFields header = chunk_header(data_size);
+  uint32_t header_size = header.data().size();
+  memcpy(_buffer, &header_size, 4);
+  memcpy(_buffer + 4, header.data().data(), header_size);
+  memcpy(_buffer + 4 + header_size, &data_size, 4);
+
+  write_file(_buffer, _fill);
+  _chunks.push_back(std::move(info));
+  _fill = bag_chunk_prefix;
+  _chunk_messages = 0;
+}
+
+void BagWriter::close() {
+  if (_fd < 0) {
+    return;
+  }
+  flush_chunk();
+
+  uint64_t index_position = _file_size;
+  std::string index;
+  for (uint32_t id = 0; id < _connections.size(); id++) {
+    auto &c = _connections[id];
+    index += connection_record(id, c.topic, c.type, c.md5sum, c.definition);
+  }
+  for (auto &chunk : _chunks) {
+    std::string counts;
+    for (auto &entry : chunk.counts) {
+      counts.append((const char *)&entry.first, 4);
+      counts.append((const char *)&entry.second, 4);
+    }
+    append_record(index,
+                  BagFields()
+                      .field("op", bag_op_chunk_info)
+                      .field("ver", uint32_t(1))
+                      .field("chunk_pos", chunk.position)
+                      .field("start_time", chunk.start)
+                      .field("end_time", chunk.end)
+                      .field("count", uint32_t(chunk.counts.size())),
+                  counts.data(), counts.size());
+  }
+  write_file(index.data(), index.size());
+
+  std::string record =
+      bag_header_record(index_position, _connections.size(), _chunks.size());
+  if (pwrite(_fd, record.data(), record.size(), bag_magic_size) !=
+      (ssize_t)record.size()) {
+    throw std::runtime_error("failed to write bag header " + _path + " " +
+                             strerror(errno));
+  }
+  int fd = _fd;
+  _fd = -1;
+  if (::close(fd) != 0) {
+    throw std::runtime_error("failed to close bag " + _path + " " +
+                             strerror(errno));
+  }
+}
+
+// Looks up a field of a record header, false if there is none.
+static bool bag_field(const std::string &header, const char *name,
+                      std::string &value) {
+  size_t name_size = strlen(name);
+  size_t pos = 0;
+  while (pos + 4 <= header.size()) {
+    uint32_t len = 0;
+    memcpy(&len, header.data() + pos, 4);
+    pos += 4;
+    if (len > header.size() - pos) {
+      break;
+    }
+    if (len > name_size && header[pos + name_size] == '=' &&
+        header.compare(pos, name_size, name) == 0) {
+      value.assign(header, pos + name_size + 1, len - name_size - 1);
+      return true;
+    }
+    pos += len;
+  }
+  return false;
+}
+
+template <class T>
+static T bag_field(const std::string &header, const char *name) {
+  static_assert(std::is_trivially_copyable<T>::value, "");
+  std::string value;
+  if (!bag_field(header, name, value) || value.size() != sizeof(T)) {
+    throw std::runtime_error(std::string("bag record without valid ") + name +
+                             " field");
+  }
+  T ret;
+  memcpy(&ret, value.data(), sizeof(T));
+  return ret;
+}
+
+BagReader::BagReader(const std::string &path) : _path(path) {
+  _fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (_fd < 0) {
+    throw std::runtime_error("failed to open bag " + path + " " +
+                             strerror(errno));
+  }
+  try {
+    read_index();
+  } catch (...) {
+    ::close(_fd);
+    throw;
+  }
+}
+
+BagReader::~BagReader() { ::close(_fd); }
+
+void BagReader::read_file(void *data, size_t size, uint64_t position) const {
+  uint8_t *p = (uint8_t *)data;
+  while (size > 0) {
+    ssize_t n = pread(_fd, p, size, position);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("failed to read bag " + _path + " " +
+                               strerror(errno));
+    }
+    if (n == 0) {
+      throw std::runtime_error("bag " + _path + " is truncated");
+    }
+    p += n;
+    size -= n;
+    position += n;
+  }
+}
+
+uint64_t BagReader::read_record(uint64_t position, std::string &header,
+                                std::string *data) const {
+  uint32_t len = 0;
+  read_file(&len, 4, position);
+  if (position + 8 + len > _file_size) {
+    throw std::runtime_error("bag " + _path + " is truncated");
+  }
+  header.resize(len);
+  read_file(&header[0], len, position + 4);
+  position += 4 + len;
+  read_file(&len, 4, position);
+  position += 4;
+  if (position + len > _file_size) {
+    throw std::runtime_error("bag " + _path + " is truncated");
+  }
+  if (data) {
+    data->resize(len);
+    read_file(&(*data)[0], len, position);
+  }
+  return position + len;
+}
+
+void BagReader::read_index() {
+  struct stat st;
+  if (fstat(_fd, &st) != 0) {
+    throw std::runtime_error("failed to stat bag " + _path + " " +
+                             strerror(errno));
+  }
+  _file_size = st.st_size;
+
+  char magic[bag_magic_size];
+  if (_file_size < bag_magic_size) {
+    throw std::runtime_error(_path + " is not a bag file");
+  }
+  read_file(magic, bag_magic_size, 0);
+  if (memcmp(magic, bag_magic, bag_magic_size) != 0) {
+    throw std::runtime_error(_path + " is not a version 2.0 bag file");
+  }
+
+  std::string header, data, value;
+  read_record(bag_magic_size, header, nullptr);
+  if (bag_field<uint8_t>(header, "op") != bag_op_bag_header) {
+    throw std::runtime_error("bag " + _path + " has no bag header");
+  }
+  uint64_t index_position = bag_field<uint64_t>(header, "index_pos");
+  if (index_position == 0) {
+    throw std::runtime_error("bag " + _path +
+                             " is not indexed, run rosbag reindex");
+  }
+
+  // connection records and chunk infos
+  std::vector<std::pair<uint64_t, uint32_t>> chunks;
+  for (uint64_t pos = index_position; pos < _file_size;) {
+    pos = read_record(pos, header, &data);
+    uint8_t op = bag_field<uint8_t>(header, "op");
+    if (op == bag_op_connection) {
+      uint32_t id = bag_field<uint32_t>(header, "conn");
+      if (id >= _connections.size()) {
+        _connections.resize(id + 1);
+      }
+      auto &c = _connections[id];
+      bag_field(data, "topic", c.topic);
+      bag_field(data, "type", c.type);
+      bag_field(data, "md5sum", c.md5sum);
+      bag_field(data, "message_definition", c.definition);
+    } else if (op == bag_op_chunk_info) {
+      chunks.emplace_back(bag_field<uint64_t>(header, "chunk_pos"),
+                          bag_field<uint32_t>(header, "count"));
+    }
+  }
+
+  // index records follow their chunk, one per connection in the chunk
+  for (auto &chunk : chunks) {
+    uint64_t pos = read_record(chunk.first, header, nullptr);
+    if (bag_field<uint8_t>(header, "op") != bag_op_chunk) {
+      throw std::runtime_error("bag " + _path + " has an invalid chunk index");
+    }
+    bag_field(header, "compression", value);
+    if (value != "none") {
+      throw std::runtime_error("bag " + _path + " has " + value +
+                               " compressed chunks, run rosbag decompress");
+    }
+    uint64_t data_position = chunk.first + 8 + header.size();
+    for (uint32_t i = 0; i < chunk.second; i++) {
+      pos = read_record(pos, header, &data);
+      if (bag_field<uint8_t>(header, "op") != bag_op_index) {
+        throw std::runtime_error("bag " + _path +
+                                 " has a chunk without index records");
+      }
+      uint32_t id = bag_field<uint32_t>(header, "conn");
+      uint32_t count = bag_field<uint32_t>(header, "count");
+      if (id >= _connections.size() || data.size() < count * size_t(12)) {
+        throw std::runtime_error("bag " + _path + " has an invalid index");
+      }
+      for (uint32_t k = 0; k < count; k++) {
+        BagMessageInfo m;
+        memcpy(&m.time, data.data() + k * 12, 8);
+        uint32_t offset = 0;
+        memcpy(&offset, data.data() + k * 12 + 8, 4);
+        m.connection = id;
+        m.position = data_position + offset;
+        _messages.push_back(m);
+      }
+    }
+  }
+  std::sort(_messages.begin(), _messages.end(),
+            [](const BagMessageInfo &a, const BagMessageInfo &b) {
+              return std::make_tuple(a.time.value(), a.position) <
+                     std::make_tuple(b.time.value(), b.position);
+            });
+}
+
+BagTime BagReader::start_time() const {
+  return _messages.empty() ? BagTime() : _messages.front().time;
+}
+
+BagTime BagReader::end_time() const {
+  return _messages.empty() ? BagTime() : _messages.back().time;
+}
+
+size_t BagReader::lower_bound(const BagTime &time) const {
+  return std::lower_bound(_messages.begin(), _messages.end(), time,
+                          [](const BagMessageInfo &m, const BagTime &t) {
+                            return m.time < t;
+                          }) -
+         _messages.begin();
+}
+
+void BagReader::read(const BagMessageInfo &message,
+                     std::vector<uint8_t> &data) const {
+  uint32_t header_size = 0;
+  read_file(&header_size, 4, message.position);
+  uint32_t data_size = 0;
+  uint64_t data_position = message.position + 4 + header_size + 4;
+  read_file(&data_size, 4, data_position - 4);
+  if (data_position + data_size > _file_size) {
+    throw std::runtime_error("bag " + _path + " is truncated");
+  }
+  data.resize(data_size);
+  read_file(data.data(), data_size, data_position);
+}
+
+}  // namespace mittenwire
\ No newline at end of file
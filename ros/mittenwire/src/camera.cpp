@@ -4,12 +4,355 @@
 
 #include <messages.hpp>
 #include <log.hpp>
+#include <simd.hpp>
 
 #include <chrono>
 #include <bitset>
 
 namespace mittenwire {
 
+static constexpr size_t camera_payload_size = 64;
+
+// Pixels are sent as enc[i] = (pixel[i] ^ 0xAA) + enc[i - 1] * 31, so every
+// byte decodes from two encoded bytes without a dependency on earlier
+// decoded output. Decodes one 64-byte payload, prev is the last encoded byte
+// of the preceding payload. src[-1] must be readable.
+#if defined(MTW_SIMD_AVX2)
+MTW_TARGET_AVX2 static void decode_camera_payload_avx2(const uint8_t *src,
+                                                       uint8_t *dst) {
+  const __m256i mask = _mm256_set1_epi8((char)0xe0);
+  const __m256i key = _mm256_set1_epi8((char)0xaa);
+  for (size_t i = 0; i < camera_payload_size; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i p = _mm256_loadu_si256((const __m256i *)(src + i - 1));
+    // p * 31 == (p << 5) - p per byte
+    __m256i p31 =
+        _mm256_sub_epi8(_mm256_and_si256(_mm256_slli_epi16(p, 5), mask), p);
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_xor_si256(_mm256_sub_epi8(v, p31), key));
+  }
+}
+#endif
+
+static void decode_camera_payload(const uint8_t *src, uint8_t prev,
+                                  uint8_t *dst) {
+  size_t i = 0;
+#if defined(MTW_SIMD_AVX2)
+  if (simd_avx2()) {
+    decode_camera_payload_avx2(src, dst);
+    i = camera_payload_size;
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i mask = _mm_set1_epi8((char)0xe0);
+    const __m128i key = _mm_set1_epi8((char)0xaa);
+    for (; i < camera_payload_size; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i p = _mm_loadu_si128((const __m128i *)(src + i - 1));
+      __m128i p31 =
+          _mm_sub_epi8(_mm_and_si128(_mm_slli_epi16(p, 5), mask), p);
+      _mm_storeu_si128((__m128i *)(dst + i),
+                       _mm_xor_si128(_mm_sub_epi8(v, p31), key));
+    }
+  }
+#endif
+  for (; i < camera_payload_size; i++) {
+    dst[i] = (uint8_t)(src[i] - src[i - 1] * 31) ^ 0xaa;
+  }
+  dst[0] = (uint8_t)(src[0] - prev * 31) ^ 0xaa;
+}
+
+// Powers of 41 for the payload checksum, c = c * 41 + byte starting at the
+// packet index, unrolled into index * 41^64 + sum(byte[i] * 41^(63 - i)).
+// Only the low 12 bits are transmitted, so 16-bit arithmetic is exact.
+struct CameraChecksumTable {
+  alignas(32) uint16_t weights[camera_payload_size];
+  uint16_t index_weight = 1;
+  CameraChecksumTable() {
+    uint16_t w = 1;
+    for (size_t i = camera_payload_size; i-- > 0;) {
+      weights[i] = w;
+      w *= 41;
+    }
+    index_weight = w;
+  }
+};
+
+#if defined(MTW_SIMD_AVX2)
+MTW_TARGET_AVX2 static uint16_t camera_payload_sum_avx2(
+    const uint8_t *src, const uint16_t *weights) {
+  __m256i acc = _mm256_setzero_si256();
+  for (size_t i = 0; i < camera_payload_size; i += 16) {
+    __m256i v =
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i)));
+    __m256i w = _mm256_load_si256((const __m256i *)(weights + i));
+    acc = _mm256_add_epi16(acc, _mm256_mullo_epi16(v, w));
+  }
+  __m128i s = _mm_add_epi16(_mm256_castsi256_si128(acc),
+                            _mm256_extracti128_si256(acc, 1));
+  s = _mm_add_epi16(s, _mm_srli_si128(s, 8));
+  s = _mm_add_epi16(s, _mm_srli_si128(s, 4));
+  s = _mm_add_epi16(s, _mm_srli_si128(s, 2));
+  return (uint16_t)_mm_cvtsi128_si32(s);
+}
+#endif
+
+static uint32_t camera_payload_checksum(const uint8_t *src,
+                                        uint32_t packet_index) {
+  static const CameraChecksumTable table;
+  uint16_t sum = 0;
+  size_t i = 0;
+#if defined(MTW_SIMD_AVX2)
+  if (simd_avx2()) {
+    sum = camera_payload_sum_avx2(src, table.weights);
+    i = camera_payload_size;
+  }
+#endif
+#if defined(__SSE2__)
+  if (i < camera_payload_size) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; i < camera_payload_size; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      __m128i w0 = _mm_load_si128((const __m128i *)(table.weights + i));
+      __m128i w1 = _mm_load_si128((const __m128i *)(table.weights + i + 8));
+      acc = _mm_add_epi16(
+          acc, _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), w0));
+      acc = _mm_add_epi16(
+          acc, _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), w1));
+    }
+    acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 8));
+    acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 4));
+    acc = _mm_add_epi16(acc, _mm_srli_si128(acc, 2));
+    sum = (uint16_t)_mm_cvtsi128_si32(acc);
+  }
+#endif
+  for (; i < camera_payload_size; i++) {
+    sum += src[i] * table.weights[i];
+  }
+  sum += (uint16_t)packet_index * table.index_weight;
+  return sum & 4095;
+}
+
+ImagePool::ImagePool(size_t depth) : _depth(depth) {}
+
+void ImagePool::recycle(ImageMessage *image) {
+  std::unique_ptr<ImageMessage> ptr(image);
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (_free.size() < _depth) {
+    _free.push_back(std::move(ptr));
+  }
+}
+
+std::shared_ptr<ImageMessage> ImagePool::acquire() {
+  std::unique_ptr<ImageMessage> image;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_free.empty()) {
+      image = std::move(_free.back());
+      _free.pop_back();
+    } else {
+      _allocations++;
+    }
+  }
+  if (!image) {
+    image.reset(new ImageMessage());
+  }
+  std::weak_ptr<ImagePool> weak = shared_from_this();
+  return std::shared_ptr<ImageMessage>(image.release(),
+                                       [weak](ImageMessage *image) {
+                                         if (auto pool = weak.lock()) {
+                                           pool->recycle(image);
+                                         } else {
+                                           delete image;
+                                         }
+                                       });
+}
+
+void ImagePool::set_depth(size_t depth) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _depth = depth;
+  if (_free.size() > depth) {
+    _free.resize(depth);
+  }
+}
+
+size_t ImagePool::depth() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _depth;
+}
+
+size_t ImagePool::idle() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _free.size();
+}
+
+uint64_t ImagePool::allocations() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _allocations;
+}
+
+Camera::Metrics &Camera::get_metrics(size_t channel) {
+  if (!metrics || metrics_channel != channel) {
+    auto &registry = MetricsRegistry::instance();
+    std::string prefix = "camera." + std::to_string(channel) + ".";
+    metrics.reset(new Metrics());
+    metrics->frames_completed = registry.counter(prefix + "frames_completed");
+    metrics->frames_invalid = registry.counter(prefix + "frames_invalid");
+    metrics->frames_incomplete = registry.counter(prefix + "frames_incomplete");
+    metrics->checksum_errors = registry.counter(prefix + "checksum_errors");
+    metrics->lost_packets = registry.counter(prefix + "lost_packets");
+    metrics->filled_packets = registry.counter(prefix + "filled_packets");
+    metrics->size_errors = registry.counter(prefix + "size_errors");
+    metrics->frame_allocations = registry.counter(prefix + "frame_allocations");
+    metrics->reassembly_latency_us =
+        registry.histogram(prefix + "reassembly_latency_us");
+    metrics->trigger_latency_us =
+        registry.histogram(prefix + "trigger_latency_us");
+    metrics_channel = channel;
+  }
+  return *metrics;
+}
+
+void Camera::emit_slices(bool frame_complete) {
+  auto &image = *frame;
+  size_t size = image.data.size();
+  size_t rows = std::min(received_prefix * camera_payload_size, size) /
+                std::max<size_t>(image.width, 1);
+  while (slice_row < image.height &&
+         (rows >= slice_row + slice_rows || frame_complete)) {
+    ImageSlice slice;
+    slice.frame = frame;
+    slice.frame_id = image.frame_id;
+    slice.row_begin = slice_row;
+    slice.row_end = std::min(slice_row + slice_rows, image.height);
+    slice.valid = rows >= slice.row_end;
+    slice_row = slice.row_end;
+    slice_callback(slice);
+  }
+}
+
+void Camera::fill_missing(ImageMessage &image) {
+  size_t count = payload_edges.size();
+  size_t received = 0;
+  for (uint64_t bits : received_packets) {
+    received += __builtin_popcountll(bits);
+  }
+  image.packets_expected = count;
+  image.packets_received = received;
+  image.row_valid.assign(image.height, 1);
+  if (received == count || image.width == 0) {
+    return;
+  }
+  // also catches loss at the start of the frame, which the sequence check
+  // does not see
+  image.valid = false;
+
+  // a lost payload also leaves the first byte of its successor undecodable
+  auto damaged = [&](size_t i) {
+    size_t slot = i / camera_payload_size;
+    return !packet_received(slot) ||
+           (i % camera_payload_size == 0 && slot > 0 &&
+            !packet_received(slot - 1));
+  };
+
+  const ImageMessage *previous = nullptr;
+  if (fill_policy == FillPolicy::PreviousFrame && previous_frame &&
+      previous_frame->width == image.width &&
+      previous_frame->height == image.height) {
+    previous = previous_frame.get();
+  }
+
+  size_t size = image.data.size();
+  size_t width = image.width;
+  uint8_t *pixels = image.data.data();
+  for (size_t slot = 0; slot < count; slot++) {
+    if (packet_received(slot)) {
+      continue;
+    }
+    size_t begin = slot * camera_payload_size;
+    size_t end = std::min(size, begin + camera_payload_size + 1);
+    for (size_t row = begin / width; row <= (end - 1) / width; row++) {
+      image.row_valid[row] = 0;
+    }
+    switch (fill_policy) {
+      case FillPolicy::Gray:
+        std::memset(pixels + begin, 0x80, end - begin);
+        break;
+      case FillPolicy::PreviousFrame:
+        if (previous) {
+          std::memcpy(pixels + begin, previous->data.data() + begin,
+                      end - begin);
+        } else {
+          std::memset(pixels + begin, 0x80, end - begin);
+        }
+        break;
+      case FillPolicy::Interpolate:
+        // two rows apart keeps the Bayer phase, the pixel above has already
+        // been filled if it was missing as well
+        for (size_t i = begin; i < end; i++) {
+          bool up = (i >= 2 * width);
+          bool down = (i + 2 * width < size && !damaged(i + 2 * width));
+          if (up && down) {
+            pixels[i] = (pixels[i - 2 * width] + pixels[i + 2 * width] + 1) / 2;
+          } else if (up) {
+            pixels[i] = pixels[i - 2 * width];
+          } else if (down) {
+            pixels[i] = pixels[i + 2 * width];
+          } else {
+            pixels[i] = 0x80;
+          }
+        }
+        break;
+    }
+  }
+}
+
+void Camera::complete_frame(Metrics &m) {
+  auto &image_buffer = *frame;
+  frame_started = false;
+
+  fill_missing(image_buffer);
+  m.filled_packets->add(image_buffer.packets_expected -
+                        image_buffer.packets_received);
+
+  m.reassembly_latency_us->record_us(std::chrono::steady_clock::now() -
+                                     receive_start_time);
+  image_buffer.trigger_host_timestamp = 0;
+  image_buffer.stamp = 0;
+  if (clock_sync) {
+    image_buffer.trigger_host_timestamp =
+        clock_sync->to_host(image_buffer.request_timestamp);
+    image_buffer.stamp = clock_sync->to_wall(image_buffer.request_timestamp);
+    if (image_buffer.trigger_host_timestamp &&
+        image_buffer.host_timestamp > image_buffer.trigger_host_timestamp) {
+      m.trigger_latency_us->record((image_buffer.host_timestamp -
+                                    image_buffer.trigger_host_timestamp) /
+                                   1000);
+    }
+  }
+  if (image_buffer.valid) {
+    m.frames_completed->add();
+  } else {
+    m.frames_invalid->add();
+  }
+
+  if (slice_rows && slice_callback) {
+    emit_slices(true);
+  }
+
+  if (fill_policy == FillPolicy::PreviousFrame) {
+    previous_frame = frame;
+  } else {
+    previous_frame.reset();
+  }
+
+  // hand over the frame, the next one comes from the pool
+  auto completed = std::move(frame);
+  callback(completed);
+}
+
 void Camera::process(const Packet &msg) {
   static constexpr size_t packet_size = 72;
   static constexpr size_t payload_size = 64;
@@ -21,12 +364,17 @@ void Camera::process(const Packet &msg) {
   auto *data64 = (const uint64_t *)msg.data.data();
   size_t len64 = msg.data.size() / 8;
 
+  auto &m = get_metrics(msg.channel);
+
   if (data32[0] == 0xBA2FA166) {
     if (frame_started) {
+      auto &image_buffer = *frame;
+
       if (msg.data.size() != packet_size) {
         MTW_LOG_ERROR("packet size error " << msg.data.size()
                                            << " != " << packet_size << " flags "
                                            << msg.flags);
+        m.size_errors->add();
         image_buffer.valid = false;
         return;
       }
@@ -35,11 +383,7 @@ void Camera::process(const Packet &msg) {
 
       size_t packet_index = (tail & (1024 * 1024 - 1));
 
-      uint32_t checksum_a = packet_index;
-      for (size_t i = 0; i < payload_size; i++) {
-        checksum_a = checksum_a * 41 + msg.data[i + 4];
-      }
-      checksum_a = (checksum_a & 4095);
+      uint32_t checksum_a = camera_payload_checksum(data8 + 4, packet_index);
 
       uint32_t checksum_b = (tail >> 20);
 
@@ -53,6 +397,7 @@ void Camera::process(const Packet &msg) {
       if (checksum_a != checksum_b) {
         MTW_LOG_ERROR("data checksum error " << checksum_a
                                              << " != " << checksum_b);
+        m.checksum_errors->add();
         image_buffer.valid = false;
 
         return;
@@ -61,24 +406,52 @@ void Camera::process(const Packet &msg) {
       if (image_buffer.data.empty()) {
         receive_start_time = std::chrono::steady_clock::now();
       }
+      image_buffer.host_timestamp = msg.host_timestamp;
 
       if (prev_offset >= 0 && offset != prev_offset + 1) {
         MTW_LOG_ERROR("lost " << offset - prev_offset - 1
                               << " image data packets from " << prev_offset
                               << " to " << offset);
+        if (offset > (size_t)prev_offset) {
+          m.lost_packets->add(offset - prev_offset - 1);
+        }
         image_buffer.valid = false;
       }
       prev_offset = offset;
+      size_t slot = offset;
       offset *= payload_size;
 
-      if (offset < image_buffer.data.size()) {
-        std::memset(image_buffer.data.data() + offset, 0x80,
-                    std::min(payload_size, image_buffer.data.size() - offset));
-
-        std::memcpy(image_buffer.data.data() + offset, msg.data.data() + 4,
-                    std::min(msg.data.size() - (packet_size - payload_size),
-                             image_buffer.data.size() - offset));
-
+      if (slot < payload_edges.size()) {
+        // decode straight into the frame, the first byte depends on the last
+        // encoded byte of the preceding payload
+        const uint8_t *src = data8 + 4;
+        uint8_t prev = 0;
+        if (slot > 0) {
+          prev = packet_received(slot - 1) ? payload_edges[slot - 1].last
+                                           : 0xff;
+        }
+        size_t n = std::min(payload_size, image_buffer.data.size() - offset);
+        if (n == payload_size) {
+          decode_camera_payload(src, prev, image_buffer.data.data() + offset);
+        } else {
+          uint8_t tail_pixels[payload_size];
+          decode_camera_payload(src, prev, tail_pixels);
+          std::memcpy(image_buffer.data.data() + offset, tail_pixels, n);
+        }
+        auto &edge = payload_edges[slot];
+        edge.first = src[0];
+        edge.last = src[payload_size - 1];
+        received_packets[slot / 64] |= uint64_t(1) << (slot % 64);
+        // the successor arrived first and was decoded against a guess
+        if (slot + 1 < payload_edges.size() && packet_received(slot + 1)) {
+          image_buffer.data[offset + payload_size] =
+              (uint8_t)(payload_edges[slot + 1].first - edge.last * 31) ^
+              0xaa;
+        }
+        while (received_prefix < payload_edges.size() &&
+               packet_received(received_prefix)) {
+          received_prefix++;
+        }
       } else {
         MTW_LOG_ERROR("image data offset out of range "
                       << offset << " " << data32[1] << " " << data32[1]);
@@ -87,19 +460,9 @@ void Camera::process(const Packet &msg) {
       size_t packet_count =
           1 + ((image_buffer.width * image_buffer.height + 63) / 64);
       if (packet_index + 1 == packet_count) {
-        frame_started = false;
-
-        {
-          uint8_t prev = 0;
-          for (size_t i = 0; i < image_buffer.data.size(); i++) {
-            uint8_t next = image_buffer.data[i] - prev * 31;
-            prev = image_buffer.data[i];
-            image_buffer.data[i] = next ^ (0b10101010);
-          }
-        }
-
-        callback(image_buffer);
-        image_buffer.data.clear();
+        complete_frame(m);
+      } else if (slice_rows && slice_callback) {
+        emit_slices(false);
       }
     }
     return;
@@ -121,8 +484,22 @@ void Camera::process(const Packet &msg) {
       }
     }
 
+    if (frame_started) {
+      // the last packet was lost, deliver what arrived
+      m.frames_incomplete->add();
+      frame->valid = false;
+      complete_frame(m);
+    }
+
     if (checksum_valid && info.width < 5000 && info.height < 5000 &&
         info.width >= 2 && info.height >= 2) {
+      if (!frame || frame.use_count() > 1) {
+        uint64_t allocations = pool->allocations();
+        frame = pool->acquire();
+        m.frame_allocations->add(pool->allocations() - allocations);
+      }
+      auto &image_buffer = *frame;
+      receive_start_time = std::chrono::steady_clock::now();
       uint32_t skip = info.skip + 1;
       image_buffer.skip = skip;
       image_buffer.left = info.left;
@@ -131,10 +508,22 @@ void Camera::process(const Packet &msg) {
       image_buffer.height = info.height / skip;
       image_buffer.channel = msg.channel;
       image_buffer.request_timestamp = info.timestamp;
+      image_buffer.frame_id = frame_counter++;
+      image_buffer.host_start_timestamp = msg.host_timestamp;
+      image_buffer.host_timestamp = msg.host_timestamp;
       image_buffer.valid = true;
 
-      image_buffer.data.clear();
-      image_buffer.data.resize(image_buffer.width * image_buffer.height, 0xff);
+      if (clock_sync && msg.host_timestamp) {
+        clock_sync->add_sample(info.timestamp, msg.host_timestamp);
+      }
+
+      // keeps the capacity of a recycled frame
+      image_buffer.data.assign(image_buffer.width * image_buffer.height, 0x80);
+      payload_edges.resize((image_buffer.data.size() + payload_size - 1) /
+                           payload_size);
+      received_packets.assign((payload_edges.size() + 63) / 64, 0);
+      received_prefix = 0;
+      slice_row = 0;
 
       static std::array<int16_t, 64> thermotable = {
           -58, -56, -54, -52, -45, -44, -43, -42, -41, -40, -39, -38, -37,
@@ -148,7 +537,7 @@ void Camera::process(const Packet &msg) {
       frame_started = true;
       prev_offset = -1;
     } else {
-      image_buffer.valid = false;
+      frame.reset();
       frame_started = false;
       prev_offset = -1;
     }
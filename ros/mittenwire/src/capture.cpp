@@ -0,0 +1,235 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <capture.hpp>
+
+#include <log.hpp>
+#include <utils.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+namespace mittenwire {
+namespace superspeed {
+
+static size_t align_record(size_t size) { return (size + 7) & ~size_t(7); }
+
+Capture::Capture(const std::string &prefix, size_t segment_size,
+                 size_t max_segments, size_t staging_size)
+    : _prefix(prefix),
+      _segment_size(segment_size),
+      _max_segments(max_segments) {
+  _staging.resize(align_record(staging_size), 0);
+  open_segment();
+  _thread = std::thread([this]() { run(); });
+}
+
+Capture::~Capture() {
+  MTW_LOG_INFO("stopping capture");
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _exit_flag = true;
+    _condition.notify_all();
+  }
+  _thread.join();
+  close_segment();
+  MTW_LOG_INFO("capture stopped after " << _transfers_captured
+                                        << " transfers, "
+                                        << _transfers_dropped << " dropped");
+}
+
+void Capture::append(const void *data, size_t size, uint64_t timestamp,
+                     uint64_t transfer_index) {
+  size_t capacity = _staging.size();
+  size_t len = align_record(sizeof(RecordHeader) + size);
+  if (_failed.load(std::memory_order_relaxed)) {
+    _transfers_dropped++;
+    return;
+  }
+  uint64_t w = _write_pos.load(std::memory_order_relaxed);
+  uint64_t r = _read_pos.load(std::memory_order_acquire);
+  size_t phys = w % capacity;
+  size_t tail = capacity - phys;
+  size_t need = (tail < len ? tail + len : len);
+  if (len > capacity || w + need - r > capacity || size > _segment_size) {
+    _transfers_dropped++;
+    return;
+  }
+  if (tail < len) {
+    if (tail >= sizeof(RecordHeader)) {
+      RecordHeader marker = {wrap_marker, 0, 0, 0};
+      memcpy(_staging.data() + phys, &marker, sizeof(marker));
+    }
+    w += tail;
+    phys = 0;
+  }
+  RecordHeader header = {uint32_t(size), 0, timestamp, transfer_index};
+  memcpy(_staging.data() + phys, &header, sizeof(header));
+  memcpy(_staging.data() + phys + sizeof(header), data, size);
+  _write_pos.store(w + len, std::memory_order_release);
+  _condition.notify_one();
+}
+
+void Capture::open_segment() {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%06llu",
+           (unsigned long long)_segment_count.load());
+  std::string name = _prefix + suffix;
+
+  _segment_fd = open((name + ".raw").c_str(),
+                     O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (_segment_fd < 0) {
+    throw std::runtime_error("failed to create capture segment " + name +
+                             " " + strerror(errno));
+  }
+  // a sparse file would raise SIGBUS on the first write into a full disk
+  // instead of failing here
+  int err = posix_fallocate(_segment_fd, 0, _segment_size);
+  if (err != 0) {
+    close(_segment_fd);
+    _segment_fd = -1;
+    unlink((name + ".raw").c_str());
+    throw std::runtime_error("failed to allocate capture segment " + name +
+                             " " + strerror(err));
+  }
+  void *map = mmap(nullptr, _segment_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, _segment_fd, 0);
+  if (map == MAP_FAILED) {
+    err = errno;
+    close(_segment_fd);
+    _segment_fd = -1;
+    throw std::runtime_error("failed to map capture segment " + name + " " +
+                             strerror(err));
+  }
+  _segment_map = (uint8_t *)map;
+  _segment_fill = 0;
+
+  _index_fd = open((name + ".idx").c_str(),
+                   O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (_index_fd < 0) {
+    err = errno;
+    close_segment();
+    throw std::runtime_error("failed to create capture index " + name + " " +
+                             strerror(err));
+  }
+
+  _segment_names.push_back(name);
+  _segment_count++;
+  MTW_LOG_INFO("capture segment " << name);
+
+  if (_max_segments > 0) {
+    while (_segment_names.size() > _max_segments) {
+      auto &oldest = _segment_names.front();
+      unlink((oldest + ".raw").c_str());
+      unlink((oldest + ".idx").c_str());
+      _segment_names.erase(_segment_names.begin());
+    }
+  }
+}
+
+void Capture::close_segment() {
+  if (_segment_map) {
+    msync(_segment_map, _segment_fill, MS_ASYNC);
+    munmap(_segment_map, _segment_size);
+    _segment_map = nullptr;
+  }
+  if (_segment_fd >= 0) {
+    if (ftruncate(_segment_fd, _segment_fill) != 0) {
+      MTW_LOG_ERROR("failed to truncate capture segment");
+    }
+    close(_segment_fd);
+    _segment_fd = -1;
+  }
+  if (_index_fd >= 0) {
+    close(_index_fd);
+    _index_fd = -1;
+  }
+}
+
+void Capture::write_record(const RecordHeader &header, const uint8_t *data) {
+  if (_segment_fill + header.size > _segment_size) {
+    close_segment();
+    open_segment();
+  }
+  memcpy(_segment_map + _segment_fill, data, header.size);
+  CaptureIndexEntry entry;
+  entry.timestamp = header.timestamp;
+  entry.transfer_index = header.transfer_index;
+  entry.offset = _segment_fill;
+  entry.size = header.size;
+  if (write(_index_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+    throw std::runtime_error(std::string("failed to write capture index ") +
+                             strerror(errno));
+  }
+  _segment_fill += header.size;
+  _transfers_captured++;
+  _bytes_captured += header.size;
+}
+
+void Capture::fail(const std::string &error) {
+  MTW_LOG_ERROR("capture stopped, " << error);
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _error = error;
+  }
+  _failed = true;
+  close_segment();
+}
+
+std::string Capture::error() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _error;
+}
+
+void Capture::run() {
+  set_current_thread_name("capture thread");
+  size_t capacity = _staging.size();
+  while (true) {
+    uint64_t r = _read_pos.load(std::memory_order_relaxed);
+    uint64_t w = _write_pos.load(std::memory_order_acquire);
+    if (r == w) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (_exit_flag && _write_pos.load(std::memory_order_acquire) == r) {
+        break;
+      }
+      _condition.wait_for(lock, std::chrono::milliseconds(10));
+      continue;
+    }
+    while (r < w) {
+      size_t phys = r % capacity;
+      size_t tail = capacity - phys;
+      if (tail < sizeof(RecordHeader)) {
+        r += tail;
+        continue;
+      }
+      RecordHeader header;
+      memcpy(&header, _staging.data() + phys, sizeof(header));
+      if (header.size == wrap_marker) {
+        r += tail;
+        continue;
+      }
+      if (_failed) {
+        _transfers_dropped++;
+      } else {
+        try {
+          write_record(header, _staging.data() + phys + sizeof(header));
+        } catch (std::exception &e) {
+          fail(e.what());
+          _transfers_dropped++;
+        }
+      }
+      r += align_record(sizeof(RecordHeader) + header.size);
+      _read_pos.store(r, std::memory_order_release);
+    }
+    _read_pos.store(r, std::memory_order_release);
+  }
+}
+
+}  // namespace superspeed
+}  // namespace mittenwire
@@ -0,0 +1,174 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <clocksync.hpp>
+
+#include <log.hpp>
+#include <utils.hpp>
+
+#include <math.h>
+
+#include <chrono>
+#include <cstdlib>
+
+namespace mittenwire {
+
+// A sample this far off the current estimate means the hub was restarted.
+static constexpr double clock_sync_reset_threshold_ns = 1e9;
+// conversions remembered, enough for all nodes of a few triggers
+static constexpr size_t clock_sync_recent_count = 64;
+// a system clock change this large is a step, smaller ones are jitter
+static constexpr int64_t clock_sync_wall_step_ns = 1000000;
+
+ClockSync::ClockSync(double bucket_seconds, size_t bucket_count)
+    : _bucket_seconds(bucket_seconds), _bucket_count(bucket_count) {}
+
+int64_t ClockSync::unwrap(uint32_t device_us) const {
+  return _last_unwrapped + (int32_t)(device_us - _last_device);
+}
+
+double ClockSync::predict_residual(int64_t unwrapped_us) const {
+  return _offset_ns + _drift * 1000.0 * (unwrapped_us - _reference_us);
+}
+
+void ClockSync::fit() {
+  if (_buckets.empty()) {
+    _valid = false;
+    return;
+  }
+  // the newest bucket is still filling up and its minimum is unreliable, so
+  // leave it out once there are enough complete buckets
+  size_t n = _buckets.size() >= 3 ? _buckets.size() - 1 : _buckets.size();
+  auto &last = _buckets[n - 1];
+  _reference_us = last.device_us;
+  if (n == 1) {
+    _offset_ns = last.residual_ns;
+    _drift = 0;
+    _valid = true;
+    return;
+  }
+  // least squares in coordinates relative to the newest point
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  double y0 = last.residual_ns;
+  for (size_t i = 0; i < n; i++) {
+    auto &b = _buckets[i];
+    double x = (b.device_us - _reference_us) * 1000.0;
+    double y = b.residual_ns - y0;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+  }
+  double d = n * sxx - sx * sx;
+  _drift = (d != 0) ? (n * sxy - sx * sy) / d : 0.0;
+  _offset_ns = y0 + (sy - _drift * sx) / n;
+  _valid = true;
+}
+
+void ClockSync::add_sample(uint32_t device_us, uint64_t host_ns) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  int64_t unwrapped = _has_samples ? unwrap(device_us) : 0;
+  int64_t residual = (int64_t)host_ns - unwrapped * 1000;
+  if (_valid && fabs(residual - predict_residual(unwrapped)) >
+                    clock_sync_reset_threshold_ns) {
+    MTW_LOG_INFO("clock sync reset, device clock jumped");
+    _buckets.clear();
+    _recent.clear();
+    _valid = false;
+    _reset_count++;
+    unwrapped = 0;
+    residual = (int64_t)host_ns;
+  }
+  _has_samples = true;
+  _last_device = device_us;
+  _last_unwrapped = unwrapped;
+  _sample_count++;
+
+  int64_t index = (int64_t)floor(unwrapped / (_bucket_seconds * 1e6));
+  if (_buckets.empty() || _buckets.back().index < index) {
+    Bucket b;
+    b.index = index;
+    b.device_us = unwrapped;
+    b.residual_ns = residual;
+    _buckets.push_back(b);
+    while (_buckets.size() > _bucket_count) {
+      _buckets.pop_front();
+    }
+    fit();
+  } else if (_buckets.back().index == index &&
+             residual < _buckets.back().residual_ns) {
+    _buckets.back().device_us = unwrapped;
+    _buckets.back().residual_ns = residual;
+    fit();
+  }
+}
+
+void ClockSync::reset() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _buckets.clear();
+  _recent.clear();
+  _has_samples = false;
+  _valid = false;
+  _reset_count++;
+}
+
+bool ClockSync::valid() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _valid;
+}
+
+uint64_t ClockSync::to_host(uint32_t device_us) const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (!_valid) {
+    return 0;
+  }
+  for (auto &r : _recent) {
+    if (r.first == device_us) {
+      return r.second;
+    }
+  }
+  int64_t unwrapped = unwrap(device_us);
+  double host = unwrapped * 1000.0 + predict_residual(unwrapped);
+  uint64_t ret = host > 0 ? (uint64_t)host : 0;
+  _recent.emplace_back(device_us, ret);
+  if (_recent.size() > clock_sync_recent_count) {
+    _recent.pop_front();
+  }
+  return ret;
+}
+
+double ClockSync::to_wall(uint32_t device_us) const {
+  uint64_t host = to_host(device_us);
+  if (!host) {
+    return 0;
+  }
+  int64_t wall_minus_host =
+      (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count() -
+      (int64_t)monotonic_time_ns();
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (!_has_wall_offset ||
+      std::abs(wall_minus_host - _wall_minus_host_ns) >
+          clock_sync_wall_step_ns) {
+    _wall_minus_host_ns = wall_minus_host;
+    _has_wall_offset = true;
+  }
+  return ((int64_t)host + _wall_minus_host_ns) * 1e-9;
+}
+
+double ClockSync::drift_ppm() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _drift * 1e6;
+}
+
+uint64_t ClockSync::sample_count() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _sample_count;
+}
+
+uint64_t ClockSync::reset_count() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _reset_count;
+}
+
+}  // namespace mittenwire
\ No newline at end of file
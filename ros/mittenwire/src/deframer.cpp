@@ -0,0 +1,157 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <deframer.hpp>
+
+#include <log.hpp>
+#include <simd.hpp>
+
+#include <string.h>
+
+namespace mittenwire {
+
+static constexpr uint32_t header_mask = 0xffff0000;
+static constexpr uint32_t header_magic = 0x23010000;
+
+#if defined(MTW_SIMD_AVX2)
+// Scans whole blocks of 8 words from i, returns true with i at the header if
+// there is one, else false with i after the last block.
+MTW_TARGET_AVX2 static bool find_segment_header_avx2(const uint32_t *words,
+                                                     size_t count, size_t &i) {
+  const __m256i mask = _mm256_set1_epi32(header_mask);
+  const __m256i magic = _mm256_set1_epi32(header_magic);
+  for (; i + 8 <= count; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(words + i));
+    __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(v, mask), magic);
+    int bits = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+    if (bits) {
+      i += __builtin_ctz(bits);
+      return true;
+    }
+  }
+  return false;
+}
+#endif
+
+size_t find_segment_header(const uint32_t *words, size_t count) {
+  size_t i = 0;
+#if defined(MTW_SIMD_AVX2)
+  if (simd_avx2() && find_segment_header_avx2(words, count, i)) {
+    return i;
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i mask = _mm_set1_epi32(header_mask);
+    const __m128i magic = _mm_set1_epi32(header_magic);
+    for (; i + 4 <= count; i += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(words + i));
+      __m128i eq = _mm_cmpeq_epi32(_mm_and_si128(v, mask), magic);
+      int bits = _mm_movemask_ps(_mm_castsi128_ps(eq));
+      if (bits) {
+        return i + __builtin_ctz(bits);
+      }
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    if ((words[i] & header_mask) == header_magic) {
+      return i;
+    }
+  }
+  return count;
+}
+
+Deframer::Deframer() {
+  _channels.resize(channel_count);
+  for (auto &channel : _channels) {
+    channel.data.reserve(4096);
+  }
+}
+
+void Deframer::reset() {
+  for (auto &channel : _channels) {
+    channel.data.clear();
+  }
+  _remaining = 0;
+  _in_payload = false;
+  _end = false;
+}
+
+void Deframer::finish_segment(std::vector<Packet> &packets) {
+  _in_payload = false;
+  auto &pbuf = _channels[_channel];
+  if (_end) {
+    packets.emplace_back();
+    Packet &msg = packets.back();
+    msg.channel = _channel;
+    msg.host_timestamp = _host_timestamp;
+    msg.data.assign(pbuf.data.begin(), pbuf.data.end());
+    if (pbuf.start_transfer != _transfer_index) {
+      msg.flags |= 64;
+      _split_packets++;
+    }
+    pbuf.data.clear();
+  }
+  if (pbuf.data.size() > max_packet_size) {
+    MTW_LOG_ERROR("pbuf overflow " << _channel);
+    pbuf.data.clear();
+    _overflows++;
+  }
+}
+
+void Deframer::process(const uint32_t *words, size_t count,
+                       std::vector<Packet> &packets, uint64_t host_timestamp) {
+  _transfer_index++;
+  _host_timestamp = host_timestamp;
+  size_t i = 0;
+  while (i < count) {
+    if (!_in_payload) {
+      uint32_t header = words[i];
+      if ((header & header_mask) != header_magic) {
+        size_t skip = find_segment_header(words + i, count - i);
+        MTW_LOG_INFO("resync " << header << " " << (header & header_mask)
+                               << " skipped " << skip);
+        _resync_words += skip;
+        i += skip;
+        continue;
+      }
+      i++;
+      size_t len64 = (header & 0xff);
+      _channel = ((header >> 8) & 15);
+      _end = ((header >> 12) & 1);
+      _remaining = len64 * 2;
+      _in_payload = true;
+      auto &pbuf = _channels[_channel];
+      if (pbuf.data.empty()) {
+        pbuf.start_transfer = _transfer_index;
+        if (_end && _remaining <= count - i) {
+          // common case, whole packet within a single segment
+          size_t bytecount = _remaining * 4;
+          packets.emplace_back();
+          Packet &msg = packets.back();
+          msg.channel = _channel;
+          msg.host_timestamp = _host_timestamp;
+          msg.data.assign((const uint8_t *)(words + i),
+                          (const uint8_t *)(words + i) + bytecount);
+          i += _remaining;
+          _remaining = 0;
+          _in_payload = false;
+          continue;
+        }
+      }
+    }
+    size_t n = std::min(_remaining, count - i);
+    if (n > 0) {
+      auto &data = _channels[_channel].data;
+      data.insert(data.end(), (const uint8_t *)(words + i),
+                  (const uint8_t *)(words + i + n));
+      i += n;
+      _remaining -= n;
+    }
+    if (_remaining == 0) {
+      finish_segment(packets);
+    }
+  }
+}
+
+}  // namespace mittenwire
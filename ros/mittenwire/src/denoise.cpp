@@ -0,0 +1,133 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <denoise.hpp>
+
+#include <parallel.hpp>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace mittenwire {
+
+static constexpr size_t denoise_band_rows = 16;
+
+namespace {
+
+struct DenoiseSpan {
+  int32_t sigma = 0;
+  float inverse_threshold = 0;
+  float strength = 0;
+  float spatial = 0;
+
+  // Values [begin, end) of a row whose left and right neighbors are left and
+  // right values away. Branch free and with the parameters in locals so that
+  // it vectorizes.
+  void run(const uint8_t *__restrict up, const uint8_t *__restrict in,
+           const uint8_t *__restrict down, uint16_t *__restrict history,
+           uint8_t *__restrict out, size_t begin, size_t end, size_t left,
+           size_t right) const {
+    const int32_t sigma = this->sigma;
+    const float inverse_threshold = this->inverse_threshold;
+    const float strength = this->strength;
+    const float spatial = this->spatial;
+    for (size_t i = begin; i < end; i++) {
+      int32_t center = in[i];
+      float sum = center;
+      float n = 1;
+      // integer comparison, a float one keeps the loop from vectorizing
+      auto add = [&](int32_t v) {
+        float similar = (abs(v - center) <= sigma);
+        sum += similar * v;
+        n += similar;
+      };
+      add(up[i - left]);
+      add(up[i]);
+      add(up[i + right]);
+      add(in[i - left]);
+      add(in[i + right]);
+      add(down[i - left]);
+      add(down[i]);
+      add(down[i + right]);
+      float value = center + spatial * (sum / n - center);
+      float previous = history[i] * (1.0f / 256);
+      float still = 1.0f - fabsf(value - previous) * inverse_threshold;
+      still = (still > 0.0f) ? still : 0.0f;
+      value += strength * still * (previous - value);
+      history[i] = (uint16_t)(int32_t)(value * 256 + 0.5f);
+      out[i] = (uint8_t)(int32_t)(value + 0.5f);
+    }
+  }
+};
+
+}  // namespace
+
+TemporalDenoiser::TemporalDenoiser(float strength, float threshold,
+                                   float spatial)
+    : _strength(std::min(std::max(strength, 0.0f), 0.99f)),
+      _threshold(std::max(threshold, 1.0f)),
+      _spatial(std::min(std::max(spatial, 0.0f), 1.0f)) {}
+
+void TemporalDenoiser::reset() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _history.clear();
+  _width = 0;
+  _height = 0;
+  _channels = 0;
+}
+
+void TemporalDenoiser::process(uint8_t *data, size_t width, size_t height,
+                               size_t channels, size_t stride,
+                               ThreadPool *pool) {
+  if (!width || !height || !channels) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(_mutex);
+  size_t row = width * channels;
+  bool restart = _history.empty() || width != _width || height != _height ||
+                 channels != _channels;
+  if (restart) {
+    _width = width;
+    _height = height;
+    _channels = channels;
+    _history.resize(row * height);
+  }
+  // the spatial filter reads neighbors that other bands overwrite
+  _input.resize(row * height);
+  for (size_t y = 0; y < height; y++) {
+    memcpy(_input.data() + y * row, data + y * stride, row);
+  }
+
+  DenoiseSpan span;
+  span.sigma = (int32_t)_threshold;
+  span.inverse_threshold = 1.0f / _threshold;
+  span.strength = restart ? 0.0f : _strength;
+  span.spatial = restart ? 1.0f : _spatial;
+
+  auto band = [&](size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+      const uint8_t *in = _input.data() + y * row;
+      const uint8_t *up = (y > 0) ? in - row : in;
+      const uint8_t *down = (y + 1 < height) ? in + row : in;
+      uint16_t *history = _history.data() + y * row;
+      uint8_t *out = data + y * stride;
+      if (width == 1) {
+        span.run(up, in, down, history, out, 0, row, 0, 0);
+        continue;
+      }
+      span.run(up, in, down, history, out, 0, channels, 0, channels);
+      span.run(up, in, down, history, out, channels, row - channels, channels,
+               channels);
+      span.run(up, in, down, history, out, row - channels, row, channels, 0);
+    }
+  };
+  if (pool) {
+    pool->parallel_for(0, height, denoise_band_rows, band);
+  } else {
+    band(0, height);
+  }
+}
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,109 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <diagnostics.hpp>
+
+#include <log.hpp>
+#include <utils.hpp>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include <map>
+
+namespace mittenwire {
+
+static diagnostic_msgs::KeyValue make_key_value(const std::string &key,
+                                                const std::string &value) {
+  diagnostic_msgs::KeyValue ret;
+  ret.key = key;
+  ret.value = value;
+  return ret;
+}
+
+DiagnosticsPublisher::DiagnosticsPublisher(ros::NodeHandle &node_handle,
+                                           const std::string &topic,
+                                           double interval) {
+  _publisher =
+      node_handle.advertise<diagnostic_msgs::DiagnosticArray>(topic, 10);
+  _previous_time = std::chrono::steady_clock::now();
+  _thread = std::thread([this, interval]() {
+    set_current_thread_name("diagnostics");
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+      _condition.wait_for(lock, std::chrono::duration<double>(interval));
+      if (_exit_flag) {
+        break;
+      }
+      publish();
+    }
+  });
+}
+
+DiagnosticsPublisher::~DiagnosticsPublisher() {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _exit_flag = true;
+    _condition.notify_all();
+  }
+  _thread.join();
+}
+
+void DiagnosticsPublisher::publish() {
+  auto samples = MetricsRegistry::instance().snapshot();
+  auto now = std::chrono::steady_clock::now();
+  double dt = std::chrono::duration<double>(now - _previous_time).count();
+  _previous_time = now;
+
+  std::map<std::string, diagnostic_msgs::DiagnosticStatus> status_map;
+  for (auto &sample : samples) {
+    size_t dot = sample.name.find('.');
+    std::string group = sample.name.substr(0, dot);
+    std::string key =
+        (dot == std::string::npos) ? sample.name : sample.name.substr(dot + 1);
+    auto &status = status_map[group];
+    if (status.name.empty()) {
+      status.name = "mittenwire/" + group;
+      status.hardware_id = "mittenwire";
+      status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    }
+    switch (sample.type) {
+      case MetricType::Counter: {
+        status.values.push_back(
+            make_key_value(key, std::to_string(sample.value)));
+        auto it = _previous.find(sample.name);
+        if (it != _previous.end() && dt > 0) {
+          status.values.push_back(make_key_value(
+              key + "/s", std::to_string((sample.value - it->second) / dt)));
+        }
+        _previous[sample.name] = sample.value;
+        break;
+      }
+      case MetricType::Gauge:
+        status.values.push_back(
+            make_key_value(key, std::to_string(sample.value)));
+        break;
+      case MetricType::Histogram: {
+        auto &h = sample.histogram;
+        status.values.push_back(
+            make_key_value(key + ".count", std::to_string(h.count)));
+        status.values.push_back(
+            make_key_value(key + ".mean", std::to_string(h.mean())));
+        status.values.push_back(
+            make_key_value(key + ".p50", std::to_string(h.quantile(0.5))));
+        status.values.push_back(
+            make_key_value(key + ".p99", std::to_string(h.quantile(0.99))));
+        status.values.push_back(
+            make_key_value(key + ".max", std::to_string(h.max)));
+        break;
+      }
+    }
+  }
+
+  diagnostic_msgs::DiagnosticArray message;
+  message.header.stamp = ros::Time::now();
+  for (auto &p : status_map) {
+    message.status.push_back(p.second);
+  }
+  _publisher.publish(message);
+}
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,53 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <dispatcher.hpp>
+
+#include <log.hpp>
+#include <utils.hpp>
+
+#include <string>
+
+namespace mittenwire {
+
+Dispatcher::Dispatcher(size_t thread_count, size_t queue_capacity,
+                       const Callback &callback)
+    : _callback(callback) {
+  for (size_t i = 0; i < thread_count; i++) {
+    _workers.emplace_back(new Worker(queue_capacity));
+    _workers.back()->queue.set_policy(BackpressurePolicy::Block);
+  }
+  for (size_t i = 0; i < thread_count; i++) {
+    auto *worker = _workers[i].get();
+    worker->thread = std::thread([this, worker, i]() {
+      std::string name = "dispatch " + std::to_string(i);
+      set_current_thread_name(name.c_str());
+      std::vector<Packet> batch;
+      Packet packet;
+      while (worker->queue.pop(packet)) {
+        batch.push_back(std::move(packet));
+        while (batch.size() < 256 && worker->queue.try_pop(packet)) {
+          batch.push_back(std::move(packet));
+        }
+        _callback(batch.data(), batch.size());
+        batch.clear();
+      }
+    });
+  }
+}
+
+Dispatcher::~Dispatcher() {
+  MTW_LOG_INFO("stopping dispatch workers");
+  for (auto &worker : _workers) {
+    worker->queue.close();
+  }
+  for (auto &worker : _workers) {
+    worker->thread.join();
+  }
+  MTW_LOG_INFO("dispatch workers stopped");
+}
+
+void Dispatcher::dispatch(Packet &&packet) {
+  _workers[packet.channel % _workers.size()]->queue.push(std::move(packet));
+}
+
+}  // namespace mittenwire
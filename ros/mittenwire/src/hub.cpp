@@ -4,21 +4,30 @@
 
 #include <log.hpp>
 
+#include <algorithm>
+#include <stdexcept>
+
 namespace mittenwire {
 
 Hub::Hub(const std::shared_ptr<Master>& master) {
   _master = master;
   auto impl = _impl;
-  _master->add_packet_listener(impl, [impl](const Packet& packet) {
-    std::vector<std::shared_ptr<Node>> nodes;
-    {
-      std::unique_lock<std::mutex> lock(impl->mutex);
-      if (packet.channel < impl->node_map.size()) {
-        nodes = impl->node_map[packet.channel];
+  _master->add_channel_listener(impl, [impl](const PacketSpan& packets) {
+    auto table = std::atomic_load(&impl->table);
+    size_t i = 0;
+    while (i < packets.size()) {
+      size_t channel = packets[i].channel;
+      size_t n = 1;
+      while (i + n < packets.size() && packets[i + n].channel == channel) {
+        n++;
       }
-    }
-    for (auto& n : nodes) {
-      n->process(packet);
+      if (channel < table->size()) {
+        PacketSpan run(&packets[i], n);
+        for (auto& node : (*table)[channel]) {
+          node->process_batch(run);
+        }
+      }
+      i += n;
     }
   });
 }
@@ -30,19 +39,26 @@ Hub::~Hub() {
 }
 
 void Hub::connect(size_t channel, const std::shared_ptr<Node>& node) {
-  std::unique_lock<std::mutex> lock(_impl->mutex);
-  if (_impl->node_map.size() <= channel) {
-    _impl->node_map.resize(channel + 1);
+  if (channel >= Deframer::channel_count) {
+    throw std::runtime_error("channel out of range");
   }
-  _impl->node_map[channel].push_back(node);
+  std::unique_lock<std::mutex> lock(_impl->mutex);
+  auto table = std::make_shared<RoutingTable>(*_impl->table);
+  (*table)[channel].push_back(node);
+  std::atomic_store(&_impl->table,
+                    std::shared_ptr<const RoutingTable>(std::move(table)));
 }
 
 void Hub::disconnect(size_t channel, const std::shared_ptr<Node>& node) {
-  std::unique_lock<std::mutex> lock(_impl->mutex);
-  if (channel < _impl->node_map.size()) {
-    auto& v = _impl->node_map[channel];
-    v.erase(std::remove(v.begin(), v.end(), node), v.end());
+  if (channel >= Deframer::channel_count) {
+    return;
   }
+  std::unique_lock<std::mutex> lock(_impl->mutex);
+  auto table = std::make_shared<RoutingTable>(*_impl->table);
+  auto& v = (*table)[channel];
+  v.erase(std::remove(v.begin(), v.end(), node), v.end());
+  std::atomic_store(&_impl->table,
+                    std::shared_ptr<const RoutingTable>(std::move(table)));
 }
 
 }  // namespace mittenwire
\ No newline at end of file
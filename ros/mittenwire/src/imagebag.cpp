@@ -0,0 +1,333 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <imagebag.hpp>
+
+#include <log.hpp>
+
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+namespace mittenwire {
+
+static const char compressed_image_suffix[] = "/image_raw/compressed";
+static const char raw_image_suffix[] = "/image_raw";
+static const char camera_info_suffix[] = "/camera_info";
+
+// camera name if topic ends with suffix
+static bool topic_prefix(const std::string &topic, const char *suffix,
+                         std::string &name) {
+  size_t n = strlen(suffix);
+  if (topic.size() <= n || topic.compare(topic.size() - n, n, suffix) != 0) {
+    return false;
+  }
+  name = topic.substr(0, topic.size() - n);
+  return true;
+}
+
+// Reads fields of a serialized ROS message in order.
+class MessageCursor {
+  const uint8_t *_data = nullptr;
+  size_t _size = 0;
+  size_t _pos = 0;
+
+ public:
+  MessageCursor(const std::vector<uint8_t> &data)
+      : _data(data.data()), _size(data.size()) {}
+  const uint8_t *skip(size_t size) {
+    if (size > _size - _pos) {
+      throw std::runtime_error("truncated image message");
+    }
+    const uint8_t *ret = _data + _pos;
+    _pos += size;
+    return ret;
+  }
+  template <class T>
+  T get() {
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    T ret;
+    memcpy(&ret, skip(sizeof(T)), sizeof(T));
+    return ret;
+  }
+  std::string string() {
+    uint32_t size = get<uint32_t>();
+    return std::string((const char *)skip(size), size);
+  }
+  // std_msgs/Header, returns the stamp
+  BagTime header() {
+    get<uint32_t>();
+    BagTime stamp = get<BagTime>();
+    string();
+    return stamp;
+  }
+};
+
+static void decode_compressed(MessageCursor &cursor, BagImage &image) {
+  image.stamp = cursor.header();
+  cursor.string();
+  uint32_t size = cursor.get<uint32_t>();
+  const uint8_t *data = cursor.skip(size);
+  cv::Mat mat = cv::imdecode(cv::Mat(1, size, CV_8U, (void *)data),
+                             cv::IMREAD_COLOR);
+  if (mat.empty()) {
+    throw std::runtime_error("failed to decode image " + image.name);
+  }
+  image.width = mat.cols;
+  image.height = mat.rows;
+  image.pixels.resize(image.width * image.height * 3);
+  for (size_t y = 0; y < image.height; y++) {
+    memcpy(image.pixels.data() + y * image.width * 3, mat.ptr(y),
+           image.width * 3);
+  }
+}
+
+static void decode_raw(MessageCursor &cursor, BagImage &image,
+                       const IspParams &params) {
+  image.stamp = cursor.header();
+  size_t height = cursor.get<uint32_t>();
+  size_t width = cursor.get<uint32_t>();
+  std::string encoding = cursor.string();
+  cursor.get<uint8_t>();
+  size_t step = cursor.get<uint32_t>();
+  uint32_t size = cursor.get<uint32_t>();
+  const uint8_t *data = cursor.skip(size);
+  size_t channels = (encoding == "bgr8" || encoding == "rgb8") ? 3 : 1;
+  if (step < width * channels || size < step * height) {
+    throw std::runtime_error("invalid image " + image.name);
+  }
+  image.width = width;
+  image.height = height;
+  image.pixels.resize(width * height * 3);
+  uint8_t *out = image.pixels.data();
+  if (encoding == "bayer_grbg8") {
+    if (width < 2 || height < 2) {
+      throw std::runtime_error("invalid image " + image.name);
+    }
+    // already running on a pool thread
+    isp_process(data, step, width, height, out, width * 3, params, nullptr);
+  } else if (encoding == "bgr8") {
+    for (size_t y = 0; y < height; y++) {
+      memcpy(out + y * width * 3, data + y * step, width * 3);
+    }
+  } else if (encoding == "rgb8") {
+    for (size_t y = 0; y < height; y++) {
+      const uint8_t *row = data + y * step;
+      for (size_t x = 0; x < width; x++) {
+        out[(y * width + x) * 3 + 0] = row[x * 3 + 2];
+        out[(y * width + x) * 3 + 1] = row[x * 3 + 1];
+        out[(y * width + x) * 3 + 2] = row[x * 3 + 0];
+      }
+    }
+  } else if (encoding == "mono8") {
+    for (size_t y = 0; y < height; y++) {
+      const uint8_t *row = data + y * step;
+      for (size_t x = 0; x < width; x++) {
+        memset(out + (y * width + x) * 3, row[x], 3);
+      }
+    }
+  } else {
+    throw std::runtime_error("unsupported image encoding " + encoding);
+  }
+}
+
+static void decode_image(BagImage &image, bool decode,
+                         const IspParams &params) {
+  MessageCursor cursor(image.image_data);
+  if (!decode) {
+    image.stamp = cursor.header();
+  } else if (image.image_type == "sensor_msgs/CompressedImage") {
+    decode_compressed(cursor, image);
+  } else {
+    decode_raw(cursor, image, params);
+  }
+}
+
+ImageBagReader::ImageBagReader(const std::string &path, size_t prefetch,
+                               size_t thread_count, bool decode)
+    : _bag(std::make_shared<BagReader>(path)),
+      _prefetch(std::max<size_t>(1, prefetch)),
+      _decode(decode),
+      _pool(new ThreadPool(thread_count)) {
+  build_index();
+  MTW_LOG_INFO("image bag " << path << " " << _sets.size() << " image sets "
+                            << _bag->messages().size() << " messages");
+}
+
+void ImageBagReader::build_index() {
+  auto &connections = _bag->connections();
+  auto &messages = _bag->messages();
+
+  // camera name and whether it is an image or a camera info, per connection
+  enum Kind { Other, Image, Info };
+  std::vector<Kind> kinds(connections.size(), Other);
+  std::vector<std::string> names(connections.size());
+  for (size_t i = 0; i < connections.size(); i++) {
+    auto &topic = connections[i].topic;
+    if (topic_prefix(topic, compressed_image_suffix, names[i]) ||
+        topic_prefix(topic, raw_image_suffix, names[i])) {
+      kinds[i] = Image;
+    } else if (topic_prefix(topic, camera_info_suffix, names[i])) {
+      kinds[i] = Info;
+    }
+  }
+
+  // messages are sorted by time, pair images and infos within each run of
+  // equal times
+  std::map<std::string, size_t> images, infos;
+  for (size_t begin = 0; begin < messages.size();) {
+    BagTime t = messages[begin].time;
+    size_t end = begin;
+    images.clear();
+    infos.clear();
+    for (; end < messages.size() && messages[end].time.value() == t.value();
+         end++) {
+      uint32_t c = messages[end].connection;
+      if (kinds[c] == Image) {
+        images[names[c]] = end;
+      } else if (kinds[c] == Info) {
+        infos[names[c]] = end;
+      } else {
+        _topics[connections[c].topic].push_back(end);
+      }
+    }
+    SetIndex set;
+    set.time = t;
+    for (auto &image : images) {
+      auto info = infos.find(image.first);
+      if (info != infos.end()) {
+        ImageIndex i;
+        i.name = image.first;
+        i.image = image.second;
+        i.info = info->second;
+        set.images.push_back(std::move(i));
+      }
+    }
+    if (!set.images.empty()) {
+      _sets.push_back(std::move(set));
+    }
+    begin = end;
+  }
+}
+
+void ImageBagReader::schedule() {
+  while (_pending.size() < _prefetch && _scheduled < _sets.size()) {
+    auto &index = _sets[_scheduled];
+    auto pending = std::make_shared<Pending>();
+    pending->index = _scheduled;
+    pending->set = std::make_shared<BagImageSet>();
+    pending->set->time = index.time;
+    pending->remaining = index.images.size();
+    for (auto &i : index.images) {
+      auto image = std::make_shared<BagImage>();
+      image->name = i.name;
+      image->time = index.time;
+      pending->set->images.push_back(image);
+      // tasks only hold shared state, the reader may move on or go away
+      auto bag = _bag;
+      auto image_message = _bag->messages()[i.image];
+      auto info_message = _bag->messages()[i.info];
+      bool decode = _decode;
+      IspParams params = _isp_params;
+      auto generation = _generation;
+      uint64_t task_generation = *generation;
+      _pool->post([bag, pending, image, image_message, info_message, decode,
+                   params, generation, task_generation]() {
+        std::exception_ptr error;
+        // skipped if the reader jumped and nobody waits for this set anymore
+        if (*generation == task_generation) {
+          try {
+            auto &connection = bag->connections()[image_message.connection];
+            image->image_type = connection.type;
+            bag->read(image_message, image->image_data);
+            bag->read(info_message, image->info_data);
+            decode_image(*image, decode, params);
+          } catch (...) {
+            error = std::current_exception();
+          }
+        }
+        std::unique_lock<std::mutex> lock(pending->mutex);
+        if (error && !pending->error) {
+          pending->error = error;
+        }
+        pending->remaining--;
+        pending->condition.notify_all();
+      });
+    }
+    _pending.push_back(pending);
+    _scheduled += _stride;
+  }
+}
+
+size_t ImageBagReader::position() const {
+  return _pending.empty() ? std::min(_scheduled, _sets.size())
+                          : _pending.front()->index;
+}
+
+void ImageBagReader::set_position(size_t index) {
+  ++*_generation;
+  _pending.clear();
+  _scheduled = index;
+}
+
+void ImageBagReader::seek(const BagTime &time) {
+  set_position(std::lower_bound(_sets.begin(), _sets.end(), time,
+                                [](const SetIndex &set, const BagTime &t) {
+                                  return set.time < t;
+                                }) -
+               _sets.begin());
+}
+
+void ImageBagReader::set_stride(size_t stride) {
+  if (stride == 0) {
+    throw std::runtime_error("stride must be at least 1");
+  }
+  size_t index = position();
+  _stride = stride;
+  set_position(index);
+}
+
+std::shared_ptr<BagImageSet> ImageBagReader::next() {
+  schedule();
+  if (_pending.empty()) {
+    return nullptr;
+  }
+  auto pending = _pending.front();
+  _pending.pop_front();
+  schedule();
+  std::unique_lock<std::mutex> lock(pending->mutex);
+  while (pending->remaining > 0) {
+    pending->condition.wait(lock);
+  }
+  if (pending->error) {
+    std::rethrow_exception(pending->error);
+  }
+  return pending->set;
+}
+
+std::vector<std::pair<BagTime, std::vector<uint8_t>>>
+ImageBagReader::messages(const std::string &topic, const BagTime &begin,
+                         const BagTime &end) const {
+  std::vector<std::pair<BagTime, std::vector<uint8_t>>> ret;
+  auto it = _topics.find(topic);
+  if (it == _topics.end()) {
+    return ret;
+  }
+  auto &messages = _bag->messages();
+  auto &indices = it->second;
+  auto i = std::lower_bound(indices.begin(), indices.end(), begin,
+                            [&](size_t index, const BagTime &t) {
+                              return messages[index].time < t;
+                            });
+  for (; i != indices.end() && messages[*i].time < end; i++) {
+    ret.emplace_back(messages[*i].time, std::vector<uint8_t>());
+    _bag->read(messages[*i], ret.back().second);
+  }
+  return ret;
+}
+
+}  // namespace mittenwire
\ No newline at end of file
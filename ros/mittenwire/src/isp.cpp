@@ -0,0 +1,166 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <isp.hpp>
+
+#include <parallel.hpp>
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace mittenwire {
+
+static constexpr size_t isp_band_rows = 16;
+
+IspTables::IspTables(const IspParams &params) {
+  // hue rotation about the gray axis and saturation towards luma
+  static const float luma[3] = {0.299f, 0.587f, 0.114f};
+  float c = cosf(params.hue * (float)M_PI / 180.0f);
+  float s = sinf(params.hue * (float)M_PI / 180.0f);
+  float hue[9] = {
+      0.299f + 0.701f * c + 0.168f * s, 0.587f - 0.587f * c + 0.330f * s,
+      0.114f - 0.114f * c - 0.497f * s, 0.299f - 0.299f * c - 0.328f * s,
+      0.587f + 0.413f * c + 0.035f * s, 0.114f - 0.114f * c + 0.292f * s,
+      0.299f - 0.300f * c + 1.250f * s, 0.587f - 0.588f * c - 1.050f * s,
+      0.114f + 0.886f * c - 0.203f * s,
+  };
+  float gains[3] = {params.gain_red, params.gain_green, params.gain_blue};
+  float black_level = std::min(std::max(params.black_level, 0.0f), 0.99f);
+  float scale = params.brightness / (1.0f - black_level) / 255.0f * lut_steps;
+  for (size_t i = 0; i < 3; i++) {
+    for (size_t j = 0; j < 3; j++) {
+      float sum = 0;
+      for (size_t k = 0; k < 3; k++) {
+        float sat = (1.0f - params.saturation) * luma[k] +
+                    (i == k ? params.saturation : 0.0f);
+        sum += sat * hue[k * 3 + j];
+      }
+      matrix[i * 3 + j] = sum * gains[j] * scale;
+    }
+  }
+  black = black_level * 255.0f;
+
+  // extended Reinhard curve that maps the brightened white point to 1
+  float white = std::max(1.0f, params.brightness);
+  for (int i = 0; i < lut_size; i++) {
+    float y = i * (1.0f / lut_steps);
+    if (params.tone_mapping) {
+      y = y * (1.0f + y / (white * white)) / (1.0f + y);
+    }
+    y = std::min(y, 1.0f);
+    if (params.srgb) {
+      y = (y <= 0.0031308f) ? y * 12.92f
+                            : 1.055f * powf(y, 1.0f / 2.4f) - 0.055f;
+    }
+    int v = (int)lrintf(y * 255.0f);
+    v = std::min(std::max(v, 0), 255);
+    lut[i] = params.invert ? 255 - v : v;
+  }
+}
+
+namespace {
+
+void isp_band(const uint8_t *bayer, size_t bayer_stride, size_t width,
+              size_t height, uint8_t *rgb, size_t rgb_stride,
+              const IspTables &tables, size_t y0, size_t y1) {
+  // rows y0 - 1 to y1 with one pixel of padding on either side, mirrored at
+  // the image borders so the Bayer phase is preserved, and a spare byte for
+  // odd widths
+  thread_local std::vector<uint8_t> padded;
+  size_t pw = width + 3;
+  padded.resize(pw * (y1 - y0 + 2));
+  for (size_t i = 0; i < y1 - y0 + 2; i++) {
+    ptrdiff_t y = (ptrdiff_t)(y0 + i) - 1;
+    if (y < 0) {
+      y = 1;
+    } else if (y >= (ptrdiff_t)height) {
+      y = height - 2;
+    }
+    uint8_t *row = padded.data() + i * pw;
+    memcpy(row + 1, bayer + y * bayer_stride, width);
+    row[0] = row[2];
+    row[width + 1] = row[width - 1];
+    row[width + 2] = row[width];
+  }
+
+  // color math is branch free over pixel pairs so it vectorizes, the table
+  // lookups run as a second pass over the row
+  thread_local std::vector<int32_t> indices;
+  indices.resize(width * 3 + 6);
+  const float *m = tables.matrix;
+  const float black = tables.black;
+  const float limit = IspTables::lut_size - 1;
+  auto index = [&](float r, float g, float b, int32_t *dst) {
+    r -= black;
+    g -= black;
+    b -= black;
+    // BGR order
+    dst[0] = (int32_t)std::min(std::max(m[6] * r + m[7] * g + m[8] * b, 0.0f),
+                               limit);
+    dst[1] = (int32_t)std::min(std::max(m[3] * r + m[4] * g + m[5] * b, 0.0f),
+                               limit);
+    dst[2] = (int32_t)std::min(std::max(m[0] * r + m[1] * g + m[2] * b, 0.0f),
+                               limit);
+  };
+  for (size_t y = y0; y < y1; y++) {
+    const uint8_t *up = padded.data() + (y - y0) * pw + 1;
+    const uint8_t *center = up + pw;
+    const uint8_t *down = center + pw;
+    int32_t *ix = indices.data();
+    // rows alternate between G R G R and B G B G, an odd width is handled by
+    // the padding and by writing one pixel too many into the index row
+    if ((y & 1) == 0) {
+      for (size_t x = 0; x < width; x += 2) {
+        float g0 = center[x];
+        float r0 = (center[x - 1] + center[x + 1]) * 0.5f;
+        float b0 = (up[x] + down[x]) * 0.5f;
+        index(r0, g0, b0, ix + x * 3);
+        float r1 = center[x + 1];
+        float g1 = (center[x] + center[x + 2] + up[x + 1] + down[x + 1]) * 0.25f;
+        float b1 = (up[x] + up[x + 2] + down[x] + down[x + 2]) * 0.25f;
+        index(r1, g1, b1, ix + x * 3 + 3);
+      }
+    } else {
+      for (size_t x = 0; x < width; x += 2) {
+        float b0 = center[x];
+        float g0 = (center[x - 1] + center[x + 1] + up[x] + down[x]) * 0.25f;
+        float r0 = (up[x - 1] + up[x + 1] + down[x - 1] + down[x + 1]) * 0.25f;
+        index(r0, g0, b0, ix + x * 3);
+        float g1 = center[x + 1];
+        float b1 = (center[x] + center[x + 2]) * 0.5f;
+        float r1 = (up[x + 1] + down[x + 1]) * 0.5f;
+        index(r1, g1, b1, ix + x * 3 + 3);
+      }
+    }
+    uint8_t *out = rgb + y * rgb_stride;
+    const uint8_t *lut = tables.lut;
+    for (size_t i = 0; i < width * 3; i++) {
+      out[i] = lut[ix[i]];
+    }
+  }
+}
+
+}  // namespace
+
+void isp_process(const uint8_t *bayer, size_t bayer_stride, size_t width,
+                 size_t height, uint8_t *rgb, size_t rgb_stride,
+                 const IspParams &params, ThreadPool *pool) {
+  if (width < 2 || height < 2) {
+    throw std::runtime_error("bayer image too small");
+  }
+  IspTables tables(params);
+  auto band = [&](size_t y0, size_t y1) {
+    isp_band(bayer, bayer_stride, width, height, rgb, rgb_stride, tables, y0,
+             y1);
+  };
+  if (pool) {
+    pool->parallel_for(0, height, isp_band_rows, band);
+  } else {
+    band(0, height);
+  }
+}
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,269 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <log.hpp>
+
+#include <utils.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace mittenwire {
+
+std::atomic<int> Logger::g_level{MTW_LOG_LEVEL};
+
+namespace {
+
+int64_t log_clock() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static constexpr int64_t log_window = 1000000000;
+
+struct LogEntry {
+  LogSite *site = nullptr;
+  uint32_t suppressed = 0;
+  std::string text;
+};
+
+// Bounded multi-producer queue with per-cell sequence numbers, drained by the
+// single logger thread.
+class LogQueue {
+  struct alignas(64) Cell {
+    std::atomic<size_t> sequence{0};
+    LogEntry entry;
+  };
+  static constexpr size_t capacity = 4096;
+  std::unique_ptr<Cell[]> _cells{new Cell[capacity]};
+  alignas(64) std::atomic<size_t> _head{0};
+  alignas(64) std::atomic<size_t> _tail{0};
+
+ public:
+  LogQueue() {
+    for (size_t i = 0; i < capacity; i++) {
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  bool push(LogEntry &&entry) {
+    size_t pos = _tail.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = _cells[pos % capacity];
+      size_t seq = cell.sequence.load(std::memory_order_acquire);
+      if (seq == pos) {
+        if (_tail.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          cell.entry = std::move(entry);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (seq < pos) {
+        return false;
+      } else {
+        pos = _tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  bool pop(LogEntry &entry) {
+    size_t pos = _head.load(std::memory_order_relaxed);
+    Cell &cell = _cells[pos % capacity];
+    if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+      return false;
+    }
+    entry = std::move(cell.entry);
+    cell.sequence.store(pos + capacity, std::memory_order_release);
+    _head.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+};
+
+struct LoggerState {
+  LogQueue queue;
+  std::atomic<LogSite *> sites{nullptr};
+  std::atomic<uint32_t> rate_limit{20};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> pushed{0};
+  std::atomic<uint64_t> written{0};
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::thread thread;
+
+  // only accessed from the logger thread
+  std::unordered_map<LogSite *, std::string> last_text;
+  uint64_t reported_drops = 0;
+  std::string output;
+
+  LoggerState() {
+    thread = std::thread([this]() {
+      set_current_thread_name("logger");
+      run();
+    });
+    thread.detach();
+    std::atexit([]() { Logger::flush(); });
+  }
+
+  static const char *prefix(LogLevel level) {
+    switch (level) {
+      case LogLevel::Debug:
+        return "D ";
+      case LogLevel::Info:
+        return "I ";
+      default:
+        return "E ";
+    }
+  }
+
+  void format(LogEntry &entry) {
+    output += prefix(entry.site->level);
+    if (entry.suppressed) {
+      auto it = last_text.find(entry.site);
+      if (it != last_text.end()) {
+        output += it->second;
+      } else {
+        output += entry.site->file;
+        output += ":";
+        output += std::to_string(entry.site->line);
+      }
+      output += " x ";
+      output += std::to_string(entry.suppressed);
+      output += " in last 1s";
+    } else {
+      output += entry.text;
+      last_text[entry.site] = std::move(entry.text);
+    }
+    output += "\n";
+  }
+
+  void run() {
+    LogEntry entry;
+    auto last_roll = std::chrono::steady_clock::now();
+    while (true) {
+      size_t n = 0;
+      while (queue.pop(entry)) {
+        format(entry);
+        n++;
+      }
+      uint64_t d = dropped.load(std::memory_order_relaxed);
+      if (d != reported_drops) {
+        output += "E log queue full, dropped " +
+                  std::to_string(d - reported_drops) + " messages\n";
+        reported_drops = d;
+      }
+      if (!output.empty()) {
+        fwrite(output.data(), 1, output.size(), stderr);
+        fflush(stderr);
+        output.clear();
+      }
+      if (n) {
+        std::unique_lock<std::mutex> lock(mutex);
+        written += n;
+        condition.notify_all();
+        continue;
+      }
+      auto now = std::chrono::steady_clock::now();
+      if (now - last_roll > std::chrono::milliseconds(100)) {
+        // report suppressed messages of sites that went quiet
+        int64_t t = log_clock();
+        for (auto *site = sites.load(); site; site = site->next) {
+          site->roll(t);
+        }
+        last_roll = now;
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait_for(lock, std::chrono::milliseconds(10));
+    }
+  }
+};
+
+LoggerState &logger_state() {
+  // never destroyed, logging may happen during static destruction
+  static LoggerState *state = new LoggerState();
+  return *state;
+}
+
+}  // namespace
+
+LogSite::LogSite(const char *file, int line, LogLevel level)
+    : file(file), line(line), level(level) {
+  window_start = log_clock();
+  auto &state = logger_state();
+  next = state.sites.load();
+  while (!state.sites.compare_exchange_weak(next, this)) {
+  }
+}
+
+void LogSite::roll(int64_t now) {
+  int64_t start = window_start.load(std::memory_order_relaxed);
+  if (now - start < log_window ||
+      !window_start.compare_exchange_strong(start, now)) {
+    return;
+  }
+  window_count.store(0, std::memory_order_relaxed);
+  uint32_t count = suppressed.exchange(0);
+  if (count) {
+    Logger::report_suppressed(*this, count);
+  }
+}
+
+bool LogSite::admit() {
+  roll(log_clock());
+  if (window_count.fetch_add(1, std::memory_order_relaxed) <
+      Logger::rate_limit()) {
+    return true;
+  }
+  suppressed.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void Logger::set_rate_limit(uint32_t messages_per_second) {
+  logger_state().rate_limit = messages_per_second;
+}
+
+uint32_t Logger::rate_limit() {
+  return logger_state().rate_limit.load(std::memory_order_relaxed);
+}
+
+uint64_t Logger::dropped() { return logger_state().dropped; }
+
+void Logger::write(LogSite &site, std::string &&text) {
+  auto &state = logger_state();
+  LogEntry entry;
+  entry.site = &site;
+  entry.text = std::move(text);
+  if (state.queue.push(std::move(entry))) {
+    state.pushed++;
+  } else {
+    state.dropped++;
+  }
+}
+
+void Logger::report_suppressed(LogSite &site, uint32_t count) {
+  auto &state = logger_state();
+  LogEntry entry;
+  entry.site = &site;
+  entry.suppressed = count;
+  if (state.queue.push(std::move(entry))) {
+    state.pushed++;
+  } else {
+    state.dropped++;
+  }
+}
+
+void Logger::flush() {
+  auto &state = logger_state();
+  uint64_t target = state.pushed;
+  std::unique_lock<std::mutex> lock(state.mutex);
+  state.condition.notify_all();
+  state.condition.wait_for(lock, std::chrono::seconds(1), [&]() {
+    return state.written >= target;
+  });
+}
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <master.hpp>
 
 #include <log.hpp>
+#include <simd.hpp>
 #include <utils.hpp>
 
 namespace mittenwire {
@@ -32,13 +33,70 @@ inline static void scan_message(const Packet &message) {
   }
 }
 
-Master::Master(const std::shared_ptr<superspeed::Device> &device,
-               size_t buffer_count, size_t buffer_size) {
-  _device = device;
+// Stable counting sort, so that listeners can process each channel of a
+// transfer as one contiguous batch.
+static void sort_by_channel(std::vector<Packet> &packets,
+                            std::vector<Packet> &temp) {
+  bool sorted = true;
+  for (size_t i = 1; i < packets.size(); i++) {
+    if (packets[i].channel < packets[i - 1].channel) {
+      sorted = false;
+      break;
+    }
+  }
+  if (sorted) {
+    return;
+  }
+  size_t offsets[Deframer::channel_count + 1] = {};
+  for (auto &p : packets) {
+    offsets[p.channel + 1]++;
+  }
+  for (size_t c = 0; c < Deframer::channel_count; c++) {
+    offsets[c + 1] += offsets[c];
+  }
+  temp.resize(packets.size());
+  for (auto &p : packets) {
+    temp[offsets[p.channel]++] = std::move(p);
+  }
+  packets.swap(temp);
+  temp.clear();
+}
+
+static size_t default_max_buffer_count(size_t buffer_count,
+                                       size_t max_buffer_count) {
+  return max_buffer_count ? max_buffer_count : buffer_count * 4;
+}
+
+// The ring holds every transfer the reader can have leased at once, so that
+// it only overflows when the packet thread falls behind.
+Master::Master(const std::shared_ptr<superspeed::Transport> &transport,
+               size_t buffer_count, size_t buffer_size,
+               size_t max_buffer_count)
+    : _rx_ring(default_max_buffer_count(buffer_count, max_buffer_count)) {
+  _transport = transport;
+  max_buffer_count = default_max_buffer_count(buffer_count, max_buffer_count);
+  if (!transport->live()) {
+    // recorded streams wait for the packet thread instead of losing data
+    _rx_ring.set_policy(BackpressurePolicy::Block);
+  }
+  MTW_LOG_INFO("master using " << simd_name() << " kernels");
+
+  auto &registry = MetricsRegistry::instance();
+  for (size_t i = 0; i < Deframer::channel_count; i++) {
+    std::string prefix = "master.channel." + std::to_string(i) + ".";
+    ChannelMetrics m;
+    m.packets = registry.counter(prefix + "packets");
+    m.bytes = registry.counter(prefix + "bytes");
+    m.split_packets = registry.counter(prefix + "split_packets");
+    _channel_metrics.push_back(m);
+  }
+  _transfers_metric = registry.counter("master.transfers");
+  _resync_words_metric = registry.counter("master.resync_words");
+  _overflows_metric = registry.counter("master.overflows");
 
   _reader = std::make_shared<superspeed::Reader>(
-      device,
-      [this](const void *data, size_t size) {
+      transport,
+      [this](superspeed::Buffer &&buffer) {
         if (g_master_framesync_debug) {
           union U {
             struct {
@@ -48,8 +106,8 @@ Master::Master(const std::shared_ptr<superspeed::Device> &device,
             uint64_t sync64;
             char sync8[9] = "EMARFMAC";
           } u;
-          auto *data32 = (const uint32_t *)data;
-          size_t n32 = size / 4;
+          auto *data32 = (const uint32_t *)buffer.data();
+          size_t n32 = buffer.size() / 4;
           for (size_t i = 0; i + 1 < n32; i++) {
             if (data32[i] == u.sync32b && data32[i + 1] == u.sync32a) {
               MTW_LOG_INFO(
@@ -61,106 +119,41 @@ Master::Master(const std::shared_ptr<superspeed::Device> &device,
             }
           }
         }
-        if (size > 0) {
-          std::unique_lock<std::mutex> lock(_rx_mutex);
-          _rx_buffers.emplace_back((const uint8_t *)data,
-                                   (const uint8_t *)data + size);
-          if (_rx_buffers.size() > 100000) {
-            _rx_buffers.clear();
-            MTW_LOG_ERROR("rx buffer overflow");
-          }
-          _rx_condition.notify_all();
+        if (!buffer.empty()) {
+          _rx_ring.push(std::move(buffer));
         }
       },
-      buffer_count, buffer_size);
+      buffer_count, buffer_size, max_buffer_count);
 
   _packet_thread = std::thread([this]() {
     {
       set_current_thread_name("master packet thread");
-      std::vector<uint32_t> recv_buffer;
-      size_t recv_index = 0;
-      size_t transfer_index = 0;
-      auto _recv = [this, &recv_buffer, &recv_index, &transfer_index] {
-        if (recv_index < recv_buffer.size()) {
-          return recv_buffer[recv_index++];
+      superspeed::Buffer recv_buffer;
+      std::vector<Packet> packets;
+      std::vector<Packet> sorted;
+      while (!_exit_flag && _rx_ring.pop(recv_buffer)) {
+        if (_exit_flag) break;
+        packets.clear();
+        _deframer.process((const uint32_t *)recv_buffer.data(),
+                          recv_buffer.size() / 4, packets,
+                          recv_buffer.timestamp());
+        recv_buffer.release();
+        update_metrics(packets);
+        if (packets.empty()) {
+          continue;
         }
-        recv_index = 0;
-        recv_buffer.clear();
-        {
-          std::unique_lock<std::mutex> lock(_rx_mutex);
-          while (recv_buffer.empty()) {
-            if (_exit_flag) {
-              return uint32_t(0);
-            }
-            if (!_rx_buffers.empty()) {
-              auto &b = _rx_buffers.front();
-              recv_buffer.resize(b.size() / 4);
-              memcpy(recv_buffer.data(), b.data(), recv_buffer.size() * 4);
-              _rx_buffers.pop_front();
-              transfer_index++;
-            } else {
-              _rx_condition.wait(lock);
-            }
-          }
+        for (auto &msg : packets) {
+          scan_message(msg);
         }
-        return recv_buffer[recv_index++];
-      };
-
-      struct PacketBuffer {
-        std::vector<uint32_t> data;
-        size_t start_transfer = 0;
-      };
-
-      std::vector<PacketBuffer> packet_buffers(16);
-
-      while (true) {
-        uint32_t header = _recv();
-        if (_exit_flag) break;
-        uint32_t header_masked = (header & 0xffff0000);
-        if (header_masked == 0x23010000) {
-          size_t len64 = (header & 0xff);
-          size_t channel = ((header >> 8) & 15);
-          bool end = ((header >> 12) & 1);
-          auto &pbuf = packet_buffers.at(channel);
-          if (pbuf.data.empty()) {
-            pbuf.start_transfer = transfer_index;
-          }
-          for (size_t i = 0; i < len64; i++) {
-            uint32_t v;
-            v = _recv();
-            pbuf.data.push_back(v);
-            v = _recv();
-            pbuf.data.push_back(v);
+        sort_by_channel(packets, sorted);
+        deliver(_listener_map, packets.data(), packets.size());
+        std::unique_lock<std::mutex> lock(_dispatch_mutex);
+        if (_dispatcher) {
+          for (auto &msg : packets) {
+            _dispatcher->dispatch(std::move(msg));
           }
-          if (_exit_flag) break;
-          if (end) {
-            size_t bytecount = pbuf.data.size() * 4;
-            Packet msg;
-            msg.channel = channel;
-            msg.data.resize(bytecount);
-            memcpy(msg.data.data(), pbuf.data.data(), bytecount);
-            if (pbuf.start_transfer != transfer_index) {
-              msg.flags |= 64;
-            }
-            pbuf.data.clear();
-            scan_message(msg);
-
-            ListenerMapPointer listener_map;
-            {
-              std::unique_lock<std::mutex> lock(_listener_mutex);
-              listener_map = _listener_map;
-            }
-            for (auto &l : *listener_map) {
-              l.second(msg);
-            }
-          }
-          if (pbuf.data.size() > 1000000) {
-            MTW_LOG_ERROR("pbuf overflow " << channel);
-            pbuf.data.clear();
-          }
-          continue;
         } else {
-          MTW_LOG_INFO("resync " << header << " " << header_masked);
+          deliver(_channel_listener_map, packets.data(), packets.size());
         }
       }
     }
@@ -171,44 +164,129 @@ Master::Master(const std::shared_ptr<superspeed::Device> &device,
 Master::~Master() {
   MTW_LOG_INFO("master shutting down tamsnet");
   MTW_LOG_INFO("master notifying threads");
-  {
-    std::unique_lock<std::mutex> lock(_rx_mutex);
-    _exit_flag = true;
-    _rx_condition.notify_all();
-  }
+  _exit_flag = true;
+  _rx_ring.close();
   MTW_LOG_INFO("master joining rx thread");
   _reader.reset();
   MTW_LOG_INFO("master joining packet thread");
   _packet_thread.join();
+  MTW_LOG_INFO("master joining dispatch threads");
+  _dispatcher.reset();
   MTW_LOG_INFO("master tamsnet shut down");
 }
 
-void Master::add_packet_listener(
-    const std::shared_ptr<void> &listener,
-    const std::function<void(const Packet &)> &callback) {
-  ListenerMap m;
-  {
-    std::unique_lock<std::mutex> lock(_listener_mutex);
-    m = *_listener_map;
+void Master::update_metrics(const std::vector<Packet> &packets) {
+  uint64_t counts[Deframer::channel_count] = {};
+  uint64_t bytes[Deframer::channel_count] = {};
+  uint64_t split[Deframer::channel_count] = {};
+  for (auto &p : packets) {
+    counts[p.channel]++;
+    bytes[p.channel] += p.data.size();
+    split[p.channel] += ((p.flags & 64) != 0);
+  }
+  for (size_t i = 0; i < Deframer::channel_count; i++) {
+    if (counts[i]) {
+      _channel_metrics[i].packets->add(counts[i]);
+      _channel_metrics[i].bytes->add(bytes[i]);
+      if (split[i]) {
+        _channel_metrics[i].split_packets->add(split[i]);
+      }
+    }
+  }
+  _transfers_metric->add();
+  if (_deframer.resync_words() != _last_resync_words) {
+    _resync_words_metric->add(_deframer.resync_words() - _last_resync_words);
+    _last_resync_words = _deframer.resync_words();
+  }
+  if (_deframer.overflows() != _last_overflows) {
+    _overflows_metric->add(_deframer.overflows() - _last_overflows);
+    _last_overflows = _deframer.overflows();
   }
-  m[listener] = callback;
+}
+
+void Master::deliver(const ListenerMapPointer &map, const Packet *packets,
+                     size_t count) {
+  ListenerMapPointer listener_map;
   {
     std::unique_lock<std::mutex> lock(_listener_mutex);
-    _listener_map = std::make_shared<ListenerMap>(m);
+    listener_map = map;
+  }
+  PacketSpan span(packets, count);
+  for (auto &l : *listener_map) {
+    l.second(span);
   }
 }
 
-void Master::remove_packet_listener(const std::shared_ptr<void> &listener) {
+void Master::set_dispatch_threads(size_t thread_count) {
+  std::unique_lock<std::mutex> lock(_dispatch_mutex);
+  // drain the previous workers first to keep packets of a channel in order
+  _dispatcher.reset();
+  if (thread_count > 0) {
+    _dispatcher.reset(new Dispatcher(
+        thread_count, 4096,
+        [this](const Packet *packets, size_t count) {
+          deliver(_channel_listener_map, packets, count);
+        }));
+  }
+}
+
+size_t Master::dispatch_threads() {
+  std::unique_lock<std::mutex> lock(_dispatch_mutex);
+  return _dispatcher ? _dispatcher->thread_count() : 0;
+}
+
+void Master::add_packet_listener(
+    const std::shared_ptr<void> &listener,
+    const std::function<void(const Packet &)> &callback) {
+  add_batch_listener(listener, [callback](const PacketSpan &packets) {
+    for (auto &packet : packets) {
+      callback(packet);
+    }
+  });
+}
+
+void Master::update_listeners(
+    ListenerMapPointer &map, const std::shared_ptr<void> &listener,
+    const std::function<void(const PacketSpan &)> *callback) {
   ListenerMap m;
   {
     std::unique_lock<std::mutex> lock(_listener_mutex);
-    m = *_listener_map;
+    m = *map;
+  }
+  if (callback) {
+    m[listener] = *callback;
+  } else {
+    m.erase(listener);
   }
-  m.erase(listener);
   {
     std::unique_lock<std::mutex> lock(_listener_mutex);
-    _listener_map = std::make_shared<ListenerMap>(m);
+    map = std::make_shared<ListenerMap>(m);
   }
 }
 
+void Master::add_batch_listener(
+    const std::shared_ptr<void> &listener,
+    const std::function<void(const PacketSpan &)> &callback) {
+  update_listeners(_listener_map, listener, &callback);
+}
+
+void Master::add_channel_listener(
+    const std::shared_ptr<void> &listener,
+    const std::function<void(const PacketSpan &)> &callback) {
+  update_listeners(_channel_listener_map, listener, &callback);
+}
+
+void Master::remove_packet_listener(const std::shared_ptr<void> &listener) {
+  update_listeners(_listener_map, listener, nullptr);
+  update_listeners(_channel_listener_map, listener, nullptr);
+}
+
+void Master::start_capture(const std::string &prefix, size_t segment_size,
+                           size_t max_segments) {
+  _reader->set_capture(std::make_shared<superspeed::Capture>(
+      prefix, segment_size, max_segments));
+}
+
+void Master::stop_capture() { _reader->set_capture(nullptr); }
+
 }  // namespace mittenwire
\ No newline at end of file
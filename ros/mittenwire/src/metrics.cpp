@@ -0,0 +1,98 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <metrics.hpp>
+
+#include <algorithm>
+
+namespace mittenwire {
+
+uint64_t HistogramSnapshot::quantile(double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t threshold = std::max<uint64_t>(1, q * count);
+  uint64_t accumulated = 0;
+  for (size_t i = 0; i < buckets.size(); i++) {
+    accumulated += buckets[i];
+    if (accumulated >= threshold) {
+      return i == 0 ? 0 : std::min(max, (uint64_t(1) << i) - 1);
+    }
+  }
+  return max;
+}
+
+HistogramSnapshot MetricHistogram::snapshot() const {
+  HistogramSnapshot ret;
+  ret.buckets.resize(bucket_count);
+  for (size_t i = 0; i < bucket_count; i++) {
+    ret.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+    ret.count += ret.buckets[i];
+  }
+  ret.sum = _sum.load(std::memory_order_relaxed);
+  ret.max = _max.load(std::memory_order_relaxed);
+  return ret;
+}
+
+MetricsRegistry &MetricsRegistry::instance() {
+  // never destroyed, components may still update metrics during shutdown
+  static MetricsRegistry *registry = new MetricsRegistry();
+  return *registry;
+}
+
+template <class T>
+static std::shared_ptr<T> get_or_create(
+    std::map<std::string, std::shared_ptr<T>> &map, const std::string &name) {
+  auto &ptr = map[name];
+  if (!ptr) {
+    ptr = std::make_shared<T>();
+  }
+  return ptr;
+}
+
+std::shared_ptr<MetricCounter> MetricsRegistry::counter(
+    const std::string &name) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return get_or_create(_counters, name);
+}
+
+std::shared_ptr<MetricGauge> MetricsRegistry::gauge(const std::string &name) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return get_or_create(_gauges, name);
+}
+
+std::shared_ptr<MetricHistogram> MetricsRegistry::histogram(
+    const std::string &name) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return get_or_create(_histograms, name);
+}
+
+std::vector<MetricSample> MetricsRegistry::snapshot() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  std::vector<MetricSample> ret;
+  for (auto &p : _counters) {
+    ret.emplace_back();
+    ret.back().name = p.first;
+    ret.back().type = MetricType::Counter;
+    ret.back().value = p.second->value();
+  }
+  for (auto &p : _gauges) {
+    ret.emplace_back();
+    ret.back().name = p.first;
+    ret.back().type = MetricType::Gauge;
+    ret.back().value = p.second->value();
+  }
+  for (auto &p : _histograms) {
+    ret.emplace_back();
+    ret.back().name = p.first;
+    ret.back().type = MetricType::Histogram;
+    ret.back().histogram = p.second->snapshot();
+    ret.back().value = ret.back().histogram.count;
+  }
+  std::sort(ret.begin(), ret.end(),
+            [](const MetricSample &a, const MetricSample &b) {
+              return a.name < b.name;
+            });
+  return ret;
+}
+
+}  // namespace mittenwire
\ No newline at end of file
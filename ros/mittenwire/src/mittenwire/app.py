@@ -10,7 +10,7 @@ import PIL
 import PIL.ImageFont
 import PIL.ImageDraw
 import PIL.Image
-from . import net, image, mosaic, gui, profiler
+from . import net, image, gui, profiler
 from OpenGL import GL
 import moderngl
 import struct
@@ -38,46 +38,24 @@ class App:
         self.window.__exit__(exc_type, exc_val, exc_tb)
         print("app shut down")
 
-    def preprocess(self, img):
-
-        with profiler.Profiler("debayer", 0):
-            img = cv2.cvtColor(img, cv2.COLOR_BAYER_GR2RGB)
-
-        return img
-
-    def postprocess(self, img):
-
+    def isp_params(self):
+        params = pymittenwire.IspParams()
         hconf = self.network.hub_config
-
         if hconf is not False and hconf.enable_filters:
+            params.hue = hconf.hue
+            params.saturation = hconf.saturation * 0.01
+            params.brightness = hconf.brightness * 0.01
+            params.tone_mapping = hconf.tone_mapping
+            params.invert = hconf.invert
+        return params
 
-            img = cv2.cvtColor(img, cv2.COLOR_RGB2HSV_FULL)
-            h, s, v = cv2.split(img)
-
-            h += np.uint8(int(hconf.hue * 256 / 360))
-            s = cv2.multiply(s, (1, 1, 1, 1), scale=hconf.saturation * 0.01)
-
-            img = cv2.merge([h, s, v])
-            img = cv2.cvtColor(img, cv2.COLOR_HSV2RGB_FULL)
-
-            img = cv2.multiply(img, (1, 1, 1, 1),
-                               scale=hconf.brightness * 0.01)
-
-            if hconf.invert:
-                img = 255 - img
-
-            # mittenwire.tonemap(img)
-
-            # img = np.array(img, dtype=np.uint8)
-            # mittenwire.sqrt_tonemap_srgb_8(img, hconf.brightness * 0.01)
+    def postprocess(self, img):
 
-        # mittenwire.linear2srgb(img)
+        hconf = self.network.hub_config
 
         if hconf is not False and hconf.enable_filters:
             if hconf.median_blur > 0:
-                img = cv2.medianBlur(img, hconf.median_blur * 2 + 1)
-
-        return img
+                img[...] = cv2.medianBlur(img, hconf.median_blur * 2 + 1)
 
     def process_camera_image(self, msg):
 
@@ -123,6 +101,9 @@ class App:
         self.frame_images = {}
         self.frame_lock = threading.Lock()
 
+        self.compositor = pymittenwire.MosaicCompositor(400, 300)
+        self.frame_buffer = None
+
         self.pub_mat = rospy.Publisher("impedance_matrix", mittenwire.msg.ImpedanceMatrix,
                                        latch=False, queue_size=100)
 
@@ -187,36 +168,35 @@ class App:
             (images[i].message) and (time.time() < images[i].time + 3.0)))]
         return images
 
-    def render_mosaic(self, width, height):
-
-        width = max(self.minsize, width)
-        height = max(self.minsize, height)
+    def render_mosaic(self, out):
 
         # hconf = self.network.hub_config
         # prefix = self.network.get_mode_prefix()
 
         images = self.get_images()
 
-        images = [self.render_message(img.message) for img in images]
-
-        images = [img for img in images if img is not None]
+        images = [img.message for img in images
+                  if isinstance(img.message, pymittenwire.ImageMessage)]
 
-        images = [self.preprocess(img) for img in images]
-        img = mosaic.make_mosaic(
-            images, (height, width),
-            # (hconf[prefix+"height"], hconf[prefix+"width"])
-            (300, 400), np.uint8)
-        img = self.postprocess(img)
+        # raw frames are demosaiced at cell size straight into the display
+        # buffer
+        with profiler.Profiler("mosaic", 0):
+            self.compositor.render(images, out, self.isp_params())
 
-        return img
+        self.postprocess(out)
 
-    def render(self, width, height):
-        return self.render_mosaic(width, height)
+    def display_buffer(self, width, height):
+        if self.frame_buffer is None or self.frame_buffer.shape[:2] != (height, width):
+            self.frame_buffer = np.zeros([height, width, 3], dtype=np.uint8)
+        return self.frame_buffer
 
     def render(self, width, height, text):
 
         bar = 32
 
+        width = max(self.minsize, width)
+        height = max(self.minsize + bar, height)
+
         image = np.zeros([bar, width, 3], dtype=np.uint8)
 
         font = cv2.FONT_HERSHEY_SIMPLEX
@@ -228,10 +208,11 @@ class App:
         cv2.putText(image, text, (x, y),
                     font, scale, (255, 255, 255), thickness)
 
-        image = np.vstack([image.astype(np.uint8) * 50,
-                          self.render_mosaic(width, height - bar)])
+        frame = self.display_buffer(width, height)
+        frame[:bar] = image.astype(np.uint8) * 50
+        self.render_mosaic(frame[bar:])
 
-        return image
+        return frame
 
     def handle_event(self, event):
         if event.type == sdl2.SDL_WINDOWEVENT:
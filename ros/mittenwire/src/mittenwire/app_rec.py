@@ -1,39 +1,31 @@
 #!/usr/bin/env python3
 
 import mittenwire
-import rospy
-import rosbag
 import sdl2
 import sys
 import time
-import sensor_msgs.msg
-import threading
-import numpy as np
 
 
 class RecordingApp(mittenwire.App):
 
+    # frames and tactile messages are recorded natively by the network's
+    # recorder, the callbacks only count them
     def __init__(self):
         self.w = 0
         self.h = 0
-        self.lock = threading.Lock()
-        self.bag = None
         self.counter_images = 0
         self.counter_tactile = 0
-        self.timeref = np.uint32(0)
         super().__init__("View")
 
+    @property
+    def recorder(self):
+        return self.network.recorder
+
     def close(self):
         print("closing bag if open")
-        b = None
-        with self.lock:
-            if self.bag is not None:
-                b = self.bag
-                self.bag = None
-        if b is not None:
+        if self.recorder.recording:
             print("closing bag")
-            b.close()
-            b = None
+            self.recorder.stop()
             print("bag closed")
             return True
         else:
@@ -43,67 +35,35 @@ class RecordingApp(mittenwire.App):
         super().run()
         self.close()
 
-    def time2ros(self, t):
-        rtime = int(np.uint32(np.uint32(t) +
-                    np.uint32(1000000) - np.uint32(self.timeref)))
-        rtime = rospy.Time(0, rtime * 1000)
-        # print(t, rtime, time.time() - rtime.to_sec())
-        return rtime
-
     def process_tactile_matrix(self, msg):
         super().process_tactile_matrix(msg)
-        t = self.time2ros(msg.timestamp)
-        msg.header.stamp = t
-        with self.lock:
-            if self.bag is not None:
-                self.bag.write("/impedance_matrix", msg, t=t)
         self.counter_tactile += 1
 
     def process_tactile_status(self, msg):
         super().process_tactile_status(msg)
-        t = self.time2ros(msg.timestamp)
-        msg.header.stamp = t
-        with self.lock:
-            if self.bag is not None:
-                self.bag.write("/glove_status", msg, t=t)
         self.counter_tactile += 1
 
     def process_camera_image(self, msg):
         super().process_camera_image(msg)
         self.w = msg.width
         self.h = msg.height
-        t = self.time2ros(msg.request_timestamp)
-        with self.lock:
-            if self.bag is not None:
-                image_message = self.image2ros(msg)
-                image_message.header.stamp = t
-                info_message = sensor_msgs.msg.CameraInfo()
-                info_message.header.stamp = t
-                info_message.width = 2592
-                info_message.height = 1944
-                info_message.binning_x = msg.skip
-                info_message.binning_y = msg.skip
-                info_message.roi.x_offset = msg.left
-                info_message.roi.y_offset = msg.top
-                info_message.roi.width = msg.width * msg.skip
-                info_message.roi.height = msg.height * msg.skip
-                self.bag.write("/cam"+str(msg.channel) +
-                               "/image_raw", image_message, t=t)
-                self.bag.write("/cam"+str(msg.channel) +
-                               "/camera_info", info_message, t=t)
         self.counter_images += 1
 
     def render(self, width, height):
-        with self.lock:
-            if self.bag:
-                text = "recording " + self.bag.filename
-            else:
-                text = "press space to start recording"
-                bagname = self.suggest_bag_name()
-                if bagname:
-                    text += " \"" + bagname + "\""
-            text += " - cam " + str(self.counter_images) + " - tac " + \
-                    str(self.counter_tactile)
+        if self.recorder.recording:
+            text = "recording " + self.recorder.path
+            text += " - backlog %.0f MB" % (self.recorder.backlog_bytes * 1e-6)
+            if self.recorder.dropped:
+                text += " - not recorded " + str(self.recorder.dropped)
+            if self.recorder.incomplete:
+                text += " - incomplete " + str(self.recorder.incomplete)
+        else:
+            text = "press space to start recording"
+            bagname = self.suggest_bag_name()
+            if bagname:
+                text += " \"" + bagname + "\""
+        text += " - cam " + str(self.counter_images) + " - tac " + \
+                str(self.counter_tactile)
         text += (" - fps %.3f" % self.frames_per_second)
         text += " - %i x %i" % (self.w, self.h)
         return super().render(width, height, text)
@@ -119,17 +79,12 @@ class RecordingApp(mittenwire.App):
         if event.type == sdl2.SDL_KEYDOWN:
             if event.key.keysym.sym == sdl2.SDLK_SPACE:
                 if not self.close():
-                    with self.lock:
-                        if self.bag is None:
-                            name = "bag-"
-                            name += str(time.time_ns())
-                            bagname = self.suggest_bag_name()
-                            if bagname:
-                                name += "-" + bagname
-                            name += ".bag"
-                            self.bag = rosbag.Bag(name, "w")
-                            self.counter_images = 0
-                            self.counter_tactile = 0
-                            self.timeref = np.uint32(self.frame_timestamp)
-                        else:
-                            closebag = True
+                    name = "bag-"
+                    name += str(time.time_ns())
+                    bagname = self.suggest_bag_name()
+                    if bagname:
+                        name += "-" + bagname
+                    name += ".bag"
+                    self.recorder.start(name)
+                    self.counter_images = 0
+                    self.counter_tactile = 0
@@ -145,21 +145,49 @@ class GloveParser:
         return ret
 
 
-class Glove(mittenwire.Node):
-
-    def __init__(self, matrix_handler, status_handler):
-
-        self.parser = GloveParser()
-
-        def handle_message(message):
-            ros_msg = self.parser.parse(bytes(message.data))
-
-            if isinstance(ros_msg,  mittenwire.msg.ImpedanceMatrix):
-                ros_msg.channel = message.channel
-                matrix_handler(ros_msg)
-
-            if isinstance(ros_msg,  mittenwire.msg.GloveStatus):
-                ros_msg.channel = message.channel
-                status_handler(ros_msg)
-
-        super().__init__(handle_message)
+def tactile_matrix_to_ros(matrix):
+    mat = mittenwire.msg.ImpedanceMatrix()
+    mat.channel = matrix.channel
+    mat.timestamp = matrix.timestamp
+    mat.width = matrix.width
+    mat.height = matrix.height
+    mat.inphase = matrix.inphase.ravel().astype(np.float32)
+    mat.quadrature = matrix.quadrature.ravel().astype(np.float32)
+    mat.validity = matrix.validity.ravel()
+    return mat
+
+
+def tactile_status_to_ros(status):
+    msg = mittenwire.msg.GloveStatus()
+    msg.channel = status.channel
+    msg.timestamp = status.timestamp
+    msg.clock_milliseconds = status.clock_milliseconds
+    msg.core_temperature = status.core_temperature
+    msg.button_pressed = status.button_pressed
+    msg.battery_disconnect = status.battery_disconnect
+    msg.battery_charging = status.battery_charging
+    msg.usb_power_present = status.usb_power_present
+    msg.battery_voltage = status.battery_voltage
+    msg.battery_current = status.battery_current
+    msg.imu_temperature = status.imu_temperature
+    (msg.imu_linear_acceleration.x,
+     msg.imu_linear_acceleration.y,
+     msg.imu_linear_acceleration.z) = status.imu_linear_acceleration
+    (msg.imu_angular_velocity.x,
+     msg.imu_angular_velocity.y,
+     msg.imu_angular_velocity.z) = status.imu_angular_velocity
+    return msg
+
+
+class Glove(mittenwire.Tactile):
+
+    # parsing and matrix reassembly are native, only the finished ROS
+    # messages are built in Python
+    def __init__(self, matrix_handler, status_handler, clock_sync=None):
+
+        super().__init__(
+            lambda matrix: matrix_handler(tactile_matrix_to_ros(matrix)),
+            lambda status: status_handler(tactile_status_to_ros(status)))
+
+        if clock_sync is not None:
+            self.set_clock_sync(clock_sync)
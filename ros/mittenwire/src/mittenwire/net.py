@@ -1,6 +1,9 @@
 #!/usr/bin/env python3
 
 import mittenwire
+import rospy
+import sys
+import threading
 import time
 import dynamic_reconfigure.server
 import mittenwire.cfg.SensorConfig
@@ -127,8 +130,9 @@ class Network:
 
     def _camera_callback(self, msg):
 
-        if not msg.valid:
-            print("image corrupted")
+        if not msg.valid and msg.completeness < self.min_frame_completeness:
+            print("image corrupted, received %d of %d packets" %
+                  (msg.packets_received, msg.packets_expected))
             return
 
         # print("camera_callback_wrapper begin")
@@ -139,6 +143,23 @@ class Network:
             self.camera_callback(msg)
         # print("camera_callback_wrapper end")
 
+    def _frame_loop(self):
+        # frames are pulled in batches, so a busy interpreter only fills the
+        # queue instead of stalling the packet path
+        while not self.frame_queue.closed:
+            for msg in self.frame_queue.poll(64, 1.0):
+                self._camera_callback(msg)
+
+    def _tactile_loop(self):
+        while not self.tactile_queue.closed:
+            for msg in self.tactile_queue.poll(256, 1.0):
+                if isinstance(msg, mittenwire.TactileMatrix):
+                    self._tactile_matrix_callback(
+                        mittenwire.tactile_matrix_to_ros(msg))
+                elif isinstance(msg, mittenwire.TactileStatus):
+                    self._tactile_status_callback(
+                        mittenwire.tactile_status_to_ros(msg))
+
     def _tactile_matrix_callback(self, msg):
         self.update_times[msg.channel] = time.time()
         self.messages_valid[msg.channel] = 1
@@ -175,15 +196,18 @@ class Network:
                         self.remove_sensor(iport)
                         print("creating camera at port", iport)
                         cam = mittenwire.Camera(
-                            self._camera_callback)
+                            self.frame_queue, recorder=self.recorder)
+                        cam.set_clock_sync(self.master.clock_sync)
+                        cam.fill_policy = mittenwire.FillPolicy.Interpolate
                         self.sensors[iport] = cam
                         self.hub.connect(iport, cam)
                 elif port_type == 2:
-                    if not isinstance(self.sensors[iport], mittenwire.Glove):
+                    if not isinstance(self.sensors[iport], mittenwire.Tactile):
                         self.remove_sensor(iport)
                         print("creating tactile at port", iport)
-                        cam = mittenwire.Glove(
-                            self._tactile_matrix_callback, self._tactile_status_callback)
+                        cam = mittenwire.Tactile(
+                            self.tactile_queue, recorder=self.recorder)
+                        cam.set_clock_sync(self.master.clock_sync)
                         self.sensors[iport] = cam
                         self.hub.connect(iport, cam)
                 else:
@@ -201,6 +225,12 @@ class Network:
 
     def __exit__(self, exc_type, exc_val, exc_tb):
         print("net del")
+        self.recorder.stop()
+        del self.diagnostics
+        self.frame_queue.close()
+        self.frame_thread.join()
+        self.tactile_queue.close()
+        self.tactile_thread.join()
         for sensor in self.sensors:
             del sensor
         del self.sensors
@@ -222,6 +252,10 @@ class Network:
 
         self.attention_map = {}
 
+        # frames with lost packets arrive with the gaps filled in, pass them
+        # on as long as most of the frame is there
+        self.min_frame_completeness = 0.95
+
         port_count = 8
         self.port_count = port_count
 
@@ -230,6 +264,20 @@ class Network:
         self.update_times = [0] * port_count
         self.messages_valid = [True] * port_count
 
+        # idle until started, records straight from the packet path
+        self.recorder = mittenwire.Recorder()
+        self.recorder.min_frame_completeness = self.min_frame_completeness
+
+        self.frame_queue = mittenwire.FrameQueue(4 * port_count)
+        self.frame_thread = threading.Thread(
+            target=self._frame_loop, daemon=True)
+        self.frame_thread.start()
+
+        self.tactile_queue = mittenwire.MessageQueue(1024)
+        self.tactile_thread = threading.Thread(
+            target=self._tactile_loop, daemon=True)
+        self.tactile_thread.start()
+
         ctx = mittenwire.Context()
         self.context = ctx
 
@@ -253,6 +301,17 @@ class Network:
         hub = mittenwire.Hub(net)
         self.hub = hub
 
+        # publishes the native metrics, which needs a roscpp node of its own
+        # next to the rospy one. roslaunch passes the rospy node's name as a
+        # remap that would override ours and get the rospy node shut down.
+        if not mittenwire.ros_ok():
+            argv = [a for a in sys.argv
+                    if not a.startswith(("__name:=", "__log:="))]
+            mittenwire.ros_init(
+                argv, rospy.get_name().split("/")[-1] + "_native")
+        self.diagnostics = mittenwire.DiagnosticsPublisher(
+            mittenwire.NodeHandle(""))
+
         self.led_count = 9
         self.port_leds = [5, 6, 7, 8, 3, 2, 1, 0]
         self.usb_led = 4
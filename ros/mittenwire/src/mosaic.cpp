@@ -0,0 +1,240 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <mosaic.hpp>
+
+#include <camera.hpp>
+#include <parallel.hpp>
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace mittenwire {
+
+static constexpr size_t mosaic_band_rows = 16;
+
+std::vector<MosaicCell> mosaic_layout(
+    size_t width, size_t height, size_t cell_width, size_t cell_height,
+    const std::vector<std::pair<size_t, size_t>> &image_sizes) {
+  std::vector<MosaicCell> cells;
+  size_t count = image_sizes.size();
+  if (count == 0) {
+    return cells;
+  }
+  auto cell_scale = [&](double w, double h, size_t cols) {
+    size_t rows = (count + cols - 1) / cols;
+    return std::min(width * 1.0 / cols / std::max(w, 1.0),
+                    height * 1.0 / rows / std::max(h, 1.0));
+  };
+  // ties go to more columns, like the stable sort in mosaic.py
+  size_t cols = 1;
+  double best = 0;
+  for (size_t c = 1; c <= count; c++) {
+    double scale = cell_scale(cell_width, cell_height, c);
+    if (scale >= best) {
+      best = scale;
+      cols = c;
+    }
+  }
+  size_t rows = (count + cols - 1) / cols;
+  for (size_t i = 0; i < count; i++) {
+    size_t col = i % cols;
+    size_t row = i / cols;
+    size_t cx = width * (col * 2 + 1) / (cols * 2);
+    size_t cy = height * (row * 2 + 1) / (rows * 2);
+    double s =
+        cell_scale(image_sizes[i].first, image_sizes[i].second, cols) * 0.99;
+    MosaicCell cell;
+    cell.width = (size_t)floor(image_sizes[i].first * s);
+    cell.height = (size_t)floor(image_sizes[i].second * s);
+    cell.x = cx - std::min(cx, cell.width / 2);
+    cell.y = cy - std::min(cy, cell.height / 2);
+    cell.width = std::min(cell.width, width - cell.x);
+    cell.height = std::min(cell.height, height - cell.y);
+    cells.push_back(cell);
+  }
+  return cells;
+}
+
+namespace {
+
+// Per column sums of the red, green and blue samples of one row of GRBG
+// quads, green counted twice.
+void mosaic_sum_quads(const uint8_t *__restrict row0,
+                      const uint8_t *__restrict row1, int32_t *__restrict red,
+                      int32_t *__restrict green, int32_t *__restrict blue,
+                      size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    green[i] += row0[i * 2] + row1[i * 2 + 1];
+    red[i] += row0[i * 2 + 1];
+    blue[i] += row1[i * 2];
+  }
+}
+
+void mosaic_band(const ImageMessage &image, const MosaicCell &cell,
+                 uint8_t *out, size_t stride, size_t channels,
+                 const IspTables &tables, size_t y0, size_t y1) {
+  size_t quads_x = image.width / 2;
+  size_t quads_y = image.height / 2;
+
+  // quad range of each output column, at least one quad wide when enlarging
+  thread_local std::vector<uint32_t> column_begin, column_end;
+  column_begin.resize(cell.width);
+  column_end.resize(cell.width);
+  for (size_t x = 0; x < cell.width; x++) {
+    size_t begin = x * quads_x / cell.width;
+    column_begin[x] = begin;
+    column_end[x] = std::max(begin + 1, (x + 1) * quads_x / cell.width);
+  }
+
+  thread_local std::vector<int32_t> sums;
+  thread_local std::vector<int32_t> indices;
+  sums.resize(quads_x * 3);
+  indices.resize(cell.width * 3);
+  int32_t *red = sums.data();
+  int32_t *green = red + quads_x;
+  int32_t *blue = green + quads_x;
+  const float *m = tables.matrix;
+  const float black = tables.black;
+  const float limit = IspTables::lut_size - 1;
+  const uint8_t *lut = tables.lut;
+
+  for (size_t y = y0; y < y1; y++) {
+    size_t row_begin = y * quads_y / cell.height;
+    size_t row_end = std::max(row_begin + 1, (y + 1) * quads_y / cell.height);
+    std::fill(sums.begin(), sums.end(), 0);
+    for (size_t q = row_begin; q < row_end; q++) {
+      const uint8_t *row0 = image.data.data() + q * 2 * image.width;
+      mosaic_sum_quads(row0, row0 + image.width, red, green, blue, quads_x);
+    }
+    float row_weight = 1.0f / (row_end - row_begin);
+    int32_t *ix = indices.data();
+    for (size_t x = 0; x < cell.width; x++) {
+      int32_t r = 0, g = 0, b = 0;
+      for (size_t i = column_begin[x]; i < column_end[x]; i++) {
+        r += red[i];
+        g += green[i];
+        b += blue[i];
+      }
+      float weight = row_weight / (column_end[x] - column_begin[x]);
+      float fr = r * weight - black;
+      float fg = g * weight * 0.5f - black;
+      float fb = b * weight - black;
+      // BGR order
+      ix[x * 3 + 0] = (int32_t)std::min(
+          std::max(m[6] * fr + m[7] * fg + m[8] * fb, 0.0f), limit);
+      ix[x * 3 + 1] = (int32_t)std::min(
+          std::max(m[3] * fr + m[4] * fg + m[5] * fb, 0.0f), limit);
+      ix[x * 3 + 2] = (int32_t)std::min(
+          std::max(m[0] * fr + m[1] * fg + m[2] * fb, 0.0f), limit);
+    }
+    uint8_t *dst = out + (cell.y + y) * stride + cell.x * channels;
+    if (channels == 3) {
+      for (size_t i = 0; i < cell.width * 3; i++) {
+        dst[i] = lut[ix[i]];
+      }
+    } else {
+      for (size_t x = 0; x < cell.width; x++) {
+        dst[x * 4 + 0] = lut[ix[x * 3 + 0]];
+        dst[x * 4 + 1] = lut[ix[x * 3 + 1]];
+        dst[x * 4 + 2] = lut[ix[x * 3 + 2]];
+        dst[x * 4 + 3] = 255;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+MosaicCompositor::MosaicCompositor(size_t cell_width, size_t cell_height,
+                                   size_t channels)
+    : _cell_width(cell_width),
+      _cell_height(cell_height),
+      _channels(channels) {
+  if (channels != 3 && channels != 4) {
+    throw std::runtime_error("mosaic must have three or four channels");
+  }
+}
+
+void MosaicCompositor::update_layout(
+    const std::vector<std::shared_ptr<ImageMessage>> &images, size_t width,
+    size_t height) {
+  std::vector<std::pair<size_t, size_t>> sizes;
+  for (auto &image : images) {
+    sizes.emplace_back(image->width, image->height);
+  }
+  if (width != _width || height != _height || sizes != _image_sizes) {
+    _cells = mosaic_layout(width, height, _cell_width, _cell_height, sizes);
+    _width = width;
+    _height = height;
+    _image_sizes = std::move(sizes);
+  }
+}
+
+void MosaicCompositor::render(
+    const std::vector<std::shared_ptr<ImageMessage>> &images, uint8_t *out,
+    size_t width, size_t height, size_t stride, const IspParams &params,
+    ThreadPool *pool) {
+  update_layout(images, width, height);
+  IspTables tables(params);
+
+  // one work item per band of rows of a cell, after clearing the background
+  struct Item {
+    size_t cell = 0;
+    size_t y0 = 0;
+    size_t y1 = 0;
+  };
+  std::vector<Item> items;
+  for (size_t i = 0; i < _cells.size(); i++) {
+    auto &image = *images[i];
+    if (image.width < 2 || image.height < 2 ||
+        image.data.size() < image.width * image.height) {
+      continue;
+    }
+    for (size_t y = 0; y < _cells[i].height; y += mosaic_band_rows) {
+      Item item;
+      item.cell = i;
+      item.y0 = y;
+      item.y1 = std::min(y + mosaic_band_rows, _cells[i].height);
+      items.push_back(item);
+    }
+  }
+  auto clear = [&](size_t y0, size_t y1) {
+    for (size_t y = y0; y < y1; y++) {
+      uint8_t *row = out + y * stride;
+      memset(row, 0, width * _channels);
+      if (_channels == 4) {
+        for (size_t x = 0; x < width; x++) {
+          row[x * 4 + 3] = 255;
+        }
+      }
+    }
+  };
+  auto draw = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      auto &item = items[i];
+      mosaic_band(*images[item.cell], _cells[item.cell], out, stride,
+                  _channels, tables, item.y0, item.y1);
+    }
+  };
+  if (pool) {
+    pool->parallel_for(0, height, mosaic_band_rows * 4, clear);
+    pool->parallel_for(0, items.size(), 1, draw);
+  } else {
+    clear(0, height);
+    draw(0, items.size());
+  }
+}
+
+const uint8_t *MosaicCompositor::render(
+    const std::vector<std::shared_ptr<ImageMessage>> &images, size_t width,
+    size_t height, const IspParams &params, ThreadPool *pool) {
+  _buffer.resize(width * height * _channels);
+  render(images, _buffer.data(), width, height, width * _channels, params,
+         pool);
+  return _buffer.data();
+}
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -8,4 +8,10 @@ namespace mittenwire {
 
 void Node::process(const Packet& message) {}
 
+void Node::process_batch(const PacketSpan& packets) {
+  for (auto& packet : packets) {
+    process(packet);
+  }
+}
+
 }
\ No newline at end of file
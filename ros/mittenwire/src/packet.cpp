@@ -4,4 +4,132 @@
 
 #include <log.hpp>
 
-namespace mittenwire {}
\ No newline at end of file
+#include <stdlib.h>
+
+#include <new>
+
+namespace mittenwire {
+
+namespace {
+
+void update_high_water(std::atomic<uint64_t> &high_water, uint64_t value) {
+  uint64_t current = high_water.load(std::memory_order_relaxed);
+  while (value > current &&
+         !high_water.compare_exchange_weak(current, value,
+                                           std::memory_order_relaxed)) {
+  }
+}
+
+struct SpinLock {
+  std::atomic_flag &flag;
+  SpinLock(std::atomic_flag &flag) : flag(flag) {
+    while (flag.test_and_set(std::memory_order_acquire)) {
+    }
+  }
+  ~SpinLock() { flag.clear(std::memory_order_release); }
+};
+
+size_t size_class_of(size_t size) {
+  size_t c = 0;
+  while ((size_t(1) << (PacketPool::min_class_shift + c)) < size) {
+    c++;
+  }
+  return c;
+}
+
+}  // namespace
+
+PacketPool &PacketPool::instance() {
+  // never destroyed, packets may still be released during static destruction
+  static PacketPool *pool = new PacketPool();
+  return *pool;
+}
+
+PacketBlock *PacketPool::allocate(size_t size) {
+  size_t c = size_class_of(size);
+  PacketBlock *block = nullptr;
+  size_t capacity = size;
+  if (c < class_count) {
+    capacity = size_t(1) << (min_class_shift + c);
+    auto &sc = _classes[c];
+    SpinLock lock(sc.lock);
+    if (sc.free) {
+      block = sc.free;
+      sc.free = block->next;
+      sc.cached_bytes -= capacity;
+    }
+  }
+  if (block) {
+    _hits++;
+    _bytes_cached -= capacity;
+    block->refcount.store(1, std::memory_order_relaxed);
+    block->next = nullptr;
+  } else {
+    _misses++;
+    void *mem = aligned_alloc(alignof(PacketBlock),
+                              (sizeof(PacketBlock) + capacity + 15) / 16 * 16);
+    if (!mem) {
+      throw std::bad_alloc();
+    }
+    block = new (mem) PacketBlock();
+    block->size_class = c;
+    block->capacity = capacity;
+  }
+  block->size = 0;
+  update_high_water(_blocks_high_water, ++_blocks_in_use);
+  update_high_water(_bytes_high_water, _bytes_in_use += capacity);
+  return block;
+}
+
+void PacketPool::release(PacketBlock *block) {
+  size_t capacity = block->capacity;
+  _blocks_in_use--;
+  _bytes_in_use -= capacity;
+  if (block->size_class < class_count) {
+    auto &sc = _classes[block->size_class];
+    SpinLock lock(sc.lock);
+    if (sc.cached_bytes + capacity <= max_cached_bytes ||
+        sc.free == nullptr) {
+      block->next = sc.free;
+      sc.free = block;
+      sc.cached_bytes += capacity;
+      _bytes_cached += capacity;
+      return;
+    }
+  }
+  block->~PacketBlock();
+  free(block);
+}
+
+void PacketPool::trim() {
+  for (auto &sc : _classes) {
+    PacketBlock *list = nullptr;
+    {
+      SpinLock lock(sc.lock);
+      list = sc.free;
+      sc.free = nullptr;
+      _bytes_cached -= sc.cached_bytes;
+      sc.cached_bytes = 0;
+    }
+    while (list) {
+      PacketBlock *next = list->next;
+      list->~PacketBlock();
+      free(list);
+      list = next;
+    }
+  }
+}
+
+PacketPoolStats PacketPool::stats() const {
+  PacketPoolStats ret;
+  ret.hits = _hits;
+  ret.misses = _misses;
+  ret.blocks_in_use = _blocks_in_use;
+  ret.blocks_high_water = _blocks_high_water;
+  ret.bytes_in_use = _bytes_in_use;
+  ret.bytes_high_water = _bytes_high_water;
+  ret.bytes_cached = _bytes_cached;
+  return ret;
+}
+
+}  // namespace mittenwire
\ No newline at end of file
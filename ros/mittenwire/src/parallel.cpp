@@ -0,0 +1,108 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <parallel.hpp>
+
+#include <utils.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace mittenwire {
+
+ThreadPool::ThreadPool(size_t thread_count) {
+  if (thread_count == 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < thread_count; i++) {
+    _threads.emplace_back([this, i]() {
+      std::string name = "pool " + std::to_string(i);
+      set_current_thread_name(name.c_str());
+      while (true) {
+        std::function<void()> task;
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          while (!_exit && _tasks.empty()) {
+            _condition.wait(lock);
+          }
+          if (_tasks.empty()) {
+            return;
+          }
+          task = std::move(_tasks.front());
+          _tasks.pop_front();
+        }
+        task();
+      }
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _exit = true;
+    _condition.notify_all();
+  }
+  for (auto &thread : _threads) {
+    thread.join();
+  }
+}
+
+void ThreadPool::post(std::function<void()> task) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _tasks.push_back(std::move(task));
+  _condition.notify_one();
+}
+
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain,
+                              const std::function<void(size_t, size_t)> &f) {
+  if (begin >= end) {
+    return;
+  }
+  grain = std::max<size_t>(grain, 1);
+  size_t chunk_count = (end - begin + grain - 1) / grain;
+  if (chunk_count == 1) {
+    f(begin, end);
+    return;
+  }
+
+  // helpers may start after all chunks are done, so the job is shared
+  struct Job {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mutex;
+    std::condition_variable condition;
+  };
+  auto job = std::make_shared<Job>();
+  auto run = [job, begin, end, grain, chunk_count, &f]() {
+    size_t finished = 0;
+    size_t chunk;
+    while ((chunk = job->next.fetch_add(1)) < chunk_count) {
+      size_t b = begin + chunk * grain;
+      f(b, std::min(end, b + grain));
+      finished++;
+    }
+    if (finished &&
+        job->done.fetch_add(finished) + finished == chunk_count) {
+      std::unique_lock<std::mutex> lock(job->mutex);
+      job->condition.notify_all();
+    }
+  };
+
+  size_t helpers = std::min(chunk_count - 1, _threads.size());
+  for (size_t i = 0; i < helpers; i++) {
+    post(run);
+  }
+  run();
+  std::unique_lock<std::mutex> lock(job->mutex);
+  while (job->done.load() < chunk_count) {
+    job->condition.wait(lock);
+  }
+}
+
+ThreadPool &ThreadPool::instance() {
+  static ThreadPool *pool = new ThreadPool();
+  return *pool;
+}
+
+}  // namespace mittenwire
\ No newline at end of file
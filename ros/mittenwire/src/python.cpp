@@ -1,21 +1,34 @@
 // (c) 2023-2024 Philipp Ruppel
 
 #include <camera.hpp>
+#include <clocksync.hpp>
+#include <denoise.hpp>
 #include <messages.hpp>
+#include <imagebag.hpp>
 #include <imagepublisher.hpp>
+#include <isp.hpp>
 #include <master.hpp>
+#include <metrics.hpp>
+#include <mosaic.hpp>
+#include <parallel.hpp>
+#include <diagnostics.hpp>
 #include <packet.hpp>
+#include <queue.hpp>
+#include <recorder.hpp>
+#include <shfloat.hpp>
+#include <replay.hpp>
+#include <synchronizer.hpp>
+#include <tactile.hpp>
+#include <tactilepublisher.hpp>
 #include <hub.hpp>
 #include <log.hpp>
+#include <utils.hpp>
 
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/functional.h>
 
-#include <opencv2/imgproc.hpp>
-#include <opencv2/photo/cuda.hpp>
-
 namespace py = pybind11;
 
 namespace mittenwire {
@@ -72,12 +85,41 @@ void init_python(py::module &m) {
       .def(py::init<const std::shared_ptr<Context> &,
                     const std::vector<std::shared_ptr<Device>> &>());
 
+  py::class_<Transport, std::shared_ptr<Transport>>(m, "Transport")
+      .def("write_async", [](Transport *me, const std::string &data) {
+        me->write_async(data);
+      });
+
   py::class_<Writer>(m, "Writer")
-      .def(py::init<const std::shared_ptr<Device> &,
+      .def(py::init<const std::shared_ptr<Transport> &,
                     const std::function<std::string()> &, double>())
       .def("update", &Writer::update);
 
-  py::class_<Device, std::shared_ptr<Device>>(m, "Device")
+  py::class_<Capture, std::shared_ptr<Capture>>(m, "Capture")
+      .def_property_readonly("transfers_captured",
+                             &Capture::transfers_captured)
+      .def_property_readonly("transfers_dropped", &Capture::transfers_dropped)
+      .def_property_readonly("bytes_captured", &Capture::bytes_captured)
+      .def_property_readonly("segment_count", &Capture::segment_count)
+      .def_property_readonly("failed", &Capture::failed)
+      .def_property_readonly("error", &Capture::error);
+
+  py::enum_<ReplayPacing>(m, "ReplayPacing")
+      .value("AsFastAsPossible", ReplayPacing::AsFastAsPossible)
+      .value("RealTime", ReplayPacing::RealTime);
+
+  py::class_<ReplayDevice, std::shared_ptr<ReplayDevice>, Transport>(
+      m, "ReplayDevice")
+      .def(py::init<const std::string &, ReplayPacing, double, bool>(),
+           py::arg("path"), py::arg("pacing") = ReplayPacing::AsFastAsPossible,
+           py::arg("bytes_per_second") = 0.0, py::arg("loop") = false)
+      .def("finished", &ReplayDevice::finished)
+      .def("wait", &ReplayDevice::wait,
+           py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("bytes_read", &ReplayDevice::bytes_read)
+      .def_property_readonly("bytes_written", &ReplayDevice::bytes_written);
+
+  py::class_<Device, std::shared_ptr<Device>, Transport>(m, "Device")
       .def(py::init<>())
       .def("open_vid_pid", &Device::open_vid_pid)
       .def("close", &Device::close)
@@ -102,10 +144,59 @@ void init_python(py::module &m) {
       .def("test_read", [](Device *me) { return me->read().size(); })
       .def("write",
            [](Device *me, const std::string &data) { me->write(data); })
-      .def("write_async", &Device::write_async);
+      .def("write_async", [](Device *me, const std::string &data) {
+        me->write_async(data);
+      });
 }
 }  // namespace superspeed
 
+// One record per packet with channel, flags, size, host_timestamp and data,
+// the payloads zero-padded to the longest one in the batch.
+static py::array packet_records(const std::vector<Packet> &packets) {
+  size_t width = 8;
+  for (auto &packet : packets) {
+    width = std::max(width, (packet.data.size() + 7) / 8 * 8);
+  }
+  py::list fields;
+  fields.append(py::make_tuple("channel", "<u2"));
+  fields.append(py::make_tuple("flags", "<u2"));
+  fields.append(py::make_tuple("size", "<u4"));
+  fields.append(py::make_tuple("host_timestamp", "<u8"));
+  fields.append(py::make_tuple("data", "u1", py::make_tuple(width)));
+  size_t record_size = 16 + width;
+  py::array ret(py::dtype::from_args(fields),
+                std::vector<ssize_t>{(ssize_t)packets.size()});
+  uint8_t *dst = (uint8_t *)ret.mutable_data();
+  memset(dst, 0, packets.size() * record_size);
+  for (auto &packet : packets) {
+    uint32_t size = packet.data.size();
+    memcpy(dst + 0, &packet.channel, 2);
+    memcpy(dst + 2, &packet.flags, 2);
+    memcpy(dst + 4, &size, 4);
+    memcpy(dst + 8, &packet.host_timestamp, 8);
+    memcpy(dst + 16, packet.data.data(), size);
+    dst += record_size;
+  }
+  return ret;
+}
+
+template <class T>
+static py::array_t<T> tactile_view(const std::shared_ptr<TactileMatrix> &matrix,
+                                   const T *data) {
+  auto *ref = new std::shared_ptr<TactileMatrix>(matrix);
+  py::capsule owner(
+      ref, [](void *p) { delete (std::shared_ptr<TactileMatrix> *)p; });
+  py::array_t<T> ret({TactileMatrix::height, TactileMatrix::width},
+                     {TactileMatrix::width * sizeof(T), sizeof(T)}, data,
+                     owner);
+  ret.attr("flags").attr("writeable") = false;
+  return ret;
+}
+
+static double poll_timeout(const py::object &timeout) {
+  return timeout.is_none() ? -1.0 : timeout.cast<double>();
+}
+
 void init_python(py::module &m) {
   superspeed::init_python(m);
 
@@ -134,30 +225,196 @@ void init_python(py::module &m) {
 
   m.def("ros_spin", []() { ros::spin(); });
 
-  m.def("denoise", [](py::array_t<uint8_t> &img) {
-    auto proxy = img.mutable_unchecked();
-    cv::Mat mat(img.shape(0), img.shape(1), CV_8UC3,
-                (unsigned char *)proxy.data());
-    cv::cuda::fastNlMeansDenoisingColored(mat, mat, 2.0, 2.0);
-  });
+  // in-place filtering of a contiguous (height, width[, channels]) image, not
+  // converted since that would filter a copy
+  auto denoise_image = [](TemporalDenoiser &denoiser,
+                          py::array_t<uint8_t, py::array::c_style> &img) {
+    if (img.ndim() != 2 && img.ndim() != 3) {
+      throw std::runtime_error("image must have two or three dimensions");
+    }
+    size_t height = img.shape(0);
+    size_t width = img.shape(1);
+    size_t channels = (img.ndim() == 3) ? img.shape(2) : 1;
+    uint8_t *data = img.mutable_data();
+    py::gil_scoped_release release;
+    denoiser.process(data, width, height, channels, width * channels,
+                     &ThreadPool::instance());
+  };
+
+  py::class_<TemporalDenoiser, std::shared_ptr<TemporalDenoiser>>(m,
+                                                                  "Denoiser")
+      .def(py::init<float, float, float>(), py::arg("strength") = 0.8f,
+           py::arg("threshold") = 12.0f, py::arg("spatial") = 1.0f)
+      .def("process", denoise_image, py::arg("img").noconvert())
+      .def("reset", &TemporalDenoiser::reset);
+
+  // single frame, spatial filter only
+  m.def(
+      "denoise",
+      [denoise_image](py::array_t<uint8_t, py::array::c_style> &img,
+                      float threshold) {
+        TemporalDenoiser denoiser(0.0f, threshold);
+        denoise_image(denoiser, img);
+      },
+      py::arg("img").noconvert(), py::arg("threshold") = 12.0f);
+
+  py::class_<IspParams>(m, "IspParams")
+      .def(py::init<>())
+      .def_readwrite("black_level", &IspParams::black_level)
+      .def_readwrite("gain_red", &IspParams::gain_red)
+      .def_readwrite("gain_green", &IspParams::gain_green)
+      .def_readwrite("gain_blue", &IspParams::gain_blue)
+      .def_readwrite("hue", &IspParams::hue)
+      .def_readwrite("saturation", &IspParams::saturation)
+      .def_readwrite("brightness", &IspParams::brightness)
+      .def_readwrite("tone_mapping", &IspParams::tone_mapping)
+      .def_readwrite("srgb", &IspParams::srgb)
+      .def_readwrite("invert", &IspParams::invert);
+
+  // raw GRBG image to a new BGR image of the same size
+  m.def(
+      "isp",
+      [](py::array_t<uint8_t, py::array::c_style> bayer,
+         const IspParams &params) {
+        if (bayer.ndim() != 2) {
+          throw std::runtime_error("bayer image must have two dimensions");
+        }
+        size_t height = bayer.shape(0);
+        size_t width = bayer.shape(1);
+        py::array_t<uint8_t> ret({height, width, size_t(3)});
+        const uint8_t *src = bayer.data();
+        uint8_t *dst = ret.mutable_data();
+        {
+          py::gil_scoped_release release;
+          isp_process(src, width, width, height, dst, width * 3, params,
+                      &ThreadPool::instance());
+        }
+        return ret;
+      },
+      py::arg("bayer"), py::arg("params") = IspParams());
+
+  m.def(
+      "isp",
+      [](const std::shared_ptr<ImageMessage> &image, const IspParams &params) {
+        if (image->data.size() < image->width * image->height) {
+          throw std::runtime_error("image data smaller than its size");
+        }
+        py::array_t<uint8_t> ret({image->height, image->width, size_t(3)});
+        uint8_t *dst = ret.mutable_data();
+        {
+          py::gil_scoped_release release;
+          isp_process(image->data.data(), image->width, image->width,
+                      image->height, dst, image->width * 3, params,
+                      &ThreadPool::instance());
+        }
+        return ret;
+      },
+      py::arg("image"), py::arg("params") = IspParams());
+
+  py::class_<MosaicCell>(m, "MosaicCell")
+      .def_readonly("x", &MosaicCell::x)
+      .def_readonly("y", &MosaicCell::y)
+      .def_readonly("width", &MosaicCell::width)
+      .def_readonly("height", &MosaicCell::height);
+
+  py::class_<MosaicCompositor, std::shared_ptr<MosaicCompositor>>(
+      m, "MosaicCompositor")
+      .def(py::init<size_t, size_t, size_t>(), py::arg("cell_width") = 400,
+           py::arg("cell_height") = 300, py::arg("channels") = 3)
+      .def_property_readonly("channels", &MosaicCompositor::channels)
+      .def_property_readonly("cells", &MosaicCompositor::cells)
+      // draws into a preallocated (height, width, channels) array, which is
+      // not converted since that would draw into a copy
+      .def(
+          "render",
+          [](MosaicCompositor &compositor,
+             const std::vector<std::shared_ptr<ImageMessage>> &images,
+             py::array_t<uint8_t, py::array::c_style> &out,
+             const IspParams &params) {
+            if (out.ndim() != 3 || (size_t)out.shape(2) != compositor.channels()) {
+              throw std::runtime_error(
+                  "mosaic buffer must have shape (height, width, channels)");
+            }
+            size_t height = out.shape(0);
+            size_t width = out.shape(1);
+            size_t stride = out.strides(0);
+            uint8_t *data = out.mutable_data();
+            py::gil_scoped_release release;
+            compositor.render(images, data, width, height, stride, params,
+                              &ThreadPool::instance());
+          },
+          py::arg("images"), py::arg("out").noconvert(),
+          py::arg("params") = IspParams());
 
   py::class_<Packet>(m, "Packet")
       .def(py::init<>())
       .def_readonly("flags", &Packet::flags)
-      .def_property_readonly("data",
-                             [](const Packet *msg) {
-                               std::vector<uint8_t> ret;
-                               ret.resize(msg->data.size());
-                               memcpy(ret.data(), msg->data.data(),
-                                      msg->data.size());
-                               return ret;
-                             })
+      .def_property_readonly(
+          "data",
+          [](const Packet *msg) {
+            // read-only view that keeps the pooled payload alive
+            auto *ref = new PacketData(msg->data);
+            py::capsule owner(ref, [](void *p) { delete (PacketData *)p; });
+            py::array_t<uint8_t> ret({ref->size()}, {1}, ref->data(), owner);
+            ret.attr("flags").attr("writeable") = false;
+            return ret;
+          })
       .def_readonly("channel", &Packet::channel)
+      .def_readonly("host_timestamp", &Packet::host_timestamp)
       .def_property_readonly("str", &Packet::str);
 
+  py::class_<PacketPoolStats>(m, "PacketPoolStats")
+      .def_readonly("hits", &PacketPoolStats::hits)
+      .def_readonly("misses", &PacketPoolStats::misses)
+      .def_readonly("blocks_in_use", &PacketPoolStats::blocks_in_use)
+      .def_readonly("blocks_high_water", &PacketPoolStats::blocks_high_water)
+      .def_readonly("bytes_in_use", &PacketPoolStats::bytes_in_use)
+      .def_readonly("bytes_high_water", &PacketPoolStats::bytes_high_water)
+      .def_readonly("bytes_cached", &PacketPoolStats::bytes_cached);
+
+  m.def("packet_pool_stats", []() { return PacketPool::instance().stats(); });
+  m.def("packet_pool_trim", []() { PacketPool::instance().trim(); });
+
+  py::enum_<BackpressurePolicy>(m, "BackpressurePolicy")
+      .value("DropOldest", BackpressurePolicy::DropOldest)
+      .value("DropNewest", BackpressurePolicy::DropNewest)
+      .value("Block", BackpressurePolicy::Block);
+
+  m.def("monotonic_time_ns", &monotonic_time_ns);
+
+  py::class_<ClockSync, std::shared_ptr<ClockSync>>(m, "ClockSync")
+      .def(py::init<double, size_t>(), py::arg("bucket_seconds") = 1.0,
+           py::arg("bucket_count") = 60)
+      .def("add_sample", &ClockSync::add_sample)
+      .def("reset", &ClockSync::reset)
+      .def("to_host", &ClockSync::to_host)
+      .def("to_wall", &ClockSync::to_wall)
+      .def_property_readonly("valid", &ClockSync::valid)
+      .def_property_readonly("drift_ppm", &ClockSync::drift_ppm)
+      .def_property_readonly("sample_count", &ClockSync::sample_count)
+      .def_property_readonly("reset_count", &ClockSync::reset_count);
+
   py::class_<Master, std::shared_ptr<Master>>(m, "Master")
-      .def(py::init<const std::shared_ptr<superspeed::Device> &, size_t,
-                    size_t>());
+      .def(py::init<const std::shared_ptr<superspeed::Transport> &, size_t,
+                    size_t>())
+      .def(py::init<const std::shared_ptr<superspeed::Transport> &, size_t,
+                    size_t, size_t>())
+      .def("start_capture", &Master::start_capture, py::arg("prefix"),
+           py::arg("segment_size") = size_t(1024) * 1024 * 1024,
+           py::arg("max_segments") = 0)
+      .def("stop_capture", &Master::stop_capture,
+           py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("capture", &Master::capture)
+      .def_property("backpressure_policy", &Master::backpressure_policy,
+                    &Master::set_backpressure_policy)
+      .def_property_readonly("clock_sync", &Master::clock_sync)
+      .def("set_dispatch_threads", &Master::set_dispatch_threads,
+           py::call_guard<py::gil_scoped_release>())
+      .def("dispatch_threads", &Master::dispatch_threads)
+      .def_property_readonly("dropped_oldest_transfers",
+                             &Master::dropped_oldest_transfers)
+      .def_property_readonly("dropped_newest_transfers",
+                             &Master::dropped_newest_transfers);
 
   py::class_<Hub>(m, "Hub")
       .def(py::init<const std::shared_ptr<Master>>())
@@ -177,12 +434,253 @@ void init_python(py::module &m) {
         return std::make_shared<LambdaNode>(callback);
       }));
 
+  // pull interface, the receive path never waits for Python
+  py::class_<PacketQueue, std::shared_ptr<PacketQueue>, Node>(m, "PacketQueue")
+      .def(py::init<size_t, BackpressurePolicy>(),
+           py::arg("capacity") = 65536,
+           py::arg("policy") = BackpressurePolicy::DropOldest)
+      .def(
+          "poll",
+          [](PacketQueue &queue, size_t max_items, const py::object &timeout) {
+            std::vector<Packet> packets;
+            double t = poll_timeout(timeout);
+            {
+              py::gil_scoped_release release;
+              queue.queue().poll(packets, max_items, t);
+            }
+            return packet_records(packets);
+          },
+          py::arg("max_items") = 4096, py::arg("timeout") = py::none())
+      .def("fileno", [](PacketQueue &queue) { return queue.queue().fileno(); })
+      .def("close", [](PacketQueue &queue) { queue.queue().close(); })
+      .def_property_readonly("closed",
+                             [](PacketQueue &queue) {
+                               return queue.queue().closed();
+                             })
+      .def_property_readonly("size",
+                             [](PacketQueue &queue) {
+                               return queue.queue().size();
+                             })
+      .def_property_readonly("capacity",
+                             [](PacketQueue &queue) {
+                               return queue.queue().capacity();
+                             })
+      .def_property_readonly("dropped", [](PacketQueue &queue) {
+        return queue.queue().dropped();
+      });
+
+  py::class_<FrameQueue, std::shared_ptr<FrameQueue>>(m, "FrameQueue")
+      .def(py::init<size_t, BackpressurePolicy>(), py::arg("capacity") = 16,
+           py::arg("policy") = BackpressurePolicy::DropOldest)
+      .def("add", &FrameQueue::add, py::call_guard<py::gil_scoped_release>())
+      .def(
+          "poll",
+          [](FrameQueue &queue, size_t max_items, const py::object &timeout) {
+            std::vector<std::shared_ptr<ImageMessage>> frames;
+            double t = poll_timeout(timeout);
+            {
+              py::gil_scoped_release release;
+              queue.poll(frames, max_items, t);
+            }
+            return frames;
+          },
+          py::arg("max_items") = 64, py::arg("timeout") = py::none())
+      .def("fileno", &FrameQueue::fileno)
+      .def("close", &FrameQueue::close)
+      .def_property_readonly("closed", &FrameQueue::closed)
+      .def_property_readonly("size", &FrameQueue::size)
+      .def_property_readonly("capacity", &FrameQueue::capacity)
+      .def_property_readonly("dropped", &FrameQueue::dropped);
+
+  py::class_<MessageQueue, std::shared_ptr<MessageQueue>>(m, "MessageQueue")
+      .def(py::init<size_t, BackpressurePolicy>(), py::arg("capacity") = 1024,
+           py::arg("policy") = BackpressurePolicy::DropOldest)
+      .def(
+          "poll",
+          [](MessageQueue &queue, size_t max_items, const py::object &timeout) {
+            std::vector<std::shared_ptr<Message>> messages;
+            double t = poll_timeout(timeout);
+            {
+              py::gil_scoped_release release;
+              queue.poll(messages, max_items, t);
+            }
+            return messages;
+          },
+          py::arg("max_items") = 256, py::arg("timeout") = py::none())
+      .def("fileno", &MessageQueue::fileno)
+      .def("close", &MessageQueue::close)
+      .def_property_readonly("closed", &MessageQueue::closed)
+      .def_property_readonly("size", &MessageQueue::size)
+      .def_property_readonly("capacity", &MessageQueue::capacity)
+      .def_property_readonly("dropped", &MessageQueue::dropped);
+
+  py::class_<Recorder, std::shared_ptr<Recorder>>(m, "Recorder")
+      .def(py::init<size_t, size_t>(),
+           py::arg("max_backlog_bytes") = size_t(1) << 30,
+           py::arg("chunk_size") = 4 << 20)
+      .def("start", &Recorder::start, py::arg("path"),
+           py::call_guard<py::gil_scoped_release>())
+      .def("stop", &Recorder::stop, py::call_guard<py::gil_scoped_release>())
+      .def("add", &Recorder::add, py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("recording", &Recorder::recording)
+      .def_property_readonly("path", &Recorder::path)
+      .def_property_readonly("backlog", &Recorder::backlog)
+      .def_property_readonly("backlog_bytes", &Recorder::backlog_bytes)
+      .def_property_readonly("messages", &Recorder::messages)
+      .def_property_readonly("dropped", &Recorder::dropped)
+      .def_property_readonly("incomplete", &Recorder::incomplete)
+      .def_property("min_frame_completeness",
+                    &Recorder::min_frame_completeness,
+                    &Recorder::set_min_frame_completeness)
+      .def_property_readonly("bytes_written", &Recorder::bytes_written);
+
+  py::class_<BagTime>(m, "BagTime")
+      .def(py::init<>())
+      .def(py::init<uint32_t, uint32_t>(), py::arg("sec"), py::arg("nsec"))
+      .def(py::init<double>(), py::arg("seconds"))
+      .def_readwrite("sec", &BagTime::sec)
+      .def_readwrite("nsec", &BagTime::nsec)
+      .def("to_sec", &BagTime::seconds);
+  py::implicitly_convertible<double, BagTime>();
+
+  py::class_<BagImage, std::shared_ptr<BagImage>>(m, "BagImage")
+      .def_readonly("name", &BagImage::name)
+      .def_readonly("time", &BagImage::time)
+      .def_readonly("stamp", &BagImage::stamp)
+      .def_readonly("image_type", &BagImage::image_type)
+      .def_property_readonly("image_data",
+                             [](const BagImage &image) {
+                               return py::bytes(
+                                   (const char *)image.image_data.data(),
+                                   image.image_data.size());
+                             })
+      .def_property_readonly("info_data",
+                             [](const BagImage &image) {
+                               return py::bytes(
+                                   (const char *)image.info_data.data(),
+                                   image.info_data.size());
+                             })
+      .def_property_readonly(
+          "pixels", [](const std::shared_ptr<BagImage> &thiz) -> py::object {
+            if (thiz->pixels.empty()) {
+              return py::none();
+            }
+            // read-only BGR view that keeps the decoded image alive
+            auto *ref = new std::shared_ptr<BagImage>(thiz);
+            py::capsule owner(
+                ref, [](void *p) { delete (std::shared_ptr<BagImage> *)p; });
+            py::array_t<uint8_t> ret({thiz->height, thiz->width, size_t(3)},
+                                     {thiz->width * 3, size_t(3), size_t(1)},
+                                     thiz->pixels.data(), owner);
+            ret.attr("flags").attr("writeable") = false;
+            return ret;
+          });
+
+  py::class_<BagImageSet, std::shared_ptr<BagImageSet>>(m, "BagImageSet")
+      .def_readonly("time", &BagImageSet::time)
+      .def_readonly("images", &BagImageSet::images);
+
+  py::class_<ImageBagReader, std::shared_ptr<ImageBagReader>>(
+      m, "ImageBagReader")
+      .def(py::init<const std::string &, size_t, size_t, bool>(),
+           py::arg("path"), py::arg("prefetch") = 4,
+           py::arg("thread_count") = 0, py::arg("decode") = true,
+           py::call_guard<py::gil_scoped_release>())
+      .def("__len__", &ImageBagReader::size)
+      .def("time", &ImageBagReader::time, py::arg("index"))
+      .def_property_readonly("start_time",
+                             [](const ImageBagReader &reader) {
+                               return reader.bag().start_time();
+                             })
+      .def_property_readonly("end_time",
+                             [](const ImageBagReader &reader) {
+                               return reader.bag().end_time();
+                             })
+      .def_property("position", &ImageBagReader::position,
+                    &ImageBagReader::set_position)
+      .def_property("stride", &ImageBagReader::stride,
+                    &ImageBagReader::set_stride)
+      .def_property(
+          "isp_params",
+          [](const ImageBagReader &reader) { return reader.isp_params(); },
+          &ImageBagReader::set_isp_params)
+      .def("seek", &ImageBagReader::seek, py::arg("time"))
+      .def("next", &ImageBagReader::next,
+           py::call_guard<py::gil_scoped_release>())
+      .def(
+          "messages",
+          [](const ImageBagReader &reader, const std::string &topic,
+             const BagTime &begin, const BagTime &end) {
+            std::vector<std::pair<BagTime, std::vector<uint8_t>>> messages;
+            {
+              py::gil_scoped_release release;
+              messages = reader.messages(topic, begin, end);
+            }
+            py::list ret;
+            for (auto &message : messages) {
+              ret.append(py::make_tuple(
+                  message.first,
+                  py::bytes((const char *)message.second.data(),
+                            message.second.size())));
+            }
+            return ret;
+          },
+          py::arg("topic"), py::arg("begin"), py::arg("end"));
+
+  py::enum_<FillPolicy>(m, "FillPolicy")
+      .value("Gray", FillPolicy::Gray)
+      .value("PreviousFrame", FillPolicy::PreviousFrame)
+      .value("Interpolate", FillPolicy::Interpolate);
+
   py::class_<Camera, std::shared_ptr<Camera>, Node>(m, "Camera")
-      .def(py::init<const std::function<void(const ImageMessage &)> &>());
+      .def(py::init<const std::function<void(
+                        const std::shared_ptr<ImageMessage> &)> &,
+                    size_t>(),
+           py::arg("callback"), py::arg("pool_depth") = 4)
+      // frames go straight to the synchronizer without entering Python
+      .def(py::init([](const std::shared_ptr<FrameSynchronizer> &sync,
+                       size_t pool_depth) {
+             return std::make_shared<Camera>(
+                 [sync](const std::shared_ptr<ImageMessage> &frame) {
+                   sync->add(frame);
+                 },
+                 pool_depth);
+           }),
+           py::arg("synchronizer"), py::arg("pool_depth") = 4)
+      .def(py::init([](const std::shared_ptr<FrameQueue> &queue,
+                       size_t pool_depth,
+                       const std::shared_ptr<Recorder> &recorder) {
+             return std::make_shared<Camera>(
+                 [queue, recorder](const std::shared_ptr<ImageMessage> &frame) {
+                   queue->add(frame);
+                   if (recorder) {
+                     recorder->add(frame);
+                   }
+                 },
+                 pool_depth);
+           }),
+           py::arg("queue"), py::arg("pool_depth") = 4,
+           py::arg("recorder") = std::shared_ptr<Recorder>())
+      .def("set_clock_sync", &Camera::set_clock_sync)
+      .def("set_slice_callback", &Camera::set_slice_callback, py::arg("rows"),
+           py::arg("callback"))
+      .def_property("fill_policy", &Camera::get_fill_policy,
+                    &Camera::set_fill_policy)
+      .def_property(
+          "pool_depth",
+          [](const Camera &cam) { return cam.frame_pool()->depth(); },
+          [](const Camera &cam, size_t depth) {
+            cam.frame_pool()->set_depth(depth);
+          })
+      .def_property_readonly("frame_allocations", [](const Camera &cam) {
+        return cam.frame_pool()->allocations();
+      });
 
-  py::class_<Message>(m, "Message").def_readonly("channel", &Message::channel);
+  py::class_<Message, std::shared_ptr<Message>>(m, "Message")
+      .def_readonly("channel", &Message::channel);
 
-  py::class_<ImageMessage, Message>(m, "ImageMessage")
+  py::class_<ImageMessage, std::shared_ptr<ImageMessage>, Message>(
+      m, "ImageMessage")
       .def(py::init<>())
       .def_readonly("left", &ImageMessage::left)
       .def_readonly("top", &ImageMessage::top)
@@ -192,19 +690,238 @@ void init_python(py::module &m) {
       .def_readonly("valid", &ImageMessage::valid)
       .def_readonly("skip", &ImageMessage::skip)
       .def_readonly("request_timestamp", &ImageMessage::request_timestamp)
-      .def_property_readonly("data", [](const ImageMessage *thiz) {
-        auto arr = py::array_t<uint8_t>({thiz->height, thiz->width});
-        auto proxy = arr.mutable_unchecked();
-        for (size_t y = 0; y < thiz->height; y++) {
-          memcpy(proxy.mutable_data(y, 0), thiz->data.data() + y * thiz->width,
-                 thiz->width);
-        }
-        return arr;
+      .def_readonly("frame_id", &ImageMessage::frame_id)
+      .def_readonly("packets_expected", &ImageMessage::packets_expected)
+      .def_readonly("packets_received", &ImageMessage::packets_received)
+      .def_property_readonly("completeness", &ImageMessage::completeness)
+      .def_property_readonly(
+          "row_valid",
+          [](const std::shared_ptr<ImageMessage> &thiz) {
+            auto *ref = new std::shared_ptr<ImageMessage>(thiz);
+            py::capsule owner(ref, [](void *p) {
+              delete (std::shared_ptr<ImageMessage> *)p;
+            });
+            py::array_t<bool> ret({thiz->row_valid.size()}, {1},
+                                  (const bool *)thiz->row_valid.data(), owner);
+            ret.attr("flags").attr("writeable") = false;
+            return ret;
+          })
+      .def_readonly("host_start_timestamp",
+                    &ImageMessage::host_start_timestamp)
+      .def_readonly("host_timestamp", &ImageMessage::host_timestamp)
+      .def_readonly("trigger_host_timestamp",
+                    &ImageMessage::trigger_host_timestamp)
+      .def_readonly("stamp", &ImageMessage::stamp)
+      .def_property_readonly(
+          "data", [](const std::shared_ptr<ImageMessage> &thiz) {
+            // read-only view that keeps the frame out of the pool while alive
+            auto *ref = new std::shared_ptr<ImageMessage>(thiz);
+            py::capsule owner(ref, [](void *p) {
+              delete (std::shared_ptr<ImageMessage> *)p;
+            });
+            py::array_t<uint8_t> ret({thiz->height, thiz->width},
+                                     {thiz->width, size_t(1)},
+                                     thiz->data.data(), owner);
+            ret.attr("flags").attr("writeable") = false;
+            return ret;
+          });
+
+  py::class_<ImageSlice>(m, "ImageSlice")
+      .def_readonly("frame", &ImageSlice::frame)
+      .def_readonly("frame_id", &ImageSlice::frame_id)
+      .def_readonly("row_begin", &ImageSlice::row_begin)
+      .def_readonly("row_end", &ImageSlice::row_end)
+      .def_readonly("valid", &ImageSlice::valid)
+      .def_property_readonly("data", [](const ImageSlice &slice) {
+        // read-only view of the rows of the slice
+        auto &frame = slice.frame;
+        auto *ref = new std::shared_ptr<ImageMessage>(frame);
+        py::capsule owner(
+            ref, [](void *p) { delete (std::shared_ptr<ImageMessage> *)p; });
+        py::array_t<uint8_t> ret(
+            {slice.row_end - slice.row_begin, frame->width},
+            {frame->width, size_t(1)},
+            frame->data.data() + slice.row_begin * frame->width, owner);
+        ret.attr("flags").attr("writeable") = false;
+        return ret;
       });
 
+  py::class_<FrameSet, std::shared_ptr<FrameSet>>(m, "FrameSet")
+      .def_readonly("request_timestamp", &FrameSet::request_timestamp)
+      .def_readonly("channels", &FrameSet::channels)
+      .def_readonly("frames", &FrameSet::frames)
+      .def_readonly("first_host_timestamp", &FrameSet::first_host_timestamp)
+      .def_readonly("last_host_timestamp", &FrameSet::last_host_timestamp)
+      .def_property_readonly("complete", &FrameSet::complete)
+      .def_property_readonly("missing_channels", &FrameSet::missing_channels);
+
+  py::class_<FrameSynchronizer, std::shared_ptr<FrameSynchronizer>>(
+      m, "FrameSynchronizer")
+      .def(py::init([](const std::vector<size_t> &channels,
+                       const std::function<void(
+                           const std::shared_ptr<FrameSet> &)> &callback,
+                       double timeout, size_t max_pending) {
+             // joining the delivery thread while it waits for the GIL in the
+             // callback would deadlock
+             return std::shared_ptr<FrameSynchronizer>(
+                 new FrameSynchronizer(channels, callback, timeout,
+                                       max_pending),
+                 [](FrameSynchronizer *sync) {
+                   if (PyGILState_Check()) {
+                     py::gil_scoped_release release;
+                     delete sync;
+                   } else {
+                     delete sync;
+                   }
+                 });
+           }),
+           py::arg("channels"), py::arg("callback"), py::arg("timeout") = 0.1,
+           py::arg("max_pending") = 8)
+      .def("add", &FrameSynchronizer::add,
+           py::call_guard<py::gil_scoped_release>())
+      .def_property_readonly("channels", &FrameSynchronizer::channels);
+
   py::class_<ros::NodeHandle>(m, "NodeHandle")
       .def(py::init([](const std::string &ns) { return ros::NodeHandle(ns); }));
 
+  py::class_<TactileMatrix, std::shared_ptr<TactileMatrix>, Message>(
+      m, "TactileMatrix")
+      .def_readonly("timestamp", &TactileMatrix::timestamp)
+      .def_readonly("host_timestamp", &TactileMatrix::host_timestamp)
+      .def_readonly("stamp", &TactileMatrix::stamp)
+      .def_readonly("chunks_received", &TactileMatrix::chunks_received)
+      .def_property_readonly("complete", &TactileMatrix::complete)
+      .def_property_readonly("width",
+                             [](const TactileMatrix &) {
+                               return TactileMatrix::width;
+                             })
+      .def_property_readonly("height",
+                             [](const TactileMatrix &) {
+                               return TactileMatrix::height;
+                             })
+      // read-only (height, width) views that keep the matrix alive
+      .def_property_readonly("inphase",
+                             [](const std::shared_ptr<TactileMatrix> &thiz) {
+                               return tactile_view(thiz, thiz->inphase);
+                             })
+      .def_property_readonly("quadrature",
+                             [](const std::shared_ptr<TactileMatrix> &thiz) {
+                               return tactile_view(thiz, thiz->quadrature);
+                             })
+      .def_property_readonly("validity",
+                             [](const std::shared_ptr<TactileMatrix> &thiz) {
+                               return tactile_view(
+                                   thiz, (const bool *)thiz->validity);
+                             });
+
+  py::class_<TactileStatus, std::shared_ptr<TactileStatus>, Message>(
+      m, "TactileStatus")
+      .def_readonly("timestamp", &TactileStatus::timestamp)
+      .def_readonly("host_timestamp", &TactileStatus::host_timestamp)
+      .def_readonly("stamp", &TactileStatus::stamp)
+      .def_readonly("clock_milliseconds", &TactileStatus::clock_milliseconds)
+      .def_readonly("core_temperature", &TactileStatus::core_temperature)
+      .def_readonly("button_pressed", &TactileStatus::button_pressed)
+      .def_readonly("battery_disconnect", &TactileStatus::battery_disconnect)
+      .def_readonly("battery_charging", &TactileStatus::battery_charging)
+      .def_readonly("usb_power_present", &TactileStatus::usb_power_present)
+      .def_readonly("battery_voltage", &TactileStatus::battery_voltage)
+      .def_readonly("battery_current", &TactileStatus::battery_current)
+      .def_readonly("imu_temperature", &TactileStatus::imu_temperature)
+      .def_property_readonly("imu_linear_acceleration",
+                             [](const TactileStatus &s) {
+                               auto &v = s.imu_linear_acceleration;
+                               return py::make_tuple(v[0], v[1], v[2]);
+                             })
+      .def_property_readonly("imu_angular_velocity",
+                             [](const TactileStatus &s) {
+                               auto &v = s.imu_angular_velocity;
+                               return py::make_tuple(v[0], v[1], v[2]);
+                             });
+
+  py::class_<TactilePublisher, std::shared_ptr<TactilePublisher>>(
+      m, "TactilePublisher")
+      .def(py::init<ros::NodeHandle &, const std::string &,
+                    const std::string &>(),
+           py::arg("node_handle"), py::arg("matrix_topic") = "impedance_matrix",
+           py::arg("status_topic") = "glove_status");
+
+  py::class_<Tactile, std::shared_ptr<Tactile>, Node>(m, "Tactile")
+      .def(py::init<const std::function<void(
+                        const std::shared_ptr<TactileMatrix> &)> &,
+                    const std::function<void(
+                        const std::shared_ptr<TactileStatus> &)> &>(),
+           py::arg("matrix_callback"), py::arg("status_callback"))
+      // matrices and status go to a queue or to ROS without entering Python
+      .def(py::init([](const std::shared_ptr<MessageQueue> &queue,
+                       const std::shared_ptr<Recorder> &recorder) {
+             return std::make_shared<Tactile>(
+                 [queue,
+                  recorder](const std::shared_ptr<TactileMatrix> &matrix) {
+                   queue->add(matrix);
+                   if (recorder) {
+                     recorder->add(matrix);
+                   }
+                 },
+                 [queue,
+                  recorder](const std::shared_ptr<TactileStatus> &status) {
+                   queue->add(status);
+                   if (recorder) {
+                     recorder->add(status);
+                   }
+                 });
+           }),
+           py::arg("queue"), py::arg("recorder") = std::shared_ptr<Recorder>())
+      .def(py::init([](const std::shared_ptr<TactilePublisher> &publisher) {
+             return std::make_shared<Tactile>(
+                 [publisher](const std::shared_ptr<TactileMatrix> &matrix) {
+                   publisher->publish(*matrix);
+                 },
+                 [publisher](const std::shared_ptr<TactileStatus> &status) {
+                   publisher->publish(*status);
+                 });
+           }),
+           py::arg("publisher"))
+      .def("set_clock_sync", &Tactile::set_clock_sync);
+
+  py::enum_<LogLevel>(m, "LogLevel")
+      .value("Debug", LogLevel::Debug)
+      .value("Info", LogLevel::Info)
+      .value("Error", LogLevel::Error)
+      .value("Off", LogLevel::Off);
+
+  m.def("set_log_level", &Logger::set_level);
+  m.def("log_level", &Logger::level);
+  m.def("set_log_rate_limit", &Logger::set_rate_limit);
+  m.def("log_flush", &Logger::flush, py::call_guard<py::gil_scoped_release>());
+
+  m.def("metrics", []() {
+    py::dict ret;
+    for (auto &sample : MetricsRegistry::instance().snapshot()) {
+      if (sample.type == MetricType::Histogram) {
+        auto &h = sample.histogram;
+        py::dict d;
+        d["count"] = h.count;
+        d["sum"] = h.sum;
+        d["max"] = h.max;
+        d["mean"] = h.mean();
+        d["p50"] = h.quantile(0.5);
+        d["p99"] = h.quantile(0.99);
+        d["buckets"] = h.buckets;
+        ret[py::str(sample.name)] = d;
+      } else {
+        ret[py::str(sample.name)] = sample.value;
+      }
+    }
+    return ret;
+  });
+
+  py::class_<DiagnosticsPublisher, std::shared_ptr<DiagnosticsPublisher>>(
+      m, "DiagnosticsPublisher")
+      .def(py::init<ros::NodeHandle &, const std::string &, double>(),
+           py::arg("node_handle"), py::arg("topic") = "/diagnostics",
+           py::arg("interval") = 1.0);
+
 #define PYFIELDSTR(name) #name
 
 #define PYFIELD(type, name)                                   \
@@ -262,23 +979,60 @@ void init_python(py::module &m) {
 
       ;
 
-  m.def("pack_sample", [](int32_t i, int32_t q) {
-    uint32_t exp = 0;
-    while ((((i & 0xC0000000) == 0xC0000000) || ((i & 0xC0000000) == 0)) &&
-           (((q & 0xC0000000) == 0xC0000000) || ((q & 0xC0000000) == 0))) {
-      i <<= 1;
-      q <<= 1;
-      exp++;
-    }
-    return exp | (uint32_t(i & 0xfff00000)) | (uint32_t(q & 0xfff00000) >> 12);
-  });
+  m.def("pack_sample", [](int32_t i, int32_t q) { return shfloat_pack(i, q); });
 
   m.def("unpack_sample", [](uint32_t v) {
-    uint32_t exp = (v & 0xff);
-    int32_t i = (v & 0xfff00000);
-    int32_t q = ((v << 12) & 0xfff00000);
-    return std::make_pair(i >> exp, q >> exp);
+    int32_t i, q;
+    shfloat_unpack(v, i, q);
+    return std::make_pair(i, q);
   });
+
+  // batch versions over arrays of any shape, e.g. all chunk words of a bag
+  m.def(
+      "pack_samples",
+      [](py::array_t<int32_t, py::array::c_style | py::array::forcecast>
+             inphase,
+         py::array_t<int32_t, py::array::c_style | py::array::forcecast>
+             quadrature) {
+        if (inphase.ndim() != quadrature.ndim() ||
+            !std::equal(inphase.shape(), inphase.shape() + inphase.ndim(),
+                        quadrature.shape())) {
+          throw std::runtime_error(
+              "inphase and quadrature must have the same shape");
+        }
+        py::array_t<uint32_t> ret(std::vector<size_t>(
+            inphase.shape(), inphase.shape() + inphase.ndim()));
+        const int32_t *i = inphase.data();
+        const int32_t *q = quadrature.data();
+        uint32_t *dst = ret.mutable_data();
+        size_t count = inphase.size();
+        {
+          py::gil_scoped_release release;
+          shfloat_pack(i, q, dst, count);
+        }
+        return ret;
+      },
+      py::arg("inphase"), py::arg("quadrature"));
+
+  m.def(
+      "unpack_samples",
+      [](py::array_t<uint32_t, py::array::c_style | py::array::forcecast>
+             packed) {
+        std::vector<size_t> shape(packed.shape(),
+                                  packed.shape() + packed.ndim());
+        py::array_t<int32_t> inphase(shape);
+        py::array_t<int32_t> quadrature(shape);
+        const uint32_t *src = packed.data();
+        int32_t *i = inphase.mutable_data();
+        int32_t *q = quadrature.mutable_data();
+        size_t count = packed.size();
+        {
+          py::gil_scoped_release release;
+          shfloat_unpack(src, i, q, count);
+        }
+        return py::make_tuple(inphase, quadrature);
+      },
+      py::arg("packed"));
 }
 
 }  // namespace mittenwire
@@ -0,0 +1,16 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <queue.hpp>
+
+namespace mittenwire {
+
+PacketQueue::PacketQueue(size_t capacity, BackpressurePolicy policy)
+    : _queue(capacity, policy) {}
+
+void PacketQueue::process(const Packet &packet) { _queue.push(packet); }
+
+void PacketQueue::process_batch(const PacketSpan &packets) {
+  _queue.push(packets.begin(), packets.end());
+}
+
+}  // namespace mittenwire
\ No newline at end of file
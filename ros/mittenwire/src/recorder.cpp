@@ -0,0 +1,307 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <recorder.hpp>
+
+#include <camera.hpp>
+#include <log.hpp>
+#include <tactile.hpp>
+#include <tactilepublisher.hpp>
+#include <utils.hpp>
+
+#include <ros/serialization.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/Image.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace mittenwire {
+
+// full sensor resolution, camera_info describes frames as binned regions of it
+static constexpr uint32_t recorder_sensor_width = 2592;
+static constexpr uint32_t recorder_sensor_height = 1944;
+// backlog accounted for messages without pixel data
+static constexpr size_t recorder_message_size = 4096;
+// triggers whose bag time is remembered, enough for frames of all cameras
+// to arrive
+static constexpr size_t recorder_trigger_count = 64;
+
+static size_t recorder_payload_size(const Message &message) {
+  if (auto *image = dynamic_cast<const ImageMessage *>(&message)) {
+    return image->width * image->height;
+  }
+  return recorder_message_size;
+}
+
+// clock sync time, or the current time without clock sync
+static BagTime recorder_time(double stamp) {
+  if (stamp > 0) {
+    return BagTime(stamp);
+  }
+  return BagTime(std::chrono::duration<double>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count());
+}
+
+template <class T>
+static void write_ros_message(BagWriter &bag, uint32_t connection,
+                              const BagTime &time, const T &msg) {
+  uint32_t size = ros::serialization::serializationLength(msg);
+  ros::serialization::OStream stream(bag.add_message(connection, time, size),
+                                     size);
+  ros::serialization::serialize(stream, msg);
+}
+
+Recorder::Recorder(size_t max_backlog_bytes, size_t chunk_size)
+    : _max_backlog_bytes(max_backlog_bytes), _chunk_size(chunk_size) {
+  auto &registry = MetricsRegistry::instance();
+  _messages_metric = registry.counter("recorder.messages");
+  _dropped_metric = registry.counter("recorder.dropped_messages");
+  _backlog_metric = registry.gauge("recorder.backlog_bytes");
+  _write_latency_us = registry.histogram("recorder.write_latency_us");
+}
+
+Recorder::~Recorder() { stop(); }
+
+void Recorder::start(const std::string &path) {
+  if (_recording) {
+    throw std::runtime_error("already recording to " + this->path());
+  }
+  // a recording that ended on a write error still has to be joined
+  stop();
+  std::unique_ptr<BagWriter> bag(new BagWriter(path, _chunk_size));
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _path = path;
+    _stop = false;
+    _messages = 0;
+    _dropped = 0;
+    _incomplete = 0;
+    _bytes_written = bag->bytes_written();
+    _connections.clear();
+    _trigger_times.clear();
+    _triggers.clear();
+    _recording = true;
+  }
+  MTW_LOG_INFO("recording to " << path);
+  _thread = std::thread([this, bag = std::move(bag)]() mutable {
+    run(std::move(bag));
+  });
+}
+
+void Recorder::stop() {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _recording = false;
+    _stop = true;
+    _condition.notify_all();
+  }
+  if (_thread.joinable()) {
+    _thread.join();
+    MTW_LOG_INFO("recorded " << _messages << " messages to " << path() << ", "
+                             << _dropped << " dropped");
+  }
+}
+
+void Recorder::add(const std::shared_ptr<Message> &message) {
+  if (!_recording.load(std::memory_order_relaxed)) {
+    return;
+  }
+  if (auto *image = dynamic_cast<const ImageMessage *>(message.get())) {
+    if (!image->valid &&
+        image->completeness() < _min_frame_completeness.load()) {
+      _incomplete++;
+      return;
+    }
+  }
+  size_t size = recorder_payload_size(*message);
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_recording) {
+      return;
+    }
+    if (_backlog_bytes + size <= _max_backlog_bytes) {
+      _queue.push_back(message);
+      _backlog_bytes += size;
+      _backlog_metric->set(_backlog_bytes);
+      _condition.notify_one();
+      return;
+    }
+  }
+  _dropped++;
+  _dropped_metric->add();
+  MTW_LOG_ERROR("recorder backlog full, message not recorded");
+}
+
+std::string Recorder::path() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _path;
+}
+
+size_t Recorder::backlog() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _queue.size();
+}
+
+size_t Recorder::backlog_bytes() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _backlog_bytes;
+}
+
+template <class T>
+uint32_t Recorder::connection(BagWriter &bag, const std::string &topic) {
+  auto it = _connections.find(topic);
+  if (it != _connections.end()) {
+    return it->second;
+  }
+  uint32_t id = bag.add_connection(topic, ros::message_traits::datatype<T>(),
+                                   ros::message_traits::md5sum<T>(),
+                                   ros::message_traits::definition<T>());
+  _connections[topic] = id;
+  return id;
+}
+
+BagTime Recorder::trigger_time(uint32_t request_timestamp, double stamp) {
+  auto it = _trigger_times.find(request_timestamp);
+  if (it != _trigger_times.end()) {
+    return it->second;
+  }
+  BagTime time = recorder_time(stamp);
+  _trigger_times[request_timestamp] = time;
+  _triggers.push_back(request_timestamp);
+  if (_triggers.size() > recorder_trigger_count) {
+    _trigger_times.erase(_triggers.front());
+    _triggers.pop_front();
+  }
+  return time;
+}
+
+void Recorder::write(BagWriter &bag, const Message &message) {
+  if (auto *image = dynamic_cast<const ImageMessage *>(&message)) {
+    BagTime time = trigger_time(image->request_timestamp, image->stamp);
+    std::string prefix = "/cam" + std::to_string(image->channel);
+    std_msgs::Header header;
+    header.stamp = ros::Time(time.sec, time.nsec);
+
+    // sensor_msgs/Image by hand, so the pixels are copied once, straight
+    // into the chunk
+    uint32_t width = image->width;
+    uint32_t height = image->height;
+    uint32_t data_size = width * height;
+    if (image->data.size() < data_size) {
+      throw std::runtime_error("image smaller than its size");
+    }
+    std::string encoding = "bayer_grbg8";
+    uint8_t is_bigendian = 0;
+    uint32_t size = ros::serialization::serializationLength(header) + 4 + 4 +
+                    ros::serialization::serializationLength(encoding) + 1 +
+                    4 + 4 + data_size;
+    ros::serialization::OStream stream(
+        bag.add_message(
+            connection<sensor_msgs::Image>(bag, prefix + "/image_raw"), time,
+            size),
+        size);
+    stream.next(header);
+    stream.next(height);
+    stream.next(width);
+    stream.next(encoding);
+    stream.next(is_bigendian);
+    // step
+    stream.next(width);
+    stream.next(data_size);
+    memcpy(stream.advance(data_size), image->data.data(), data_size);
+
+    sensor_msgs::CameraInfo info;
+    info.header = header;
+    info.width = recorder_sensor_width;
+    info.height = recorder_sensor_height;
+    info.binning_x = image->skip;
+    info.binning_y = image->skip;
+    info.roi.x_offset = image->left;
+    info.roi.y_offset = image->top;
+    info.roi.width = image->width * image->skip;
+    info.roi.height = image->height * image->skip;
+    write_ros_message(
+        bag, connection<sensor_msgs::CameraInfo>(bag, prefix + "/camera_info"),
+        time, info);
+    return;
+  }
+
+  if (auto *matrix = dynamic_cast<const TactileMatrix *>(&message)) {
+    BagTime time = recorder_time(matrix->stamp);
+    mittenwire::ImpedanceMatrix msg;
+    tactile_to_ros(*matrix, msg);
+    msg.header.stamp = ros::Time(time.sec, time.nsec);
+    write_ros_message(
+        bag, connection<mittenwire::ImpedanceMatrix>(bag, "/impedance_matrix"),
+        time, msg);
+    return;
+  }
+
+  if (auto *status = dynamic_cast<const TactileStatus *>(&message)) {
+    BagTime time = recorder_time(status->stamp);
+    mittenwire::GloveStatus msg;
+    tactile_to_ros(*status, msg);
+    msg.header.stamp = ros::Time(time.sec, time.nsec);
+    write_ros_message(
+        bag, connection<mittenwire::GloveStatus>(bag, "/glove_status"), time,
+        msg);
+    return;
+  }
+
+  MTW_LOG_ERROR("recorder got a message it cannot record");
+}
+
+void Recorder::run(std::unique_ptr<BagWriter> bag) {
+  set_current_thread_name("recorder");
+  std::deque<std::shared_ptr<Message>> batch;
+  bool failed = false;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (_queue.empty() && !_stop) {
+        _condition.wait(lock);
+      }
+      if (_queue.empty()) {
+        break;
+      }
+      batch.swap(_queue);
+    }
+    for (auto &message : batch) {
+      size_t size = recorder_payload_size(*message);
+      if (!failed) {
+        auto start = std::chrono::steady_clock::now();
+        try {
+          write(*bag, *message);
+          _messages++;
+          _messages_metric->add();
+        } catch (std::exception &e) {
+          MTW_LOG_ERROR("recording to " << bag->path()
+                                        << " failed: " << e.what());
+          failed = true;
+          _recording = false;
+        }
+        _write_latency_us->record_us(std::chrono::steady_clock::now() -
+                                     start);
+        _bytes_written = bag->bytes_written();
+      }
+      // frames go back to their pool as soon as they are in the chunk
+      message.reset();
+      std::unique_lock<std::mutex> lock(_mutex);
+      _backlog_bytes -= size;
+      _backlog_metric->set(_backlog_bytes);
+    }
+    batch.clear();
+  }
+  try {
+    bag->close();
+  } catch (std::exception &e) {
+    MTW_LOG_ERROR("failed to close bag " << bag->path() << ": " << e.what());
+  }
+  _bytes_written = bag->bytes_written();
+}
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,313 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <replay.hpp>
+
+#include <capture.hpp>
+#include <log.hpp>
+#include <utils.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace mittenwire {
+namespace superspeed {
+
+static int open_replay_source(const std::string &path) {
+  static const std::string unix_prefix = "unix:";
+  if (path == "-") {
+    return dup(STDIN_FILENO);
+  }
+  if (path.compare(0, unix_prefix.size(), unix_prefix) == 0) {
+    std::string socket_path = path.substr(unix_prefix.size());
+    sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+      throw std::runtime_error("replay socket path too long");
+    }
+    strncpy(address.sun_path, socket_path.c_str(),
+            sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      throw std::runtime_error("failed to create replay socket");
+    }
+    if (connect(fd, (const sockaddr *)&address, sizeof(address)) != 0) {
+      close(fd);
+      throw std::runtime_error("failed to connect replay socket " +
+                               socket_path);
+    }
+    return fd;
+  }
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("failed to open replay source " + path);
+  }
+  return fd;
+}
+
+// Capture segments (<name>.raw) come with an index of the original transfers
+// (<name>.idx), which is used to reproduce transfer boundaries and timing.
+static std::vector<CaptureIndexEntry> load_capture_index(
+    const std::string &path) {
+  std::vector<CaptureIndexEntry> index;
+  static const std::string raw_suffix = ".raw";
+  if (path.size() <= raw_suffix.size() ||
+      path.compare(path.size() - raw_suffix.size(), raw_suffix.size(),
+                   raw_suffix) != 0) {
+    return index;
+  }
+  std::string index_path =
+      path.substr(0, path.size() - raw_suffix.size()) + ".idx";
+  int fd = open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return index;
+  }
+  CaptureIndexEntry entry;
+  while (read(fd, &entry, sizeof(entry)) == sizeof(entry)) {
+    index.push_back(entry);
+  }
+  close(fd);
+  MTW_LOG_INFO("replay using capture index with " << index.size()
+                                                  << " transfers");
+  return index;
+}
+
+struct ReplayReader : Object<ReplayReader>,
+                      ReaderStream,
+                      BufferSource,
+                      std::enable_shared_from_this<ReplayReader> {
+  std::shared_ptr<ReplayState> state;
+  std::function<void(Buffer &&)> callback;
+  ReplayPacing pacing = ReplayPacing::AsFastAsPossible;
+  double bytes_per_second = 0;
+  bool loop = false;
+  int fd = -1;
+  std::vector<CaptureIndexEntry> index;
+
+  size_t buffer_size = 0;
+  size_t max_buffer_count = 0;
+
+  std::mutex pool_mutex;
+  std::condition_variable pool_condition;
+  std::vector<std::unique_ptr<std::vector<uint8_t>>> slots;
+  std::vector<std::vector<uint8_t> *> idle_slots;
+
+  volatile bool exit_flag = false;
+  std::thread thread;
+
+  ReplayReader(const std::shared_ptr<ReplayState> &state,
+               const std::function<void(Buffer &&)> &callback,
+               ReplayPacing pacing, double bytes_per_second, bool loop,
+               int fd, const std::vector<CaptureIndexEntry> &index,
+               size_t buffer_count, size_t buffer_size,
+               size_t max_buffer_count)
+      : state(state),
+        callback(callback),
+        pacing(pacing),
+        bytes_per_second(bytes_per_second),
+        loop(loop),
+        fd(fd),
+        index(index),
+        buffer_size(buffer_size),
+        max_buffer_count(std::max(buffer_count, max_buffer_count)) {
+    for (size_t i = 0; i < buffer_count; i++) {
+      allocate_slot();
+    }
+  }
+
+  ~ReplayReader() { close(fd); }
+
+  // requires pool_mutex
+  std::vector<uint8_t> *allocate_slot() {
+    slots.emplace_back(new std::vector<uint8_t>(buffer_size, 0));
+    idle_slots.push_back(slots.back().get());
+    return slots.back().get();
+  }
+
+  virtual void recycle(void *handle) override {
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    idle_slots.push_back((std::vector<uint8_t> *)handle);
+    pool_condition.notify_all();
+  }
+
+  std::vector<uint8_t> *acquire_slot() {
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    while (!exit_flag) {
+      if (idle_slots.empty() && slots.size() < max_buffer_count) {
+        allocate_slot();
+      }
+      if (!idle_slots.empty()) {
+        auto *slot = idle_slots.back();
+        idle_slots.pop_back();
+        return slot;
+      }
+      pool_condition.wait(lock);
+    }
+    return nullptr;
+  }
+
+  // Reads until the buffer is full, the source is exhausted or the reader is
+  // stopped.
+  size_t fill(uint8_t *data, size_t size, bool &eof) {
+    size_t filled = 0;
+    while (filled < size && !exit_flag) {
+      pollfd d = {0};
+      d.fd = fd;
+      d.events = POLLIN;
+      int ret = poll(&d, 1, 100);
+      if (ret < 0 && errno != EINTR) {
+        MTW_LOG_ERROR("replay poll failed " << strerror(errno));
+        eof = true;
+        break;
+      }
+      if (ret <= 0) {
+        continue;
+      }
+      ssize_t n = read(fd, data + filled, size - filled);
+      if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN) {
+          continue;
+        }
+        MTW_LOG_ERROR("replay read failed " << strerror(errno));
+        eof = true;
+        break;
+      }
+      if (n == 0) {
+        if (loop && index.empty() && lseek(fd, 0, SEEK_SET) == 0) {
+          continue;
+        }
+        eof = true;
+        break;
+      }
+      filled += n;
+    }
+    return filled;
+  }
+
+  void run() {
+    set_current_thread_name("replay thread");
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t total = 0;
+    size_t next_entry = 0;
+    size_t entry_remaining = 0;
+    bool eof = false;
+    while (!exit_flag && !eof) {
+      auto *slot = acquire_slot();
+      if (!slot) {
+        break;
+      }
+      size_t request = slot->size();
+      if (!index.empty()) {
+        if (entry_remaining == 0) {
+          if (next_entry >= index.size()) {
+            if (!loop || lseek(fd, 0, SEEK_SET) != 0) {
+              recycle(slot);
+              break;
+            }
+            next_entry = 0;
+            start_time = std::chrono::steady_clock::now();
+          }
+          auto &entry = index[next_entry++];
+          entry_remaining = entry.size;
+          if (pacing == ReplayPacing::RealTime && bytes_per_second <= 0) {
+            std::this_thread::sleep_until(
+                start_time + std::chrono::nanoseconds(entry.timestamp -
+                                                      index.front().timestamp));
+          }
+        }
+        request = std::min(request, entry_remaining);
+      }
+      size_t size = fill(slot->data(), request, eof);
+      if (size == 0) {
+        recycle(slot);
+        continue;
+      }
+      entry_remaining -= std::min(entry_remaining, size);
+      total += size;
+      state->bytes_read += size;
+      if (pacing == ReplayPacing::RealTime && bytes_per_second > 0) {
+        std::this_thread::sleep_until(
+            start_time +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(total / bytes_per_second)));
+      }
+      callback(Buffer(shared_from_this(), slot, slot->data(), size));
+    }
+    MTW_LOG_INFO("replay finished after " << total << " bytes");
+    {
+      std::unique_lock<std::mutex> lock(state->mutex);
+      state->finished = true;
+      state->condition.notify_all();
+    }
+  }
+
+  void start() {
+    thread = std::thread([this]() { run(); });
+  }
+
+  virtual void stop() override {
+    MTW_LOG_INFO("stopping replay");
+    {
+      std::unique_lock<std::mutex> lock(pool_mutex);
+      exit_flag = true;
+      pool_condition.notify_all();
+    }
+    if (thread.joinable()) {
+      thread.join();
+    }
+    MTW_LOG_INFO("replay stopped");
+  }
+};
+
+ReplayDevice::ReplayDevice(const std::string &path, ReplayPacing pacing,
+                           double bytes_per_second, bool loop)
+    : _path(path),
+      _pacing(pacing),
+      _bytes_per_second(bytes_per_second),
+      _loop(loop) {}
+
+std::shared_ptr<ReaderStream> ReplayDevice::open_reader(
+    const std::function<void(Buffer &&)> &callback, size_t buffer_count,
+    size_t buffer_size, size_t max_buffer_count) {
+  {
+    std::unique_lock<std::mutex> lock(_state->mutex);
+    _state->finished = false;
+  }
+  int fd = open_replay_source(_path);
+  auto reader = std::make_shared<ReplayReader>(
+      _state, callback, _pacing, _bytes_per_second, _loop, fd,
+      load_capture_index(_path), buffer_count, buffer_size, max_buffer_count);
+  reader->start();
+  return reader;
+}
+
+void ReplayDevice::write_async(const std::string &data,
+                               const std::function<void()> &completed) {
+  _state->bytes_written += data.size();
+  if (completed) {
+    completed();
+  }
+}
+
+bool ReplayDevice::finished() {
+  std::unique_lock<std::mutex> lock(_state->mutex);
+  return _state->finished;
+}
+
+void ReplayDevice::wait() {
+  std::unique_lock<std::mutex> lock(_state->mutex);
+  while (!_state->finished) {
+    _state->condition.wait(lock);
+  }
+}
+
+}  // namespace superspeed
+}  // namespace mittenwire
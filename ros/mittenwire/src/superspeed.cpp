@@ -2,6 +2,7 @@
 
 #include <superspeed.hpp>
 
+#include <capture.hpp>
 #include <log.hpp>
 #include <utils.hpp>
 
@@ -357,13 +358,26 @@ void Device::write(const void *data, size_t size) {
   }
 }
 
-struct ReaderImpl : Object<ReaderImpl> {
-  std::shared_ptr<Device> device;
-  std::function<void(const void *, size_t)> callback;
+struct ReaderImpl : Object<ReaderImpl>,
+                    ReaderStream,
+                    BufferSource,
+                    std::enable_shared_from_this<ReaderImpl> {
+  struct Slot {
+    ReaderImpl *reader = nullptr;
+    std::vector<uint8_t> buffer;
+    std::shared_ptr<libusb_transfer> transfer;
+  };
+
+  std::shared_ptr<DeviceImpl> device;
+  std::function<void(Buffer &&)> callback;
 
-  std::vector<std::vector<uint8_t>> buffers;
+  size_t buffer_count = 0;
+  size_t buffer_size = 0;
+  size_t max_buffer_count = 0;
 
-  std::vector<std::shared_ptr<libusb_transfer>> transfers;
+  std::mutex pool_mutex;
+  std::vector<std::unique_ptr<Slot>> slots;
+  std::vector<Slot *> idle_slots;
 
   size_t count_value = 0;
   std::mutex count_mutex;
@@ -373,81 +387,168 @@ struct ReaderImpl : Object<ReaderImpl> {
 
   volatile bool exit_flag = false;
 
-  void note_transfer_canceled() {
+  std::shared_ptr<MetricCounter> timeouts_metric =
+      MetricsRegistry::instance().counter("reader.timeouts");
+  std::shared_ptr<MetricCounter> errors_metric =
+      MetricsRegistry::instance().counter("reader.transfer_errors");
+  std::shared_ptr<MetricCounter> resubmit_failures_metric =
+      MetricsRegistry::instance().counter("reader.resubmit_failures");
+  std::shared_ptr<MetricGauge> in_flight_metric =
+      MetricsRegistry::instance().gauge("reader.in_flight");
+
+  void note_transfer_finished() {
     std::unique_lock<std::mutex> lock(count_mutex);
     count_value--;
+    in_flight_metric->set(count_value);
     count_condition.notify_all();
   }
 
-  ReaderImpl(const std::shared_ptr<Device> &device,
-             const std::function<void(const void *, size_t)> &callback,
-             size_t buffer_count, size_t buffer_size)
-      : device(device), callback(callback) {
-    buffers.resize(buffer_count);
-    for (auto &buffer : buffers) buffer.resize(buffer_size, 0);
+  size_t transfers_in_flight() {
+    std::unique_lock<std::mutex> lock(count_mutex);
+    return count_value;
+  }
 
-    auto impl = device->impl_or_null_unsafe();
-    if (!impl) {
-      throw std::runtime_error("reader device impl null");
+  static void handle_transfer(libusb_transfer *transfer) {
+    auto *slot = (Slot *)transfer->user_data;
+    auto *thiz = slot->reader;
+    switch (transfer->status) {
+      case LIBUSB_TRANSFER_COMPLETED:
+        if (transfer->actual_length > 0) {
+          thiz->note_transfer_finished();
+          Buffer lease(thiz->shared_from_this(), slot, transfer->buffer,
+                       transfer->actual_length, monotonic_time_ns());
+          thiz->refill();
+          thiz->callback_running++;
+          thiz->callback(std::move(lease));
+          thiz->callback_running--;
+          break;
+        }
+        // fall through
+      case LIBUSB_TRANSFER_TIMED_OUT:
+        if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
+          thiz->timeouts_metric->add();
+        }
+        if (thiz->exit_flag) {
+          thiz->note_transfer_finished();
+        } else if (0 != libusb_submit_transfer(transfer)) {
+          thiz->resubmit_failures_metric->add();
+          thiz->note_transfer_finished();
+        }
+        break;
+      case LIBUSB_TRANSFER_CANCELLED:
+        thiz->note_transfer_finished();
+        break;
+      default:
+        thiz->errors_metric->add();
+        thiz->note_transfer_finished();
+        break;
     }
+  }
 
-    for (size_t i = 0; i < buffer_count; i++) {
-      auto *transfer = libusb_alloc_transfer(0);
-      if (!transfer) {
-        throw std::runtime_error("reader libusb_alloc_transfer failed");
+  Slot *allocate_slot() {
+    std::unique_ptr<Slot> slot(new Slot());
+    slot->reader = this;
+    slot->buffer.resize(buffer_size, 0);
+    auto *transfer = libusb_alloc_transfer(0);
+    if (!transfer) {
+      throw std::runtime_error("reader libusb_alloc_transfer failed");
+    }
+    slot->transfer = std::shared_ptr<libusb_transfer>(
+        transfer,
+        [](libusb_transfer *transfer) { libusb_free_transfer(transfer); });
+    libusb_fill_bulk_transfer(transfer, device->usb_device.get(), 0x82,
+                              slot->buffer.data(), buffer_size,
+                              &ReaderImpl::handle_transfer, slot.get(), 5000);
+    slots.push_back(std::move(slot));
+    return slots.back().get();
+  }
+
+  // requires pool_mutex
+  bool submit(Slot *slot) {
+    {
+      std::unique_lock<std::mutex> lock(count_mutex);
+      count_value++;
+      in_flight_metric->set(count_value);
+    }
+    if (0 != libusb_submit_transfer(slot->transfer.get())) {
+      resubmit_failures_metric->add();
+      note_transfer_finished();
+      idle_slots.push_back(slot);
+      return false;
+    }
+    return true;
+  }
+
+  // Tops up the number of transfers in flight after one of them has been
+  // leased out.
+  void refill() {
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    while (!exit_flag && transfers_in_flight() < buffer_count) {
+      Slot *slot = nullptr;
+      if (!idle_slots.empty()) {
+        slot = idle_slots.back();
+        idle_slots.pop_back();
+      } else if (slots.size() < max_buffer_count) {
+        slot = allocate_slot();
+      } else {
+        break;
       }
-      transfers.emplace_back(transfer, [](libusb_transfer *transfer) {
-        libusb_free_transfer(transfer);
-      });
-      libusb_fill_bulk_transfer(
-          transfer, impl->usb_device.get(), 0x82, buffers.at(i).data(),
-          buffer_size,
-          [](libusb_transfer *transfer) {
-            auto *thiz = (ReaderImpl *)transfer->user_data;
-            switch (transfer->status) {
-              case LIBUSB_TRANSFER_COMPLETED:
-                thiz->callback_running++;
-                thiz->callback(transfer->buffer, transfer->actual_length);
-                thiz->callback_running--;
-              case LIBUSB_TRANSFER_TIMED_OUT:
-                if (thiz->exit_flag ||
-                    (0 != libusb_submit_transfer(transfer))) {
-                  thiz->note_transfer_canceled();
-                }
-                break;
-              default:
-                thiz->note_transfer_canceled();
-                break;
-            }
-          },
-          this, 5000);
+      if (!submit(slot)) {
+        MTW_LOG_ERROR("reader failed to resubmit transfer");
+        break;
+      }
+    }
+  }
+
+  virtual void recycle(void *handle) override {
+    auto *slot = (Slot *)handle;
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    if (exit_flag || transfers_in_flight() >= buffer_count) {
+      idle_slots.push_back(slot);
+    } else if (!submit(slot)) {
+      MTW_LOG_ERROR("reader failed to resubmit transfer");
     }
+  }
 
+  ReaderImpl(const std::shared_ptr<DeviceImpl> &device,
+             const std::function<void(Buffer &&)> &callback,
+             size_t buffer_count, size_t buffer_size, size_t max_buffer_count)
+      : device(device),
+        callback(callback),
+        buffer_count(buffer_count),
+        buffer_size(buffer_size),
+        max_buffer_count(std::max(buffer_count, max_buffer_count)) {}
+
+  void start() {
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    for (size_t i = 0; i < buffer_count; i++) {
+      allocate_slot();
+    }
     MTW_LOG_INFO("reader starting usb transfers");
-    for (auto &transfer : transfers) {
+    for (auto &slot : slots) {
       MTW_LOG_INFO("reader libusb_submit_transfer");
-      auto ret = libusb_submit_transfer(transfer.get());
-      if (ret != 0) {
+      if (!submit(slot.get())) {
         throw std::runtime_error("reader failed to submit transfer");
       }
-      {
-        std::unique_lock<std::mutex> lock(count_mutex);
-        count_value++;
-      }
     }
     MTW_LOG_INFO("reader usb transfers started");
   }
+
   void print_shutdown_status() {
     MTW_LOG_INFO("waiting for " << count_value << " transfers "
                                 << callback_running << " callbacks ");
   }
-  ~ReaderImpl() {
+
+  virtual void stop() override {
     print_shutdown_status();
 
     MTW_LOG_INFO("reader canceling transfers");
-    exit_flag = true;
-    for (auto &t : transfers) {
-      libusb_cancel_transfer(t.get());
+    {
+      std::unique_lock<std::mutex> lock(pool_mutex);
+      exit_flag = true;
+      for (auto &slot : slots) {
+        libusb_cancel_transfer(slot->transfer.get());
+      }
     }
     MTW_LOG_INFO("reader transfers canceled");
 
@@ -461,21 +562,69 @@ struct ReaderImpl : Object<ReaderImpl> {
     }
     print_shutdown_status();
     MTW_LOG_INFO("reader completed");
+  }
 
+  ~ReaderImpl() {
     MTW_LOG_INFO("reader freeing transfers");
-    transfers.clear();
+    slots.clear();
     MTW_LOG_INFO("reader transfers freed");
   }
 };
 
-Reader::Reader(const std::shared_ptr<Device> &device,
-               const std::function<void(const void *, size_t)> &callback,
-               size_t buffer_count, size_t buffer_size) {
-  _impl =
-      std::make_shared<ReaderImpl>(device, callback, buffer_count, buffer_size);
+std::shared_ptr<ReaderStream> Device::open_reader(
+    const std::function<void(Buffer &&)> &callback, size_t buffer_count,
+    size_t buffer_size, size_t max_buffer_count) {
+  auto impl = impl_or_null_unsafe();
+  if (!impl) {
+    throw std::runtime_error("reader device impl null");
+  }
+  auto reader = std::make_shared<ReaderImpl>(impl, callback, buffer_count,
+                                             buffer_size, max_buffer_count);
+  reader->start();
+  return reader;
+}
+
+Reader::Reader(const std::shared_ptr<Transport> &transport,
+               const std::function<void(Buffer &&)> &callback,
+               size_t buffer_count, size_t buffer_size,
+               size_t max_buffer_count) {
+  _impl = transport->open_reader(
+      [this, callback](Buffer &&buffer) {
+        if (!buffer.timestamp()) {
+          buffer.set_timestamp(monotonic_time_ns());
+        }
+        {
+          // append() only copies into the staging ring and never blocks
+          std::lock_guard<std::mutex> lock(_capture_mutex);
+          if (_capture) {
+            _capture->append(buffer.data(), buffer.size(), buffer.timestamp(),
+                             _transfer_index);
+          }
+        }
+        _transfer_index++;
+        _transfers_metric->add();
+        _bytes_metric->add(buffer.size());
+        callback(std::move(buffer));
+      },
+      buffer_count, buffer_size, max_buffer_count);
 }
 
-void Device::write_async(const std::string &data) {
+Reader::~Reader() { _impl->stop(); }
+
+void Reader::set_capture(const std::shared_ptr<Capture> &capture) {
+  std::shared_ptr<Capture> prev;
+  {
+    std::lock_guard<std::mutex> lock(_capture_mutex);
+    prev = std::move(_capture);
+    _capture = capture;
+  }
+  // The event thread cannot touch prev anymore, so unless someone else still
+  // holds it, it is finalized here and not on the event thread.
+  prev.reset();
+}
+
+void Device::write_async(const std::string &data,
+                         const std::function<void()> &completed) {
   auto transfer = std::shared_ptr<libusb_transfer>(
       libusb_alloc_transfer(0), [](libusb_transfer *transfer) {
         if (transfer) {
@@ -495,14 +644,20 @@ void Device::write_async(const std::string &data) {
     bool finished = false;
     std::mutex mutex;
     std::condition_variable condition;
+    const std::function<void()> *completed = nullptr;
   };
   Context context;
+  context.completed = &completed;
 
   libusb_fill_bulk_transfer(
       transfer.get(), impl->usb_device.get(), 0x02,
       (unsigned char *)data.data(), data.size(),
       [](libusb_transfer *transfer) {
         auto *context = (Context *)transfer->user_data;
+        if (transfer->status == LIBUSB_TRANSFER_COMPLETED &&
+            *context->completed) {
+          (*context->completed)();
+        }
         std::unique_lock<std::mutex> lock(context->mutex);
         context->finished = true;
         context->condition.notify_all();
@@ -560,9 +715,9 @@ void Device::write(const std::vector<int8_t> &data) {
 
 void Device::write(const std::string &data) { write(data.data(), data.size()); }
 
-Writer::Writer(const std::shared_ptr<Device> &device,
+Writer::Writer(const std::shared_ptr<Transport> &transport,
                const std::function<std::string()> &callback, double interval)
-    : _device(device), _callback(callback) {
+    : _transport(transport), _callback(callback) {
   _thread = std::thread([this, interval]() {
     set_current_thread_name("usb writer thread");
     auto last_time = std::chrono::steady_clock::now();
@@ -582,13 +737,21 @@ Writer::Writer(const std::shared_ptr<Device> &device,
                                                       std::min(0.1, interval)));
         }
       }
-      MTW_LOG_INFO("begin writer callback");
+      MTW_LOG_DEBUG("begin writer callback");
+      auto callback_start = std::chrono::steady_clock::now();
       auto message = _callback();
-      MTW_LOG_INFO("writer callback ended");
+      auto write_start = std::chrono::steady_clock::now();
+      _callback_time_metric->record_us(write_start - callback_start);
+      MTW_LOG_DEBUG("writer callback ended");
       if (!message.empty()) {
-        _device->write_async(message);
+        auto latency_metric = _write_latency_metric;
+        _transport->write_async(message, [latency_metric, write_start]() {
+          latency_metric->record_us(std::chrono::steady_clock::now() -
+                                    write_start);
+        });
+        _writes_metric->add();
       }
-      MTW_LOG_INFO("device write ended");
+      MTW_LOG_DEBUG("device write ended");
       last_time = std::chrono::steady_clock::now();
     }
   });
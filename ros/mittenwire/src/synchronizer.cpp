@@ -0,0 +1,178 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <synchronizer.hpp>
+
+#include <log.hpp>
+#include <utils.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace mittenwire {
+
+// number of delivered triggers remembered to drop late frames
+static constexpr size_t synchronizer_history = 64;
+
+bool FrameSet::complete() const {
+  for (auto& frame : frames) {
+    if (!frame) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<size_t> FrameSet::missing_channels() const {
+  std::vector<size_t> ret;
+  for (size_t i = 0; i < frames.size(); i++) {
+    if (!frames[i]) {
+      ret.push_back(channels[i]);
+    }
+  }
+  return ret;
+}
+
+FrameSynchronizer::FrameSynchronizer(
+    const std::vector<size_t>& channels,
+    const std::function<void(const std::shared_ptr<FrameSet>&)>& callback,
+    double timeout, size_t max_pending)
+    : _channels(channels),
+      _callback(callback),
+      _timeout_ns(timeout * 1e9),
+      _max_pending(std::max<size_t>(1, max_pending)) {
+  if (channels.empty()) {
+    throw std::runtime_error("frame synchronizer needs at least one channel");
+  }
+  auto& registry = MetricsRegistry::instance();
+  _complete_sets = registry.counter("sync.complete_sets");
+  _incomplete_sets = registry.counter("sync.incomplete_sets");
+  _late_frames = registry.counter("sync.late_frames");
+  _set_spread_us = registry.histogram("sync.set_spread_us");
+  _thread = std::thread([this]() {
+    set_current_thread_name("frame sync");
+    run();
+  });
+}
+
+FrameSynchronizer::~FrameSynchronizer() {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _exit = true;
+    _condition.notify_all();
+  }
+  _thread.join();
+}
+
+void FrameSynchronizer::deliver(size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    auto& pending = _pending.front();
+    auto& set = pending.set;
+    if (pending.count == _channels.size()) {
+      _complete_sets->add();
+      _set_spread_us->record(
+          (set->last_host_timestamp - set->first_host_timestamp) / 1000);
+    } else {
+      _incomplete_sets->add();
+      MTW_LOG_DEBUG("incomplete frame set " << set->request_timestamp
+                                            << ", " << pending.count << " of "
+                                            << _channels.size() << " frames");
+    }
+    _delivered.push_back(set->request_timestamp);
+    if (_delivered.size() > synchronizer_history) {
+      _delivered.pop_front();
+    }
+    _ready.push_back(std::move(set));
+    _pending.pop_front();
+  }
+  _condition.notify_all();
+}
+
+void FrameSynchronizer::add(const std::shared_ptr<ImageMessage>& frame) {
+  auto channel = std::find(_channels.begin(), _channels.end(), frame->channel);
+  if (channel == _channels.end()) {
+    return;
+  }
+  size_t slot = channel - _channels.begin();
+  uint64_t now = monotonic_time_ns();
+  uint32_t trigger = frame->request_timestamp;
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (std::find(_delivered.begin(), _delivered.end(), trigger) !=
+      _delivered.end()) {
+    _late_frames->add();
+    return;
+  }
+  auto it = std::find_if(_pending.begin(), _pending.end(),
+                         [&](const Pending& p) {
+                           return p.set->request_timestamp == trigger;
+                         });
+  if (it == _pending.end()) {
+    Pending pending;
+    pending.set = std::make_shared<FrameSet>();
+    pending.set->request_timestamp = trigger;
+    pending.set->channels = _channels;
+    pending.set->frames.resize(_channels.size());
+    pending.set->first_host_timestamp = now;
+    pending.deadline = now + _timeout_ns;
+    _pending.push_back(std::move(pending));
+    if (_pending.size() > _max_pending) {
+      deliver(1);
+    }
+    it = _pending.end() - 1;
+  }
+  auto& set = *it->set;
+  if (!set.frames[slot]) {
+    it->count++;
+  }
+  set.frames[slot] = frame;
+  set.last_host_timestamp = now;
+  if (it->count == _channels.size()) {
+    // cameras deliver in order, so older sets can no longer complete
+    deliver(it - _pending.begin() + 1);
+  }
+}
+
+void FrameSynchronizer::run() {
+  std::vector<std::shared_ptr<FrameSet>> sets;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (true) {
+        if (_exit) {
+          return;
+        }
+        size_t expired = 0;
+        uint64_t now = monotonic_time_ns();
+        while (expired < _pending.size() &&
+               _pending[expired].deadline <= now) {
+          expired++;
+        }
+        if (expired) {
+          deliver(expired);
+        }
+        if (!_ready.empty()) {
+          break;
+        }
+        if (_pending.empty()) {
+          _condition.wait(lock);
+        } else {
+          _condition.wait_for(lock, std::chrono::nanoseconds(
+                                        _pending.front().deadline - now));
+        }
+      }
+      sets.assign(_ready.begin(), _ready.end());
+      _ready.clear();
+    }
+    for (auto& set : sets) {
+      try {
+        _callback(set);
+      } catch (const std::exception& e) {
+        MTW_LOG_ERROR("frame set callback failed: " << e.what());
+      }
+    }
+    sets.clear();
+  }
+}
+
+}  // namespace mittenwire
\ No newline at end of file
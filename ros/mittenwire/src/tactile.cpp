@@ -0,0 +1,164 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <tactile.hpp>
+
+#include <log.hpp>
+#include <messages.hpp>
+#include <shfloat.hpp>
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace mittenwire {
+
+// core temperature in degrees Celsius by 6-bit sensor code
+static const int16_t glove_temperature_table[64] = {
+    -58, -56, -54, -52, -45, -44, -43, -42, -41, -40, -39, -38, -37,
+    -36, -30, -20, -10, -4,  0,   4,   10,  21,  22,  23,  24,  25,
+    26,  27,  28,  29,  40,  50,  60,  70,  76,  80,  81,  82,  83,
+    84,  85,  86,  87,  88,  89,  95,  96,  97,  98,  99,  100, 101,
+    102, 103, 104, 105, 106, 107, 108, 116, 120, 124, 128, 132,
+};
+
+// the chunk that completes a matrix
+static constexpr uint32_t tactile_last_chunk =
+    TactileMatrix::size / TactileMatrixChunk::sample_count;
+
+bool TactileMatrix::complete() const {
+  for (size_t i = 0; i < size; i++) {
+    if (!validity[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Tactile::Metrics &Tactile::get_metrics(size_t channel) {
+  if (!metrics || metrics_channel != channel) {
+    auto &registry = MetricsRegistry::instance();
+    std::string prefix = "tactile." + std::to_string(channel) + ".";
+    metrics.reset(new Metrics());
+    metrics->matrices = registry.counter(prefix + "matrices");
+    metrics->incomplete_matrices =
+        registry.counter(prefix + "incomplete_matrices");
+    metrics->status_packets = registry.counter(prefix + "status_packets");
+    metrics->unknown_packets = registry.counter(prefix + "unknown_packets");
+    metrics_channel = channel;
+  }
+  return *metrics;
+}
+
+void Tactile::flush(Metrics &m) {
+  if (matrix) {
+    m.matrices->add();
+    if (!matrix->complete()) {
+      m.incomplete_matrices->add();
+    }
+    if (clock_sync) {
+      matrix->stamp = clock_sync->to_wall(matrix->timestamp);
+    }
+    if (matrix_callback) {
+      matrix_callback(matrix);
+    }
+    matrix.reset();
+  }
+  prev_index = 0;
+}
+
+void Tactile::process(const Packet &packet) {
+  auto &m = get_metrics(packet.channel);
+
+  RadioHeader header;
+  if (packet.data.size() < sizeof(header)) {
+    m.unknown_packets->add();
+    return;
+  }
+  memcpy(&header, packet.data.data(), sizeof(header));
+  if (header.magic != RadioHeader::magic_value) {
+    m.unknown_packets->add();
+    return;
+  }
+  if (clock_sync) {
+    clock_sync->add_sample(header.timestamp, packet.host_timestamp);
+  }
+  const uint8_t *payload = packet.data.data() + sizeof(header);
+  size_t payload_size = packet.data.size() - sizeof(header);
+  uint32_t id = 0;
+  if (payload_size >= sizeof(id)) {
+    memcpy(&id, payload, sizeof(id));
+  }
+
+  if ((id & TactileMatrixChunk::id_mask) == TactileMatrixChunk::id_value &&
+      payload_size == sizeof(TactileMatrixChunk)) {
+    TactileMatrixChunk chunk;
+    memcpy(&chunk, payload, sizeof(chunk));
+    uint32_t index = chunk.index();
+    if (matrix && index < prev_index) {
+      flush(m);
+    }
+    if (!matrix) {
+      matrix = std::make_shared<TactileMatrix>();
+      matrix->channel = packet.channel;
+      matrix->timestamp = header.timestamp;
+    }
+    size_t first = index * TactileMatrixChunk::sample_count;
+    if (first < TactileMatrix::size) {
+      size_t count = std::min<size_t>(TactileMatrixChunk::sample_count,
+                                      TactileMatrix::size - first);
+      // the chunk is packed, unpack from an aligned copy
+      uint32_t samples[TactileMatrixChunk::sample_count];
+      memcpy(samples, chunk.samples, sizeof(samples));
+      shfloat_unpack(samples, matrix->inphase + first,
+                     matrix->quadrature + first, count);
+      memset(matrix->validity + first, 1, count);
+    }
+    matrix->chunks_received++;
+    matrix->host_timestamp = packet.host_timestamp;
+    prev_index = index;
+    if (index == tactile_last_chunk) {
+      flush(m);
+    }
+    return;
+  }
+
+  if (id == GloveStatusPacket::id_value &&
+      payload_size == sizeof(GloveStatusPacket)) {
+    GloveStatusPacket p;
+    memcpy(&p, payload, sizeof(p));
+    m.status_packets->add();
+    auto status = std::make_shared<TactileStatus>();
+    status->channel = packet.channel;
+    status->timestamp = header.timestamp;
+    status->host_timestamp = packet.host_timestamp;
+    if (clock_sync) {
+      status->stamp = clock_sync->to_wall(header.timestamp);
+    }
+    status->clock_milliseconds = p.millis;
+    status->core_temperature = glove_temperature_table[p.core_temperature & 63];
+    status->button_pressed = (p.flags & 1) != 0;
+    status->battery_disconnect = (p.flags & 2) == 0;
+    status->battery_charging = (p.flags & 4) != 0;
+    status->usb_power_present = (p.flags & 8) != 0;
+    status->battery_voltage = p.battery_voltage_mv * 0.001f;
+    // 10 mOhm shunt
+    status->battery_current = p.shunt_voltage_mv * 0.001f * 10;
+    status->imu_temperature = p.imu_temp_accel_gyro[0] / 132.48f + 25;
+    float acceleration_scale = 16.0f / 32767.0f;
+    float rate_scale = 2000.0f / 32767.0f;
+    for (size_t i = 0; i < 3; i++) {
+      status->imu_linear_acceleration[i] =
+          p.imu_temp_accel_gyro[1 + i] * acceleration_scale;
+      status->imu_angular_velocity[i] =
+          p.imu_temp_accel_gyro[4 + i] * rate_scale;
+    }
+    if (status_callback) {
+      status_callback(status);
+    }
+    return;
+  }
+
+  m.unknown_packets->add();
+}
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,66 @@
+// (c) 2023-2024 Philipp Ruppel
+
+#include <tactilepublisher.hpp>
+
+namespace mittenwire {
+
+static ros::Time tactile_stamp(double stamp) {
+  return stamp > 0 ? ros::Time(stamp) : ros::Time::now();
+}
+
+TactilePublisher::TactilePublisher(ros::NodeHandle &node_handle,
+                                   const std::string &matrix_topic,
+                                   const std::string &status_topic) {
+  _matrix_publisher =
+      node_handle.advertise<mittenwire::ImpedanceMatrix>(matrix_topic, 100);
+  _status_publisher =
+      node_handle.advertise<mittenwire::GloveStatus>(status_topic, 100);
+}
+
+void tactile_to_ros(const TactileMatrix &matrix,
+                    mittenwire::ImpedanceMatrix &msg) {
+  msg.timestamp = matrix.timestamp;
+  msg.channel = matrix.channel;
+  msg.width = TactileMatrix::width;
+  msg.height = TactileMatrix::height;
+  msg.inphase.assign(matrix.inphase, matrix.inphase + TactileMatrix::size);
+  msg.quadrature.assign(matrix.quadrature,
+                        matrix.quadrature + TactileMatrix::size);
+  msg.validity.assign(matrix.validity, matrix.validity + TactileMatrix::size);
+}
+
+void tactile_to_ros(const TactileStatus &status, mittenwire::GloveStatus &msg) {
+  msg.timestamp = status.timestamp;
+  msg.channel = status.channel;
+  msg.clock_milliseconds = status.clock_milliseconds;
+  msg.core_temperature = status.core_temperature;
+  msg.button_pressed = status.button_pressed;
+  msg.battery_voltage = status.battery_voltage;
+  msg.battery_current = status.battery_current;
+  msg.battery_disconnect = status.battery_disconnect;
+  msg.battery_charging = status.battery_charging;
+  msg.usb_power_present = status.usb_power_present;
+  msg.imu_temperature = status.imu_temperature;
+  msg.imu_angular_velocity.x = status.imu_angular_velocity[0];
+  msg.imu_angular_velocity.y = status.imu_angular_velocity[1];
+  msg.imu_angular_velocity.z = status.imu_angular_velocity[2];
+  msg.imu_linear_acceleration.x = status.imu_linear_acceleration[0];
+  msg.imu_linear_acceleration.y = status.imu_linear_acceleration[1];
+  msg.imu_linear_acceleration.z = status.imu_linear_acceleration[2];
+}
+
+void TactilePublisher::publish(const TactileMatrix &matrix) {
+  mittenwire::ImpedanceMatrix msg;
+  tactile_to_ros(matrix, msg);
+  msg.header.stamp = tactile_stamp(matrix.stamp);
+  _matrix_publisher.publish(msg);
+}
+
+void TactilePublisher::publish(const TactileStatus &status) {
+  mittenwire::GloveStatus msg;
+  tactile_to_ros(status, msg);
+  msg.header.stamp = tactile_stamp(status.stamp);
+  _status_publisher.publish(msg);
+}
+
+}  // namespace mittenwire
\ No newline at end of file
@@ -0,0 +1,97 @@
+// (c) 2023-2024 Philipp Ruppel
+
+// Records the frames of several cameras per trigger, each with a slightly
+// different clock sync stamp like the live cameras produce, and checks that
+// ImageBagReader reads every trigger back as one set. A frame with too many
+// lost packets must be left out.
+//
+// usage: mittenwire_recorder_test [triggers] [cameras]
+
+#include <camera.hpp>
+#include <imagebag.hpp>
+#include <log.hpp>
+#include <recorder.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+
+using namespace mittenwire;
+
+static std::shared_ptr<ImageMessage> make_frame(size_t channel,
+                                                uint32_t request_timestamp,
+                                                double stamp) {
+  auto frame = std::make_shared<ImageMessage>();
+  frame->channel = channel;
+  frame->width = 16;
+  frame->height = 8;
+  frame->skip = 1;
+  frame->data.assign(frame->width * frame->height, channel);
+  frame->request_timestamp = request_timestamp;
+  frame->stamp = stamp;
+  frame->valid = true;
+  frame->packets_expected = 2;
+  frame->packets_received = 2;
+  return frame;
+}
+
+int main(int argc, char **argv) {
+  size_t trigger_count = 20;
+  size_t camera_count = 4;
+  if (argc > 1) trigger_count = atoi(argv[1]);
+  if (argc > 2) camera_count = atoi(argv[2]);
+
+  char path[] = "/tmp/mittenwire_recorder_test_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    std::cerr << "failed to create bag file" << std::endl;
+    return 1;
+  }
+  close(fd);
+
+  Recorder recorder;
+  recorder.start(path);
+  for (size_t t = 0; t < trigger_count; t++) {
+    uint32_t request_timestamp = 1000 + t * 40000;
+    for (size_t c = 0; c < camera_count; c++) {
+      // every camera maps the trigger to the wall clock on its own
+      double stamp = 1700000000.0 + t * 0.04 + c * 1.3e-6;
+      recorder.add(make_frame(c, request_timestamp, stamp));
+    }
+  }
+  // lost half of its packets, below the default minimum completeness
+  auto incomplete = make_frame(camera_count, 1000, 1700000000.0);
+  incomplete->valid = false;
+  incomplete->packets_received = 1;
+  recorder.add(incomplete);
+  recorder.stop();
+
+  size_t set_count = 0;
+  size_t bad_sets = 0;
+  {
+    ImageBagReader reader(path, 4, 1, false);
+    set_count = reader.size();
+    while (auto set = reader.next()) {
+      if (set->images.size() != camera_count) {
+        bad_sets++;
+      }
+    }
+  }
+  unlink(path);
+  Logger::flush();
+
+  std::cout << "recorded messages " << recorder.messages() << " incomplete "
+            << recorder.incomplete() << " dropped " << recorder.dropped()
+            << " sets " << set_count << " expected " << trigger_count
+            << " sets with missing images " << bad_sets << std::endl;
+  if (recorder.messages() != trigger_count * camera_count ||
+      recorder.incomplete() != 1 || recorder.dropped() != 0 ||
+      set_count != trigger_count || bad_sets != 0) {
+    std::cout << "FAILED" << std::endl;
+    return 1;
+  }
+  std::cout << "OK" << std::endl;
+  return 0;
+}
\ No newline at end of file
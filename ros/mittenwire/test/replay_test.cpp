@@ -0,0 +1,96 @@
+// (c) 2023-2024 Philipp Ruppel
+
+// Replays a synthetic hub stream from a file as fast as possible through
+// Master, Hub and Camera nodes with the buffer settings of scripts/replay and
+// checks that no transfer is dropped and every frame arrives complete.
+//
+// usage: mittenwire_replay_test [frames]
+
+#include "../bench/generator.hpp"
+
+#include <camera.hpp>
+#include <hub.hpp>
+#include <log.hpp>
+#include <master.hpp>
+#include <replay.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace mittenwire;
+
+int main(int argc, char **argv) {
+  StreamGeneratorConfig config;
+  config.frames = 50;
+  if (argc > 1) config.frames = atoi(argv[1]);
+  auto stream = StreamGenerator(config).generate();
+
+  char path[] = "/tmp/mittenwire_replay_test_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    std::cerr << "failed to create stream file" << std::endl;
+    return 1;
+  }
+  for (auto &transfer : stream.transfers) {
+    size_t size = transfer.size() * 4;
+    if (write(fd, transfer.data(), size) != (ssize_t)size) {
+      std::cerr << "failed to write stream file" << std::endl;
+      return 1;
+    }
+  }
+  close(fd);
+
+  std::mutex mutex;
+  size_t valid = 0;
+  size_t invalid = 0;
+  uint64_t dropped = 0;
+  {
+    auto device = std::make_shared<superspeed::ReplayDevice>(path);
+    auto master = std::make_shared<Master>(device, 32, 32 * 1024);
+    {
+      Hub hub(master);
+      std::vector<std::shared_ptr<Camera>> cameras;
+      for (size_t c = 0; c < config.camera_count; c++) {
+        cameras.push_back(std::make_shared<Camera>(
+            [&](const std::shared_ptr<ImageMessage> &msg) {
+              std::unique_lock<std::mutex> lock(mutex);
+              (msg->valid ? valid : invalid)++;
+            }));
+        hub.connect(c, cameras.back());
+      }
+      device->wait();
+      // frames still in flight arrive shortly after the device finished
+      size_t expected = config.frames * config.camera_count;
+      for (size_t i = 0; i < 1000; i++) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          if (valid + invalid >= expected) {
+            break;
+          }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      dropped = master->dropped_oldest_transfers() +
+                master->dropped_newest_transfers();
+    }
+  }
+  unlink(path);
+  Logger::flush();
+
+  size_t expected = config.frames * config.camera_count;
+  std::cout << "replay frames valid " << valid << " invalid " << invalid
+            << " expected " << expected << " dropped transfers " << dropped
+            << std::endl;
+  if (dropped != 0 || invalid != 0 || valid != expected) {
+    std::cout << "FAILED" << std::endl;
+    return 1;
+  }
+  std::cout << "OK" << std::endl;
+  return 0;
+}
\ No newline at end of file
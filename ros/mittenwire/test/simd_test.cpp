@@ -0,0 +1,88 @@
+// (c) 2023-2024 Philipp Ruppel
+
+// Checks that a build with the project's compiler flags selects the AVX2
+// kernels on CPUs that support them, and that the selected kernels of the
+// library and shfloat.hpp agree with the scalar code.
+//
+// usage: mittenwire_simd_test
+
+#include <deframer.hpp>
+#include <log.hpp>
+#include <shfloat.hpp>
+#include <simd.hpp>
+
+#include <string.h>
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace mittenwire;
+
+int main(int argc, char **argv) {
+  size_t errors = 0;
+
+  std::cout << "simd " << simd_name() << std::endl;
+#if defined(MTW_SIMD_AVX2)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && strcmp(simd_name(), "avx2") != 0) {
+    std::cout << "cpu supports avx2 but the kernels do not use it"
+              << std::endl;
+    errors++;
+  }
+#endif
+
+  // odd count, so the batch code also runs its scalar tail
+  std::mt19937 rng(1);
+  size_t count = 1003;
+  std::vector<int32_t> inphase(count), quadrature(count);
+  for (size_t k = 0; k < count; k++) {
+    int shift = rng() % 32;
+    inphase[k] = int32_t(rng()) >> shift;
+    quadrature[k] = int32_t(rng()) >> shift;
+  }
+  int32_t edges[] = {0, -1, 1, INT32_MIN, INT32_MAX};
+  for (size_t k = 0; k < 25; k++) {
+    inphase[k] = edges[k % 5];
+    quadrature[k] = edges[k / 5];
+  }
+  std::vector<uint32_t> packed(count);
+  shfloat_pack(inphase.data(), quadrature.data(), packed.data(), count);
+  std::vector<int32_t> i2(count), q2(count);
+  shfloat_unpack(packed.data(), i2.data(), q2.data(), count);
+  size_t shfloat_errors = 0;
+  for (size_t k = 0; k < count; k++) {
+    int32_t i, q;
+    shfloat_unpack(shfloat_pack(inphase[k], quadrature[k]), i, q);
+    if (packed[k] != shfloat_pack(inphase[k], quadrature[k]) || i2[k] != i ||
+        q2[k] != q) {
+      shfloat_errors++;
+    }
+  }
+  std::cout << "shfloat mismatches " << shfloat_errors << std::endl;
+  errors += shfloat_errors;
+
+  // a header at every position of a short buffer, and none at all
+  size_t header_errors = 0;
+  std::vector<uint32_t> words(100, 0x12345678);
+  if (find_segment_header(words.data(), words.size()) != words.size()) {
+    header_errors++;
+  }
+  for (size_t at = 0; at < words.size(); at++) {
+    std::fill(words.begin(), words.end(), 0x12345678);
+    words[at] = 0x23011005;
+    if (find_segment_header(words.data(), words.size()) != at) {
+      header_errors++;
+    }
+  }
+  std::cout << "segment header mismatches " << header_errors << std::endl;
+  errors += header_errors;
+
+  Logger::flush();
+  if (errors) {
+    std::cout << "FAILED" << std::endl;
+    return 1;
+  }
+  std::cout << "OK" << std::endl;
+  return 0;
+}
\ No newline at end of file
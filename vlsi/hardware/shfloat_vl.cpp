@@ -2,27 +2,13 @@
 
 #include "Vshfloat_vl.h"
 
+#include <shfloat.hpp>
+
 #include <iostream>
 #include <random>
+#include <vector>
 
-uint32_t pack_sample(int32_t i, int32_t q) {
-  uint32_t exp = 0;
-  while ((((i & 0xC0000000) == 0xC0000000) || ((i & 0xC0000000) == 0)) &&
-         (((q & 0xC0000000) == 0xC0000000) || ((q & 0xC0000000) == 0)) &&
-         (exp < 31)) {
-    i <<= 1;
-    q <<= 1;
-    exp++;
-  }
-  return exp | (uint32_t(i & 0xfff00000)) | (uint32_t(q & 0xfff00000) >> 12);
-}
-
-std::pair<int32_t, int32_t> unpack_sample(uint32_t v) {
-  uint32_t exp = (v & 0xff);
-  int32_t i = (v & 0xfff00000);
-  int32_t q = ((v << 12) & 0xfff00000);
-  return std::make_pair(i >> exp, q >> exp);
-}
+using namespace mittenwire;
 
 #define ASSERT_STR(x) #x
 
@@ -33,10 +19,62 @@ std::pair<int32_t, int32_t> unpack_sample(uint32_t v) {
                              ASSERT_STR(x));                                   \
   }
 
+static uint32_t hdl_pack(Vshfloat_vl &vshfloat, uint32_t index, int32_t i,
+                         int32_t q) {
+  vshfloat.in_index = index;
+  vshfloat.in_value_i = i;
+  vshfloat.in_value_q = q;
+  vshfloat.in_strobe = 1;
+  vshfloat.clk = 1;
+  vshfloat.eval();
+  vshfloat.in_strobe = 0;
+  vshfloat.clk = 0;
+  vshfloat.eval();
+  while (!vshfloat.out_strobe) {
+    vshfloat.clk = 1;
+    vshfloat.eval();
+    vshfloat.clk = 0;
+    vshfloat.eval();
+  }
+  ASSERT(vshfloat.out_index == index);
+  return vshfloat.out_pack;
+}
+
+// Batch and scalar host codec against each other over every packed word:
+// decoding must agree, and packing a decoded pair must decode to the same
+// values again.
+static void test_host_exhaustive() {
+  const size_t batch = 1 << 16;
+  std::vector<uint32_t> words(batch), repacked(batch);
+  std::vector<int32_t> i(batch), q(batch), i2(batch), q2(batch);
+  for (uint64_t base = 0; base < (uint64_t(1) << 32); base += batch) {
+    if (base % (uint64_t(1) << 28) == 0) {
+      std::cout << std::dec << "host " << (base >> 28) << "/16" << std::endl;
+    }
+    for (size_t k = 0; k < batch; k++) {
+      words[k] = uint32_t(base + k);
+    }
+    shfloat_unpack(words.data(), i.data(), q.data(), batch);
+    shfloat_pack(i.data(), q.data(), repacked.data(), batch);
+    shfloat_unpack(repacked.data(), i2.data(), q2.data(), batch);
+    for (size_t k = 0; k < batch; k++) {
+      int32_t si, sq;
+      shfloat_unpack(words[k], si, sq);
+      ASSERT(si == i[k] && sq == q[k], std::cout << std::hex << words[k]
+                                                 << std::endl);
+      ASSERT(repacked[k] == shfloat_pack(si, sq));
+      ASSERT(i2[k] == si && q2[k] == sq, std::cout << std::hex << words[k]
+                                                   << std::endl);
+    }
+  }
+}
+
 int main(int argc, char **argv) {
 
   bool verbose = 0;
 
+  test_host_exhaustive();
+
   Vshfloat_vl vshfloat;
   vshfloat.clk = 0;
   vshfloat.in_index = 0;
@@ -45,10 +83,32 @@ int main(int argc, char **argv) {
   vshfloat.in_strobe = 0;
   vshfloat.eval();
 
+  // every exponent with both signs and both mantissa extremes
+  std::vector<int32_t> edges = {0, -1, INT32_MIN, INT32_MAX};
+  for (int b = 0; b < 31; b++) {
+    edges.push_back(int32_t(1) << b);
+    edges.push_back((int32_t(1) << b) - 1);
+    edges.push_back(-(int32_t(1) << b));
+    edges.push_back(-(int32_t(1) << b) - 1);
+  }
+  for (int32_t xi : edges) {
+    for (int32_t xq : edges) {
+      uint32_t hdl = hdl_pack(vshfloat, 0, xi, xq);
+      ASSERT(hdl == shfloat_pack(xi, xq),
+             std::cout << std::hex << xi << " " << xq << " " << hdl << " "
+                       << shfloat_pack(xi, xq) << std::endl);
+    }
+  }
+
   std::cout << std::hex << std::endl;
 
+  // the batch encoder is checked against the model in blocks
+  const size_t batch = 4096;
+  std::vector<int32_t> batch_i, batch_q;
+  std::vector<uint32_t> batch_hdl, batch_pack(batch);
+
   std::mt19937 rng(7);
-  size_t in = 1000 * 1000 * 1000 * 10;
+  size_t in = size_t(1000) * 1000 * 1000 * 10;
   for (size_t it = 0; it < in; it++) {
 
     if (it % 1000000 == 0) {
@@ -63,9 +123,10 @@ int main(int argc, char **argv) {
     int32_t xi = (rng() >> (rng() % 40));
     int32_t xq = (rng() >> (rng() % 40));
 
-    uint32_t xpack = pack_sample(xi, xq);
-    auto [yi, yq] = unpack_sample(xpack);
-    uint32_t ypack = pack_sample(yi, yq);
+    uint32_t xpack = shfloat_pack(xi, xq);
+    int32_t yi, yq;
+    shfloat_unpack(xpack, yi, yq);
+    uint32_t ypack = shfloat_pack(yi, yq);
     if (verbose) {
       std::cout << xi << " " << xq << " " << std::endl;
       std::cout << yi << " " << yq << " " << std::endl;
@@ -74,29 +135,30 @@ int main(int argc, char **argv) {
     }
     ASSERT(xpack == ypack);
 
-    vshfloat.in_index = index;
-    vshfloat.in_value_i = xi;
-    vshfloat.in_value_q = xq;
-    vshfloat.in_strobe = 1;
-    vshfloat.clk = 1;
-    vshfloat.eval();
-    vshfloat.in_strobe = 0;
-    vshfloat.clk = 0;
-    vshfloat.eval();
-    while (!vshfloat.out_strobe) {
-      vshfloat.clk = 1;
-      vshfloat.eval();
-      vshfloat.clk = 0;
-      vshfloat.eval();
-    }
-    ASSERT(vshfloat.out_index == index);
+    uint32_t hdl = hdl_pack(vshfloat, index, xi, xq);
     if (verbose) {
       std::cout << vshfloat.out_pack << " " << vshfloat.out_dbg_exp << " "
                 << vshfloat.out_dbg_i << " " << vshfloat.out_dbg_q << std::endl;
     }
-    ASSERT(vshfloat.out_pack == xpack, std::cout << xi << " " << xq << " "
-                                                 << vshfloat.out_pack << " "
-                                                 << xpack << std::endl);
+    ASSERT(hdl == xpack,
+           std::cout << xi << " " << xq << " " << hdl << " " << xpack
+                     << std::endl);
+
+    batch_i.push_back(xi);
+    batch_q.push_back(xq);
+    batch_hdl.push_back(hdl);
+    if (batch_hdl.size() == batch) {
+      shfloat_pack(batch_i.data(), batch_q.data(), batch_pack.data(), batch);
+      for (size_t k = 0; k < batch; k++) {
+        ASSERT(batch_pack[k] == batch_hdl[k],
+               std::cout << batch_i[k] << " " << batch_q[k] << " "
+                         << batch_hdl[k] << " " << batch_pack[k]
+                         << std::endl);
+      }
+      batch_i.clear();
+      batch_q.clear();
+      batch_hdl.clear();
+    }
 
     if (verbose) {
       std::cout << std::endl;